@@ -50,11 +50,11 @@ typedef struct config_s
     vna_pol_t
              vna_trig_pol;       //define the polarity of the VNA trigger invoke output
     uint8_t  hold_measure;       //hold for measurement when 1; continue to move pedestal during VNA sweep when 0;
-    uint8_t  sweep_rate_rps;     //axis rotation rate rads/sec;
-    int16_t  reference_angle;    //0-point reference for active axis
-    int16_t  start_angle;        //sweep start angle
-    int16_t  stop_angle;         //sweep stop  angle
-    uint16_t step_angle;         //meas  step  angle
+    uint32_t sweep_rate;         //continuous sweep rate, 1/1000 degree per second, 0 leaves it to the drive
+    int16_t  reference_angle;    //0-point reference for active axis, 0.1 degree
+    int16_t  start_angle;        //sweep start angle, 0.1 degree
+    int16_t  stop_angle;         //sweep stop  angle, 0.1 degree
+    uint16_t step_angle;         //meas  step  angle, 0.1 degree
 } config_t;
 
 typedef struct state_s
@@ -0,0 +1,78 @@
+/// @file hal.h
+///
+/// Hardware the SCPI layer drives, as tables of operations so the board,
+/// a simulator or a unit test can stand behind the same calls.
+///
+/// Author: Nathan Poppleton
+///
+/// Copyright: University of Utah, College of Engineering
+///
+
+#ifndef INC_HAL_H_
+#define INC_HAL_H_
+
+#include "stdint.h"
+
+#ifdef    __cplusplus
+extern "C" {
+#endif
+
+// ***********************************************
+/// Axis drive; called from the motion task only
+///
+/// Angles are in 1/SCPI_ANGLE_SCALE degree, as scpi_angle_t.
+///
+typedef struct hal_motion_s
+{
+    /// starts a move of axis towards target; 0, or < 0 when the drive refuses it
+    int                                 (*move)(void * user, int axis, int32_t target);
+
+    /// TRUE while axis is still moving
+    int                                 (*busy)(void * user, int axis);
+
+    void *                              user;
+
+    // optional, 0 when the drive has none; continuous sweeps need position
+
+    /// present angle of axis from its encoder
+    int32_t                             (*position)(void * user, int axis);
+
+    /// speed of the moves that follow, in 1/SCPI_ANGLE_SCALE degree per second; 0 restores the drive's own
+    int                                 (*rate)(void * user, int axis, uint32_t speed);
+
+    /// free running microsecond clock
+    uint32_t                            (*now)(void * user);
+
+    /// TRUE while a limit switch of axis is made; the drive stops there by itself
+    int                                 (*limit)(void * user, int axis);
+
+    /// brakes axis to rest where it is; busy stays TRUE until it stands
+    int                                 (*stop)(void * user, int axis);
+}   hal_motion_t;
+
+// ***********************************************
+/// VNA trigger output and ready input; called from the motion task only
+///
+/// ready reads FALSE from the trigger until the measurement it started is
+/// complete, however short; a board latches the ready edge in its
+/// interrupt to guarantee it.
+///
+typedef struct hal_vna_s
+{
+    /// sets the line polarities, TRUE for active high (config_t vna_trig_pol / vna_rdy_pol)
+    void                                (*polarity)(void * user, int trig_active_high, int rdy_active_high);
+
+    /// starts one measurement
+    void                                (*trigger)(void * user);
+
+    /// TRUE while the VNA is ready for a trigger
+    int                                 (*ready)(void * user);
+
+    void *                              user;
+}   hal_vna_t;
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* INC_HAL_H_ */
@@ -14,6 +14,8 @@
 #include "stddef.h"
 #include "stdint.h"
 
+#include "scpi_atomic.h"
+
 #ifdef    __cplusplus
 extern "C" {
 #endif
@@ -31,29 +33,33 @@ extern "C" {
 #define SCPI_RX_BFR_SZ  256
 #define SCPI_TX_BFR_SZ  256
 
+// ***********************************************
+/// Keywords, generated from scpi_tree.def
+///
 typedef enum scpi_menu_string_e
 {
-    k_scpi_str_unknown = 0,
-    k_scpi_str_opc,
-    k_scpi_str_idn,
-    k_scpi_str_rst,
-    k_scpi_str_input,
-    k_scpi_str_position,
-    k_scpi_str_a0,
-    k_scpi_str_a1,
-    k_scpi_str_a2,
-    k_scpi_str_a3,
-    k_scpi_str_angle,
-    k_scpi_str_immediate,
-    k_scpi_str_initiate,
-    k_scpi_str_direction,
-    k_scpi_str_limit,
-    k_scpi_str_low,
-    k_scpi_str_high,
-    k_scpi_str_state,
-    k_scpi_str_sense
+#define SCPI_KEYWORD(name, short_form, long_form)   k_scpi_str_##name,
+#include "scpi_tree.def"
+#undef  SCPI_KEYWORD
+    k_scpi_str_count                    //number of keywords, keep last
 }   scpi_menu_string_t;
 
+#define SCPI_KEYWORD_SHORT_SZ   8       //short form storage, including NUL
+#define SCPI_KEYWORD_LONG_SZ   16       //long form storage, including NUL
+
+// ***********************************************
+/// Keyword table entry; one per scpi_menu_string_t
+///
+/// Text is stored lowercase with the lengths precomputed so matching a
+/// token is a length check and a single compare.
+typedef struct scpi_keyword_s
+{
+    char                                short_form[SCPI_KEYWORD_SHORT_SZ];
+    char                                long_form[SCPI_KEYWORD_LONG_SZ];
+    uint8_t                             short_len;
+    uint8_t                             long_len;
+}   scpi_keyword_t;
+
 const char *                            scpi_str_short(scpi_menu_string_t item);
 const char *                            scpi_str_long(scpi_menu_string_t item);
 size_t                                  scpi_str_len_short(scpi_menu_string_t item);
@@ -64,103 +70,534 @@ size_t                                  scpi_str_len_long(scpi_menu_string_t ite
 int                                     scpi_is_menu_match(const char * menu, size_t len, scpi_menu_string_t item);
 
 // ***********************************************
-/// This is the top level root menu for the SCPI parser
+/// Case-insensitive compare of len characters against lowercase text
 ///
-/// Each value defines the starting value for the SCPI sub-menu enumerations it encompasses
-typedef enum scpi_menu_root_e
-{
-    k_scpi_root_none                    = 0,
-    k_scpi_root_q_idn                   = 0x2000,
-    k_scpi_root_rst                     = 0x4000,
-    k_scpi_root_opc                     = 0x6000,
-    k_scpi_root_q_opc                   = 0x8000,
-    k_scpi_root_input                   = 0xA000,
-    k_scpi_root_initiate                = 0xC000,
-    k_scpi_root_sense                   = 0xE000
-}   scpi_menu_root_t;
+/// Folds a word at a time, so neither side needs a tolower() pass or copy.
+///
+/// @returns                - TRUE when equal ignoring ASCII case
+///
+int                                     scpi_str_eq_nocase(const char * str, const char * lower, size_t len);
+
+// ***********************************************
+/// Matches a token against a list of candidate keywords
+///
+/// @param menu*[in]        - pointer to the token (any case)
+/// @param len[in]          - length of the token
+/// @param expect*[in]      - candidate keywords for the current menu level
+/// @param expect_sz[in]    - number of candidates
+///
+/// @returns                - the matched keyword, k_scpi_str_unknown if none
+///
+scpi_menu_string_t                      scpi_match_menu(const char * menu, size_t len, const scpi_menu_string_t * expect, size_t expect_sz);
 
 // ***********************************************
-/// This is the input sub-menu and some simple children
+/// Matches a keyword that carries a numeric suffix, e.g. A3
+///
+/// @param menu*[in]        - pointer to the token (any case)
+/// @param len[in]          - length of the token
+/// @param item[in]         - keyword the suffix is attached to
+/// @param suffix*[o]       - the suffix, 0..99
 ///
+/// @returns                - TRUE on a match
 ///
-typedef enum scpi_input_e
+int                                     scpi_match_suffix(const char * menu, size_t len, scpi_menu_string_t item, uint32_t * suffix);
+
+#define SCPI_NODE_QUERY         1       //leaf matched with a trailing '?'
+#define SCPI_NODE_COMMAND       2       //leaf matched without
+#define SCPI_NODE_SUFFIX        0x01    //menu keyword takes a numeric suffix
+
+// ***********************************************
+/// Event ids, one per node of scpi_tree.def in definition order
+///
+/// The id is the node's index in the parser tables.  k_scpi_first_<menu>
+/// marks where the children of <menu> start; the markers take no index.
+///
+typedef enum scpi_event_e
 {
-    k_scpi_input_none                    = 0,
-    k_scpi_input                         = k_scpi_root_input,           //0xA000
-    k_scpi_input_position                = 0x100 + k_scpi_root_input,
-    k_scpi_input_position_a0             = 0x200 + k_scpi_root_input,
-    k_scpi_input_position_a0_angle       = 0x220 + k_scpi_root_input,
-    k_scpi_input_position_a1             = 0x400 + k_scpi_root_input,
-    k_scpi_input_position_a1_angle       = 0x420 + k_scpi_root_input,
-    k_scpi_input_position_a2             = 0x600 + k_scpi_root_input,
-    k_scpi_input_position_a2_angle       = 0x620 + k_scpi_root_input,
-    k_scpi_input_position_a3             = 0x800 + k_scpi_root_input,
-    k_scpi_input_position_a3_angle       = 0x820 + k_scpi_root_input
-} scpi_menu_input_t;
+#define SCPI_CHILDREN(menu)                         k_scpi_first_##menu, k_scpi_first_##menu##_ = k_scpi_first_##menu - 1,
+#define SCPI_MENU(name, parent, keyword, flags)     k_scpi_##name,
+#define SCPI_LEAF(name, parent, keyword, type)      k_scpi_##name,
+#include "scpi_tree.def"
+#undef  SCPI_CHILDREN
+#undef  SCPI_MENU
+#undef  SCPI_LEAF
+    k_scpi_node_count                   //number of nodes, keep last
+}   scpi_event_t;
 
+typedef scpi_event_t                    scpi_menu_root_t;
 
 // ***********************************************
-/// This is the INPut:POSition:__axis__::angle: sub-menu(s)
+/// Nodes below a suffixed keyword carry the suffix in the event id
+///
+/// Only the A0 nodes are in the tree; axis n is its A0 node plus n strides.
 ///
+#define SCPI_AXIS_MAX                   8
+#define SCPI_AXIS_STRIDE                0x100u          //more than the node count, checked by scpi_tree.hpp
+
+#define SCPI_EVENT_AXIS(evt)            ((uint32_t)(evt) / SCPI_AXIS_STRIDE)
+#define SCPI_EVENT_NODE(evt)            ((uint32_t)(evt) % SCPI_AXIS_STRIDE)
+#define SCPI_AXIS_EVENT(node, axis)     ((uint32_t)(node) + (uint32_t)(axis) * SCPI_AXIS_STRIDE)
+
+// ***********************************************
+/// Names kept for existing callers; further axes use SCPI_AXIS_EVENT()
 ///
-typedef enum scpi_input_position_axis_angle_e
+#define SCPI_AXIS_NAMES(n)                                                                                                  \
+    k_scpi_input_position_a##n              = SCPI_AXIS_EVENT(k_scpi_input_position_a0,              n),                 \
+    k_scpi_input_position_a##n##_angle      = SCPI_AXIS_EVENT(k_scpi_input_position_a0_angle,        n),                 \
+    k_scpi_input_position_a##n##_immediate  = SCPI_AXIS_EVENT(k_scpi_input_position_a0_immediate,    n),                 \
+    k_scpi_input_position_a##n##_limit      = SCPI_AXIS_EVENT(k_scpi_input_position_a0_limit,        n),                 \
+    k_scpi_input_position_a##n##_limit_low  = SCPI_AXIS_EVENT(k_scpi_input_position_a0_limit_low,    n),                 \
+    k_scpi_input_position_a##n##_limit_high = SCPI_AXIS_EVENT(k_scpi_input_position_a0_limit_high,   n),                 \
+    k_scpi_input_position_a##n##_limit_state= SCPI_AXIS_EVENT(k_scpi_input_position_a0_limit_state,  n),                 \
+    k_scpi_input_position_a##n##_dir        = SCPI_AXIS_EVENT(k_scpi_input_position_a0_dir,          n)
+
+enum scpi_event_names_e
 {
-    k_scpi_input_position_axis_none     = 0,
-
-    k_scpi_input_position_a0_axis        =        k_scpi_input_position_a0_angle,
-    k_scpi_input_position_a0_immediate   = 0x1  + k_scpi_input_position_a0_axis,
-    k_scpi_input_position_a0_limit       = 0x20 + k_scpi_input_position_a0_axis,
-    k_scpi_input_position_a0_limit_low   = 0x1  + k_scpi_input_position_a0_limit,
-    k_scpi_input_position_a0_limit_high  = 0x2  + k_scpi_input_position_a0_limit,
-    k_scpi_input_position_a0_limit_state = 0x3  + k_scpi_input_position_a0_limit,
-    k_scpi_input_position_a0_dir         = 0x40 + k_scpi_input_position_a0_axis,
-
-    k_scpi_input_position_a1_axis        =        k_scpi_input_position_a1_angle,
-    k_scpi_input_position_a1_immediate   = 0x1  + k_scpi_input_position_a1_axis,
-    k_scpi_input_position_a1_limit       = 0x20 + k_scpi_input_position_a1_axis,
-    k_scpi_input_position_a1_limit_low   = 0x1  + k_scpi_input_position_a1_limit,
-    k_scpi_input_position_a1_limit_high  = 0x2  + k_scpi_input_position_a1_limit,
-    k_scpi_input_position_a1_limit_state = 0x3  + k_scpi_input_position_a1_limit,
-    k_scpi_input_position_a1_dir         = 0x40 + k_scpi_input_position_a1_axis,
-
-    k_scpi_input_position_a2_axis        =        k_scpi_input_position_a2_angle,
-    k_scpi_input_position_a2_immediate   = 0x1  + k_scpi_input_position_a2_axis,
-    k_scpi_input_position_a2_limit       = 0x20 + k_scpi_input_position_a2_axis,
-    k_scpi_input_position_a2_limit_low   = 0x1  + k_scpi_input_position_a2_limit,
-    k_scpi_input_position_a2_limit_high  = 0x2  + k_scpi_input_position_a2_limit,
-    k_scpi_input_position_a2_limit_state = 0x3  + k_scpi_input_position_a2_limit,
-    k_scpi_input_position_a2_dir         = 0x40  + k_scpi_input_position_a2_axis,
-
-    k_scpi_input_position_a3_axis        =        k_scpi_input_position_a3_angle,
-    k_scpi_input_position_a3_immediate   = 0x1  + k_scpi_input_position_a3_axis,
-    k_scpi_input_position_a3_limit       = 0x20 + k_scpi_input_position_a3_axis,
-    k_scpi_input_position_a3_limit_low   = 0x1  + k_scpi_input_position_a3_limit,
-    k_scpi_input_position_a3_limit_high  = 0x2  + k_scpi_input_position_a3_limit,
-    k_scpi_input_position_a3_limit_state = 0x3  + k_scpi_input_position_a3_limit,
-    k_scpi_input_position_a3_dir         = 0x40  + k_scpi_input_position_a3_axis
-} scpi_menu_input_position_axis_angle_t;
-
-typedef enum scpi_initiate_e
+    k_scpi_input                        = k_scpi_root_input,
+    k_scpi_initiate                     = k_scpi_root_initiate,
+    SCPI_AXIS_NAMES(1),
+    SCPI_AXIS_NAMES(2),
+    SCPI_AXIS_NAMES(3)
+};
+
+#define SCPI_MAX_LEVELS   8             //deepest header accepted, in menu levels
+
+// ***********************************************
+/// A single menu level of a header, as an offset/length into the Rx buffer
+///
+typedef struct scpi_token_s
 {
-    k_scpi_initiate_none                = 0,
-    k_scpi_initiate                     = 0xC00,
-    k_scpi_initiate_immediate           = 0xC01
-} scpi_menu_initiate_t;
+    uint16_t                            offset;
+    uint16_t                            len;
+}   scpi_token_t;
+
+// ***********************************************
+/// A program header split into its menu levels, plus the parameter span
+///
+typedef struct scpi_header_s
+{
+    scpi_token_t                        token[SCPI_MAX_LEVELS];
+    uint8_t                             count;          //number of menu levels found
+    uint8_t                             absolute;       //TRUE when the header started with ':'
+    uint16_t                            param_offset;   //first character after the header white space
+    uint16_t                            param_len;      //0 when no parameter was given
+}   scpi_header_t;
+
+// ***********************************************
+/// Splits a header into menu level tokens in a single pass
+///
+/// @param buffer*[in]  - pointer to the message
+/// @param len[in]      - length of the message
+/// @param hdr*[out]    - tokens and parameter span
+///
+/// @returns            -   0 on success
+///                     - < 0 for malformed headers (empty or too many levels)
+///
+int                                     scpi_tokenize(const char * buffer, size_t len, scpi_header_t * hdr);
 
 int                                     scpi_find_level(char * buffer, size_t len, int level, char ** found, size_t * found_len);
 
+// ***********************************************
+/// Standard SCPI error codes reported through the error queue
+///
+typedef enum scpi_err_e
+{
+    k_scpi_err_none                     = 0,
+    k_scpi_err_syntax                   = -102,
+    k_scpi_err_data_type                = -104,
+    k_scpi_err_missing_parameter        = -109,
+    k_scpi_err_undefined_header         = -113,
+    k_scpi_err_numeric_data             = -120,
+    k_scpi_err_invalid_char_in_number   = -121,
+    k_scpi_err_execution                = -200,
+    k_scpi_err_init_ignored             = -213,
+    k_scpi_err_settings_conflict        = -221,
+    k_scpi_err_out_of_range             = -222,
+    k_scpi_err_queue_overflow           = -350,
+    k_scpi_err_input_overrun            = -363
+}   scpi_err_t;
+
+// ***********************************************
+/// Fixed-point angle, in 1/SCPI_ANGLE_SCALE degree
+///
+/// Parsed straight from <NRf> text, no float or libc number parsing.
+///
+typedef int32_t                         scpi_angle_t;
+
+#define SCPI_ANGLE_SCALE                1000            //milli-degrees
+#define SCPI_ANGLE_DIGITS               3               //log10(SCPI_ANGLE_SCALE)
+#define SCPI_ANGLE_DEG(d)               ((scpi_angle_t)((d) * SCPI_ANGLE_SCALE))
+
+#ifndef SCPI_NUM_AXES
+#define SCPI_NUM_AXES                   8               //a0..a7, two positioners
+#endif
+#define SCPI_ANGLE_LIMIT_LOW_DEF        SCPI_ANGLE_DEG(-360)
+#define SCPI_ANGLE_LIMIT_HIGH_DEF       SCPI_ANGLE_DEG(360)
+
+// ***********************************************
+/// A numeric parameter after the MIN/MAX/DEF keywords have been resolved
+///
+typedef enum scpi_num_e
+{
+    k_scpi_num_none                     = 0,            //no parameter given
+    k_scpi_num_value,
+    k_scpi_num_min,
+    k_scpi_num_max,
+    k_scpi_num_def
+}   scpi_num_t;
+
+typedef struct scpi_param_s
+{
+    scpi_num_t                          kind;
+    scpi_angle_t                        value;          //valid for k_scpi_num_value
+}   scpi_param_t;
+
+// ***********************************************
+/// Per-axis settings written through the INPut:POSition:Ax:ANGLe menu
+///
+/// Shared by every connection; each field is a single word store.
+///
+typedef struct scpi_axis_s
+{
+    scpi_angle_t                        limit_low;
+    scpi_angle_t                        limit_high;
+    scpi_angle_t                        target;         //last accepted IMMediate angle
+    uint8_t                             limit_enabled;
+}   scpi_axis_t;
+
+// ***********************************************
+/// Parses SCPI <NRf> text (e.g. "12.5", "-9.0E1") into a fixed-point angle
+///
+/// Values are rounded to the nearest 1/SCPI_ANGLE_SCALE.
+///
+/// @returns            -   0 on success
+///                     - < 0 scpi_err_t code for malformed or oversized numbers
+///
+int                                     scpi_parse_nrf(const char * str, size_t len, scpi_angle_t * value);
+
+// ***********************************************
+/// Parses an <NRf> or MINimum / MAXimum / DEFault parameter
+///
+/// @returns            -   0 on success, param->kind is k_scpi_num_none for an empty parameter
+///                     - < 0 scpi_err_t code
+///
+int                                     scpi_parse_numeric(const char * str, size_t len, scpi_param_t * param);
+
+// ***********************************************
+/// Parses a <Boolean> parameter: ON | OFF | <NRf> (non-zero is ON)
+///
+/// @returns            -   0 on success
+///                     - < 0 scpi_err_t code
+///
+int                                     scpi_parse_bool(const char * str, size_t len, uint8_t * value);
+
+// ***********************************************
+/// Axis settings; axis is 0..SCPI_NUM_AXES-1, returns 0 otherwise
+///
+const scpi_axis_t *                     scpi_axis_get(int axis);
+
+// ***********************************************
+/// Restores every axis to its power-on settings (*RST)
+///
+void                                    scpi_axis_reset(void);
+
+#ifndef SCPI_ERR_QUEUE_SZ
+#define SCPI_ERR_QUEUE_SZ   8           //power of two; holds SCPI_ERR_QUEUE_SZ-1 entries, the last may be the overflow
+#endif
+
+// ***********************************************
+/// Error queue; any task or interrupt may push, only the context's own
+/// parser pops
+///
+/// Lock-free: a producer claims a position by advancing head with a
+/// compare and swap, writes the code and then publishes it through seq.
+/// Once the queue is full producers only raise the overflow flag, which is
+/// read back as k_scpi_err_queue_overflow after the queued errors.
+///
+typedef struct scpi_err_queue_s
+{
+    volatile int16_t                    code[SCPI_ERR_QUEUE_SZ];
+    volatile uint32_t                   seq[SCPI_ERR_QUEUE_SZ];     //position + 1 once code[] of that position is written
+    volatile uint32_t                   head;           //next position claimed, free running
+    volatile uint32_t                   tail;           //next position read, free running
+    volatile uint32_t                   overflow;       //TRUE when errors were dropped
+}   scpi_err_queue_t;
+
+#ifndef SCPI_HDR_CACHE_SZ
+#define SCPI_HDR_CACHE_SZ       8       //entries, power of two, at least 2; 0 for no cache
+#endif
+#ifndef SCPI_REPLY_SHARED
+#define SCPI_REPLY_SHARED       0       //1: every context replies into one buffer, for contexts that all run on one task
+#endif
+#define SCPI_HDR_CACHE_KEY_SZ   36      //longest header that is cached, e.g. ":INPUT:POSITION:A0:ANGLE:IMMEDIATE"
+
+// ***********************************************
+/// Header cache entry; a resolved header and where it leads
+///
+typedef struct scpi_hdr_cache_entry_s
+{
+    uint32_t                            hash;           //of the start state and folded header
+    uint32_t                            start;          //menu state the header was resolved from
+    uint32_t                            event;          //resolved menu state
+    uint32_t                            parent;         //path relative headers that follow continue from
+    uint8_t                             rc;             //1 query, 2 command
+    uint8_t                             len;            //header length, the parameter follows; 0 when unused
+    char                                hdr[SCPI_HDR_CACHE_KEY_SZ];     //lowercase header text
+}   scpi_hdr_cache_entry_t;
+
+// ***********************************************
+/// Two way set associative cache of resolved headers, skips the menu walk on a hit
+///
+typedef struct scpi_hdr_cache_s
+{
+#if SCPI_HDR_CACHE_SZ
+    scpi_hdr_cache_entry_t              entry[SCPI_HDR_CACHE_SZ];
+#endif
+    uint32_t                            hits;
+    uint32_t                            misses;
+}   scpi_hdr_cache_t;
+
+struct scpi_ctx_s;
+
+// ***********************************************
+/// Sends an unsolicited line (e.g. "SRQ 192") to the client of ctx
+///
+/// Called from the task that owns ctx, between replies, so it never splits
+/// one.
+///
+typedef void (*scpi_notify_fn)(struct scpi_ctx_s * ctx, const char * line, size_t len, void * user);
+
+// ***********************************************
+/// Parser context; one per connection so several clients can parse at once
+///
+/// Holds everything scpi_input() used to keep in function / file statics.
+/// The Rx buffer itself is parsed in place and is not copied.
+///
+/// With SCPI_REPLY_SHARED the reply is written to one buffer for all
+/// contexts and is valid until a message is run on any of them.  A message
+/// held on *OPC? / *WAI only ever appends to it, so a caller that sends the
+/// first ctx->reply_len bytes on SCPI_INPUT_WAIT right away needs only the
+/// bytes past those once the message completes.
+///
+typedef struct scpi_ctx_s
+{
+#if SCPI_REPLY_SHARED
+    uint8_t *                           reply;                      //NUL terminated reply, in the shared buffer
+#else
+    uint8_t                             reply[SCPI_TX_BFR_SZ];      //NUL terminated reply
+#endif
+    size_t                              reply_len;
+    scpi_err_queue_t                    errors;
+    uint32_t                            path;           //menu state relative headers start from (reset per message)
+    uint32_t                            event;          //last resolved menu state
+    const char *                        param;          //parameter text of the unit being executed
+    size_t                              param_len;      //0 when the unit has no parameter
+    volatile uint32_t                   esr;            //standard event status register, SCPI_ESR_*; set from any task
+    uint32_t                            ese;            //standard event status enable (*ESE)
+    uint32_t                            sre;            //service request enable (*SRE)
+    volatile uint32_t                   srq_rises;      //enabled ESR / error queue bits raised, counted
+    uint32_t                            srq_seen;       //service request count last looked at by scpi_srq_poll()
+    uint8_t                             srq_on;         //SYSTem:SRQ ON, this connection wants SRQ lines
+    scpi_notify_fn                      notify;         //sends an SRQ line to the client, 0 for none
+    void *                              notify_user;
+    uint32_t                            opc_idle;       //scpi_ops_idle() count when *OPC was received
+    uint8_t                             opc_armed;      //TRUE from *OPC until SCPI_ESR_OPC is set
+    uint8_t                             wait;           //SCPI_WAIT_* the message is held on
+    uint32_t                            wait_idle;      //scpi_ops_idle() count when the wait began
+    int                                 wait_rc;        //result of the unit that began the wait
+    const char *                        rest;           //units of the message still to run after the wait
+    size_t                              rest_len;
+    scpi_hdr_cache_t                    cache;
+}   scpi_ctx_t;
+
+// ***********************************************
+/// IEEE 488.2 status model
+///
+/// What follows from a connection's own commands is kept per context: the
+/// standard event status register, its enable, the service request enable
+/// and the error queue.  The OPERation and QUEStionable registers describe
+/// the instrument and are shared by every connection.
+///
+#define SCPI_ESR_OPC            0x01    //operation complete, set once the operations pending at *OPC finish
+#define SCPI_ESR_QYE            0x04    //query error, -4xx
+#define SCPI_ESR_DDE            0x08    //device dependent error, -3xx
+#define SCPI_ESR_EXE            0x10    //execution error, -2xx
+#define SCPI_ESR_CME            0x20    //command error, -1xx
+
+#define SCPI_STB_EAV            0x04    //error queue not empty
+#define SCPI_STB_QUES           0x08    //QUEStionable event & enable
+#define SCPI_STB_MAV            0x10    //message available; replies are never held, so always 0
+#define SCPI_STB_ESB            0x20    //ESR & ESE
+#define SCPI_STB_MSS            0x40    //master summary: the other bits & SRE
+#define SCPI_STB_OPER           0x80    //OPERation event & enable
+
+#define SCPI_OPER_SWEEPING      0x0008  //a measurement sweep is running
+#define SCPI_OPER_MOVING        0x0100  //an axis is moving or a move is queued
+#define SCPI_OPER_VNA_READY     0x0200  //the VNA ready input is asserted
+#define SCPI_OPER_POINT         0x0400  //pulsed as each sweep point is measured
+
+#define SCPI_QUES_LIMIT         0x0200  //an axis is on a limit
+#define SCPI_QUES_DRIVE         0x0400  //the drive refused the last move
+#define SCPI_QUES_LOG           0x0800  //the sweep log was full and a mark was dropped
+
+#define SCPI_STATUS_MASK        0x7fff  //condition, event and enable registers are 15 bit
+
+typedef enum scpi_status_reg_e
+{
+    k_scpi_reg_operation                = 0,
+    k_scpi_reg_questionable             = 1,
+    k_scpi_reg_count
+}   scpi_status_reg_t;
+
+#define SCPI_WAIT_NONE          0
+#define SCPI_WAIT_OPC_Q         1       //*OPC? replies once the pending operations finish
+#define SCPI_WAIT_WAI           2       //*WAI holds the units that follow
+
+#define SCPI_INPUT_WAIT         3       //scpi_input_ctx(): the message waits on pending operations
+
+// ***********************************************
+/// Prepares a parser context for a new connection
+///
+void                                    scpi_ctx_init(scpi_ctx_t * ctx);
+
+// ***********************************************
+/// Error queue access; codes are scpi_err_t values
+///
+/// scpi_error_push() is safe from any task or interrupt, e.g. a motion
+/// task reporting a failed move.  scpi_error_pop() and scpi_error_count()
+/// belong to the task parsing for ctx; pop returns k_scpi_err_none once
+/// the queue is empty.
+///
+void                                    scpi_error_push(scpi_ctx_t * ctx, int16_t code);
+int16_t                                 scpi_error_pop(scpi_ctx_t * ctx);
+uint32_t                                scpi_error_count(const scpi_ctx_t * ctx);
+
+// ***********************************************
+/// Pending operation tracker, shared by every connection
+///
+/// Whatever runs on after its command was acknowledged (a queued move)
+/// calls scpi_op_begin() when accepted and scpi_op_end() when finished;
+/// both are safe from any task or interrupt.  scpi_ops_idle() counts the
+/// times the pending count fell to zero, so a waiter that saw it change
+/// knows every operation it waited on has finished even if new ones began.
+///
+void                                    scpi_op_begin(void);
+void                                    scpi_op_end(void);
+uint32_t                                scpi_ops_pending(void);
+uint32_t                                scpi_ops_idle(void);
+
+// ***********************************************
+/// Standard event status register of ctx, SCPI_ESR_* bits; not cleared
+///
+uint32_t                                scpi_esr_get(scpi_ctx_t * ctx);
+
+// ***********************************************
+/// Status byte of ctx, SCPI_STB_* bits, as *STB? reads it
+///
+uint32_t                                scpi_stb_get(scpi_ctx_t * ctx);
+
+// ***********************************************
+/// Binds the transport for the SRQ lines of ctx; see scpi_srq_poll()
+///
+void                                    scpi_ctx_notify(scpi_ctx_t * ctx, scpi_notify_fn fn, void * user);
+
+// ***********************************************
+/// Pushes a service request to a subscribed client (SYSTem:SRQ ON)
+///
+/// Call from the task that owns ctx whenever it is idle or wakes, e.g. on
+/// a receive timeout.  When an enabled status bit rose since the last call
+/// and the status byte requests service (SCPI_STB_MSS), sends
+/// "SRQ <status byte>" through the notify function.  Each rise sends one
+/// line, even while the event bit it latched is still set, so a client can
+/// follow a sweep point by point without reading the event registers.
+/// Cheap when nothing changed: two loads and a compare.
+///
+/// @returns            - TRUE when a line was sent
+///
+int                                     scpi_srq_poll(scpi_ctx_t * ctx);
+
+// ***********************************************
+/// Raises / drops condition bits of an OPERation or QUEStionable register
+///
+/// Lock-free, safe from any task or interrupt: the motion task, a limit
+/// switch or the VNA ready input.  A bit that goes from 0 to 1 is latched
+/// in the event register until read or *CLS.
+///
+void                                    scpi_status_set(scpi_status_reg_t reg, uint32_t bits);
+void                                    scpi_status_clear(scpi_status_reg_t reg, uint32_t bits);
+uint32_t                                scpi_status_condition(scpi_status_reg_t reg);
+
+// ***********************************************
+/// Standard SCPI description of an error code, "" for unknown codes
+///
+const char *                            scpi_error_str(int16_t code);
+
+// ***********************************************
+/// Header cache counters; units that fail to resolve count as misses
+///
+void                                    scpi_hdr_cache_stats(const scpi_ctx_t * ctx, uint32_t * hits, uint32_t * misses);
+
+// ***********************************************
+/// Handler bound to a resolved menu state (event id)
+///
+/// @param ctx*[in]     - parser context; ctx->param holds the parameter text
+/// @param evt[in]      - the event the handler was registered for
+/// @param user*[in]    - pointer given to scpi_register_handler()
+///
+/// @returns            -   0 success; queries write their own reply with
+///                         scpi_reply_str(), commands are acknowledged by the parser
+///                     - < 0 scpi_err_t code, the command is rejected
+///
+typedef int (*scpi_handler_fn)(scpi_ctx_t * ctx, uint32_t evt, void * user);
+
+#define SCPI_HANDLER_TABLE_BITS 7
+#define SCPI_HANDLER_TABLE_SZ   (1u << SCPI_HANDLER_TABLE_BITS)     //must hold every bound event
+
+// ***********************************************
+/// Binds a handler to an event id, replacing the built-in one
+///
+/// Bind at start up, before any connection parses; the table is shared by
+/// every context and is not locked.  A 0 fn unbinds: the event is then
+/// acknowledged (command) or answered with nothing (query).
+///
+/// @returns            -   0 on success
+///                     - < 0 the table is full or evt is k_scpi_root_none
+///
+int                                     scpi_register_handler(uint32_t evt, scpi_handler_fn fn, void * user);
+
+// ***********************************************
+/// Drops every registration and binds the built-in handlers again
+///
+void                                    scpi_handlers_reset(void);
+
+// ***********************************************
+/// Binds the built-in handlers and restores every axis to its power-on
+/// settings.  Call once at start up, before any connection parses; the
+/// parser falls back to calling it on first use.
+///
+void                                    scpi_init(void);
+
+// ***********************************************
+/// Appends one reply to the reply of the current message; for query handlers
+///
+void                                    scpi_reply_str(scpi_ctx_t * ctx, const char * str);
+
 // *********************************************************************
 /// Raise an event after a scpi command has been parsed successfully / error if not
 ///
+/// Dispatches to the handler registered for evt.
+///
+/// @param ctx*[in]     - parser context the reply is written to; ctx->param
+///                       holds the parameter text of the command
 /// @param evt[in]      - This is the SCPI enumeration value cast to uint32_t
 ///
 /// @returns            -   0 for successfully processed an event
-///                     - < 0 for errors
+///                     - < 0 scpi_err_t code, the command is rejected
 ///
-int                                     scpi_query_event_handler(uint32_t evt);
-int                                     scpi_write_event_handler(uint32_t evt);
-int                                     scpi_error_event_handler();
-int                                     scpi_error_partial_event_handler();
+int                                     scpi_query_event_handler(scpi_ctx_t * ctx, uint32_t evt);
+int                                     scpi_write_event_handler(scpi_ctx_t * ctx, uint32_t evt);
+int                                     scpi_error_event_handler(scpi_ctx_t * ctx);
+int                                     scpi_error_partial_event_handler(scpi_ctx_t * ctx);
 
 // ***********************************************
 /// Handles a scpi menu item parsed from input string
@@ -177,6 +614,16 @@ int                                     scpi_handle_menu(const char * str, size_
 // ***********************************************
 /// Handles a top-level SCPI string being input from TCP
 ///
+/// A program message may hold several ';' separated units, e.g.
+/// ":INP:POS:A0:ANGL:LIM:LOW;HIGH;*OPC?".  Units run in order following the
+/// IEEE 488.2 relative path rules and their replies are coalesced into one
+/// ';' separated reply.  Processing stops at the first unit in error; the
+/// return value and event then describe that unit, otherwise the last one.
+///
+/// Uses a single shared context; not safe to call from several tasks.
+/// Connections that parse concurrently should each own a scpi_ctx_t and
+/// call scpi_input_ctx().
+///
 /// @param p_buf*[in]           - pointer to a Rx buffer
 /// @param len[in]              - length of the Rx buffer
 /// @param p_reply**[i/o]       - pointer to a string with a reply message
@@ -186,18 +633,55 @@ int                                     scpi_handle_menu(const char * str, size_
 /// @returns            -  0 proceed to next sub-menu
 ///                     -  2 indicates finished processing, with a command type
 ///                     -  1 indicates finished processing, with a query type
+///                     -  SCPI_INPUT_WAIT the message waits on pending operations (*OPC?, *WAI)
 ///                     - < 0 for errors
 ///
 int                                     scpi_input(const uint8_t * p_buf, size_t len, uint8_t ** p_reply, size_t * p_reply_len, uint32_t * evt);
 
+// ***********************************************
+/// Reentrant form of scpi_input(); the reply points into ctx->reply
+///
+/// *OPC? and *WAI hold the rest of the message while operations are
+/// pending: the call returns SCPI_INPUT_WAIT with no reply yet.  Only this
+/// connection waits; once scpi_input_blocked() turns FALSE the caller
+/// finishes the message with scpi_input_resume().  p_buf is parsed in place
+/// and must stay valid until then, and no other message may be given to
+/// ctx in between.
+///
+int                                     scpi_input_ctx(scpi_ctx_t * ctx, const uint8_t * p_buf, size_t len, uint8_t ** p_reply, size_t * p_reply_len, uint32_t * evt);
 
-int                                     scpi_menu_root_sm(scpi_menu_root_t *state, const char * str, size_t str_len );
+// ***********************************************
+/// TRUE while the message given to ctx waits on pending operations
+///
+int                                     scpi_input_blocked(const scpi_ctx_t * ctx);
 
-int                                     scpi_menu_input_sm(scpi_menu_input_t *state, const char * str, size_t str_len );
+// ***********************************************
+/// Runs the units held by *OPC? / *WAI and completes the reply
+///
+/// @returns            - as scpi_input_ctx(); SCPI_INPUT_WAIT again while
+///                       blocked or when a later unit waits in turn
+///
+int                                     scpi_input_resume(scpi_ctx_t * ctx, uint8_t ** p_reply, size_t * p_reply_len, uint32_t * evt);
 
-int                                     scpi_menu_input_pos_sm(scpi_menu_input_position_axis_angle_t *state, const char * str, size_t str_len );
 
-int                                     scpi_menu_initiate_sm(scpi_menu_initiate_t *state, const char * str, size_t str_len );
+// ***********************************************
+/// Advances the parser one menu level, walking the tables built from scpi_tree.def
+///
+/// @param state*[i/o]  - current state; k_scpi_root_none starts at the root menu
+/// @param str*[in]     - the menu level token
+/// @param str_len[in]  - length of the token
+///
+/// @returns            -  0 continue down submenus
+///                     -  1 finished, with a query type
+///                     -  2 finished, with a command type
+///                     - < 0 for errors
+///
+int                                     scpi_menu_sm(uint32_t *state, const char * str, size_t str_len );
+
+// ***********************************************
+/// Root menu level; a hash lookup rather than a walk of the root's children
+///
+int                                     scpi_menu_root_sm(scpi_menu_root_t *state, const char * str, size_t str_len );
 
 #ifdef  __cplusplus
 }
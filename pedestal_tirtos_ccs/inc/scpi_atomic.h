@@ -0,0 +1,169 @@
+/// @file scpi_atomic.h
+///
+/// Minimal atomics for the lock-free queues and counters shared between the
+/// network tasks, the motion task and interrupts.
+///
+/// GCC / Clang (host builds) use the __atomic builtins.  The TI ARM compiler
+/// uses the LDREX / STREX intrinsics; the Cortex-M4 is a single core, so
+/// program order is all the ordering needed and volatile operands keep the
+/// compiler from reordering.
+///
+/// Author: Nathan Poppleton
+///
+/// Copyright: University of Utah, College of Engineering
+///
+
+#ifndef INC_SCPI_ATOMIC_H_
+#define INC_SCPI_ATOMIC_H_
+
+#include "stdint.h"
+
+#ifdef    __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+
+static inline uint32_t scpi_atomic_load(const volatile uint32_t * p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void scpi_atomic_store(volatile uint32_t * p, uint32_t v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+// ***********************************************
+/// Compare and swap; on failure *expected is updated to the current value
+///
+/// @return TRUE when *p held *expected and now holds desired
+///
+static inline int scpi_atomic_cas(volatile uint32_t * p, uint32_t * expected, uint32_t desired)
+{
+    return __atomic_compare_exchange_n(p, expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ? 1 : 0;
+}
+
+static inline uint32_t scpi_atomic_exchange(volatile uint32_t * p, uint32_t v)
+{
+    return __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL);
+}
+
+// ***********************************************
+/// Adds delta (may be negative) to *p
+///
+/// @return the new value
+///
+static inline uint32_t scpi_atomic_add(volatile uint32_t * p, int32_t delta)
+{
+    return __atomic_add_fetch(p, (uint32_t)delta, __ATOMIC_ACQ_REL);
+}
+
+// ***********************************************
+/// Sets / keeps only the given bits of *p
+///
+/// @return the value before
+///
+static inline uint32_t scpi_atomic_or(volatile uint32_t * p, uint32_t bits)
+{
+    return __atomic_fetch_or(p, bits, __ATOMIC_ACQ_REL);
+}
+
+static inline uint32_t scpi_atomic_and(volatile uint32_t * p, uint32_t bits)
+{
+    return __atomic_fetch_and(p, bits, __ATOMIC_ACQ_REL);
+}
+
+#elif defined(__TI_ARM__)
+
+static inline uint32_t scpi_atomic_load(const volatile uint32_t * p)
+{
+    return *p;
+}
+
+static inline void scpi_atomic_store(volatile uint32_t * p, uint32_t v)
+{
+    *p = v;
+}
+
+static inline int scpi_atomic_cas(volatile uint32_t * p, uint32_t * expected, uint32_t desired)
+{
+    uint32_t cur;
+
+    do
+    {
+        cur = (uint32_t)__ldrex((void *)p);
+
+        if (cur != *expected)
+        {
+            __clrex();
+            *expected = cur;
+            return 0;
+        }
+
+    } while (__strex(desired, (void *)p));
+
+    return 1;
+}
+
+static inline uint32_t scpi_atomic_exchange(volatile uint32_t * p, uint32_t v)
+{
+    uint32_t cur;
+
+    do
+    {
+        cur = (uint32_t)__ldrex((void *)p);
+
+    } while (__strex(v, (void *)p));
+
+    return cur;
+}
+
+static inline uint32_t scpi_atomic_add(volatile uint32_t * p, int32_t delta)
+{
+    uint32_t cur;
+
+    do
+    {
+        cur = (uint32_t)__ldrex((void *)p) + (uint32_t)delta;
+
+    } while (__strex(cur, (void *)p));
+
+    return cur;
+}
+
+static inline uint32_t scpi_atomic_or(volatile uint32_t * p, uint32_t bits)
+{
+    uint32_t cur;
+
+    do
+    {
+        cur = (uint32_t)__ldrex((void *)p);
+
+    } while (__strex(cur | bits, (void *)p));
+
+    return cur;
+}
+
+static inline uint32_t scpi_atomic_and(volatile uint32_t * p, uint32_t bits)
+{
+    uint32_t cur;
+
+    do
+    {
+        cur = (uint32_t)__ldrex((void *)p);
+
+    } while (__strex(cur & bits, (void *)p));
+
+    return cur;
+}
+
+#else
+#error "scpi_atomic.h: no atomic operations for this compiler"
+#endif
+
+#ifdef    __cplusplus
+}
+#endif
+
+#endif /* INC_SCPI_ATOMIC_H_ */
@@ -0,0 +1,86 @@
+/// @file scpi_motion.h
+///
+/// Motion queue between the SCPI handlers and the motion task.
+///
+/// A command that starts a move only queues it and returns; the motion task
+/// runs the queued moves one after another in the order they were accepted.
+/// Every queued move is a pending operation (scpi_op_begin()) until the
+/// drive reports it finished, which is what *OPC, *OPC? and *WAI wait on.
+///
+/// Author: Nathan Poppleton
+///
+/// Copyright: University of Utah, College of Engineering
+///
+
+#ifndef INC_SCPI_MOTION_H_
+#define INC_SCPI_MOTION_H_
+
+#include "stddef.h"
+#include "stdint.h"
+
+#include "scpi.h"
+#include "hal.h"
+
+#ifdef    __cplusplus
+extern "C" {
+#endif
+
+#ifndef SCPI_MOTION_QUEUE_SZ
+#define SCPI_MOTION_QUEUE_SZ    8       //moves waiting for the motion task, power of two
+#endif
+
+// ***********************************************
+/// Binds the axis drive and drops every queued move
+///
+/// With no drive (hal is 0) moves complete as they are accepted and nothing
+/// is ever pending; the host unit tests and a board without a drive run so.
+/// Call at start up, before the motion task runs.
+///
+void                                    scpi_motion_init(const hal_motion_t * hal);
+
+// ***********************************************
+/// Queues a move of axis to target; safe from any task
+///
+/// @returns            -   0 the move is queued (or done, without a drive)
+///                     - < 0 k_scpi_err_execution when the queue is full
+///
+int                                     scpi_motion_submit(int axis, scpi_angle_t target);
+
+// ***********************************************
+/// One step of the motion task: retires a finished move and starts the next
+///
+/// Only the motion task calls it, e.g. every millisecond or when the drive
+/// signals.
+///
+/// @returns            - TRUE while a move runs or waits in the queue
+///
+int                                     scpi_motion_poll(void);
+
+// ***********************************************
+/// Drops every queued move that has not started; motion task only
+///
+/// The move already running is left to the drive, see hal_motion_t stop.
+/// The dropped moves end as pending operations.
+///
+void                                    scpi_motion_flush(void);
+
+// ***********************************************
+/// TRUE when a drive is bound
+///
+int                                     scpi_motion_bound(void);
+
+// ***********************************************
+/// The bound drive, 0 when there is none; its calls belong to the motion task
+///
+const hal_motion_t *                    scpi_motion_hal(void);
+
+// ***********************************************
+/// TRUE when no move runs and none is queued; motion task only
+///
+int                                     scpi_motion_idle(void);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* INC_SCPI_MOTION_H_ */
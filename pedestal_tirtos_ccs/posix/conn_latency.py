@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""Measures what a new connection costs the pedestal server: the time from
+connect() returning (the server's accept) to the first byte of the reply to
+*IDN?, over many short-lived connections.
+
+Neither the event loop nor the worker pool creates anything per client, so
+this is the cost of handing the socket over. Works against the POSIX build
+or the board:
+
+    python3 conn_latency.py [host] [port] [-n connections] [-c concurrent]
+"""
+
+import argparse
+import socket
+import threading
+import time
+
+
+def one(host, port):
+    """Seconds from connect to the first reply byte on a new connection"""
+    s = socket.create_connection((host, port))
+    s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    try:
+        t0 = time.perf_counter()
+        s.sendall(b"*IDN?\n")
+        if not s.recv(1):
+            raise ConnectionError("closed before the first byte")
+        return time.perf_counter() - t0
+    finally:
+        s.close()
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("host", nargs="?", default="127.0.0.1")
+    ap.add_argument("port", nargs="?", type=int, default=5025)
+    ap.add_argument("-n", type=int, default=1000, help="connections in all")
+    ap.add_argument("-c", type=int, default=1, help="connections open at once")
+    args = ap.parse_args()
+
+    times = []
+    lock = threading.Lock()
+
+    def client(count):
+        for _ in range(count):
+            t = one(args.host, args.port)
+            with lock:
+                times.append(t)
+
+    clients = [threading.Thread(target=client, args=(args.n // args.c,)) for _ in range(args.c)]
+    for c in clients:
+        c.start()
+    for c in clients:
+        c.join()
+
+    times.sort()
+    us = lambda q: times[min(len(times) - 1, int(q * len(times)))] * 1e6
+
+    print("%d connections, %d at once: accept to first byte p50 %.0f us, p99 %.0f us, max %.0f us"
+          % (len(times), args.c, us(0.5), us(0.99), times[-1] * 1e6))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,65 @@
+/*
+ *  ======== main_posix.c ========
+ *  Runs tcpEcho.c and tcpEchoHooks.c as a Linux daemon over the host's BSD
+ *  sockets, in place of main_tirtos.c, BIOS and the NDK.
+ *
+ *  netIPAddrHook() is called once, as the NDK does when DHCP hands out an
+ *  address, and starts tcpHandler on TCPPORT. The NDK file descriptor
+ *  sessions are not needed on a host and do nothing.
+ *
+ *  Author: Nathan Poppleton
+ *
+ *  Copyright: University of Utah, College of Engineering
+ */
+
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include <ti/display/Display.h>
+#include <ti/net/slnet.h>
+
+extern void netIPAddrHook(uint32_t IPAddr, unsigned int IfIdx, unsigned int fAdd);
+
+Display_Handle display;
+
+/*
+ *  ======== NDK stubs ========
+ */
+void fdOpenSession(void *task)
+{
+}
+
+void fdCloseSession(void *task)
+{
+}
+
+void *TaskSelf(void)
+{
+    return (void *)(uintptr_t)pthread_self();
+}
+
+int32_t ti_net_SlNet_initConfig(void)
+{
+    return (0);
+}
+
+/*
+ *  ======== main ========
+ */
+int main(void)
+{
+    /* a client that goes away mid-reply must fail send(), not end the daemon */
+    signal(SIGPIPE, SIG_IGN);
+
+    netIPAddrHook(htonl(INADDR_LOOPBACK), 1, 1);
+
+    /* the handler, worker and motion threads do the rest */
+    while (1) {
+        pause();
+    }
+
+    return (0);
+}
@@ -0,0 +1,15 @@
+/*
+ *    ======== Display.h ========
+ *    POSIX stand-in for the TI Display driver: every line goes to stderr.
+ */
+
+#ifndef ti_display_Display__include
+#define ti_display_Display__include
+
+#include <stdio.h>
+
+typedef void *Display_Handle;
+
+#define Display_printf(handle, line, column, ...) fprintf(stderr, __VA_ARGS__)
+
+#endif /* ti_display_Display__include */
@@ -0,0 +1,9 @@
+/*
+ *    ======== EMACMSP432E4.h ========
+ *    POSIX stand-in; nothing from this header is used off the target.
+ */
+
+#ifndef ti_drivers_emac_EMACMSP432E4__include
+#define ti_drivers_emac_EMACMSP432E4__include
+
+#endif /* ti_drivers_emac_EMACMSP432E4__include */
@@ -0,0 +1,14 @@
+/*
+ *    ======== netmain.h ========
+ *    POSIX stand-in for the NDK: the host stack's byte order helpers.
+ */
+
+#ifndef ti_ndk_inc_netmain__include
+#define ti_ndk_inc_netmain__include
+
+#include <arpa/inet.h>
+
+#define NDK_ntohl(x) ntohl(x)
+#define NDK_htonl(x) htonl(x)
+
+#endif /* ti_ndk_inc_netmain__include */
@@ -0,0 +1,9 @@
+/*
+ *    ======== slnetifndk.h ========
+ *    POSIX stand-in; nothing from this header is used off the target.
+ */
+
+#ifndef ti_ndk_slnetif_slnetifndk__include
+#define ti_ndk_slnetif_slnetifndk__include
+
+#endif /* ti_ndk_slnetif_slnetifndk__include */
@@ -0,0 +1,14 @@
+/*
+ *    ======== slnet.h ========
+ *    POSIX stand-in for SlNet; the host stack needs no interface set up.
+ */
+
+#ifndef ti_net_slnet__include
+#define ti_net_slnet__include
+
+#include <stdint.h>
+
+/* generated by SysConfig on the target; main_posix.c returns 0 */
+extern int32_t ti_net_SlNet_initConfig(void);
+
+#endif /* ti_net_slnet__include */
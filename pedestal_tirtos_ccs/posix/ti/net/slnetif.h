@@ -0,0 +1,9 @@
+/*
+ *    ======== slnetif.h ========
+ *    POSIX stand-in; nothing from this header is used off the target.
+ */
+
+#ifndef ti_net_slnetif__include
+#define ti_net_slnetif__include
+
+#endif /* ti_net_slnetif__include */
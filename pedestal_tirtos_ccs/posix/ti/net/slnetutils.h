@@ -0,0 +1,9 @@
+/*
+ *    ======== slnetutils.h ========
+ *    POSIX stand-in; nothing from this header is used off the target.
+ */
+
+#ifndef ti_net_slnetutils__include
+#define ti_net_slnetutils__include
+
+#endif /* ti_net_slnetutils__include */
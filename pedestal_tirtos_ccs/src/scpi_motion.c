@@ -0,0 +1,204 @@
+/// @file scpi_motion.c
+///
+/// Motion queue between the SCPI handlers and the motion task.
+///
+/// Author: Nathan Poppleton
+///
+/// Copyright: University of Utah, College of Engineering
+///
+
+#include "inc/scpi_motion.h"
+
+#include "string.h"
+#include "stdint.h"
+
+
+// ***********************************************
+/// Queued move
+///
+typedef struct scpi_move_s
+{
+    int32_t                             axis;
+    scpi_angle_t                        target;
+}   scpi_move_t;
+
+// ***********************************************
+/// Move queue; several network tasks push, the motion task pops
+///
+/// Same scheme as the error queue: a producer claims a position by
+/// advancing head with a compare and swap, writes the move and then
+/// publishes it through seq.
+///
+typedef struct scpi_motion_s
+{
+    const hal_motion_t *                hal;
+    scpi_move_t                         move[SCPI_MOTION_QUEUE_SZ];
+    volatile uint32_t                   seq[SCPI_MOTION_QUEUE_SZ];  //position + 1 once move[] of that position is written
+    volatile uint32_t                   head;           //next position claimed, free running
+    volatile uint32_t                   tail;           //next position popped, free running
+    int32_t                             active;         //axis being moved, -1 when idle; motion task only
+    uint32_t                            on_limit;       //bit per axis that ended its last move on a limit switch
+}   scpi_motion_t;
+
+//positions wrap freely, slots are picked with a mask
+typedef char scpi_motion_queue_pow2_t[(SCPI_MOTION_QUEUE_SZ >= 2 && !(SCPI_MOTION_QUEUE_SZ & (SCPI_MOTION_QUEUE_SZ - 1))) ? 1 : -1];
+
+static scpi_motion_t s_motion = { 0, { { 0, 0 } }, { 0 }, 0, 0, -1, 0 };
+
+
+// *********************************************************************
+//
+//
+void scpi_motion_init(const hal_motion_t * hal)
+{
+    //moves still running or queued were counted as pending
+    if (s_motion.active >= 0)
+        scpi_op_end();
+
+    for (; s_motion.tail != s_motion.head; s_motion.tail++)
+        scpi_op_end();
+
+    memset(&s_motion, 0, sizeof(s_motion));
+
+    s_motion.hal    = hal;
+    s_motion.active = -1;
+
+    scpi_status_clear(k_scpi_reg_operation, SCPI_OPER_MOVING);
+    scpi_status_clear(k_scpi_reg_questionable, SCPI_QUES_DRIVE | SCPI_QUES_LIMIT);
+}
+
+// *********************************************************************
+//
+//
+int scpi_motion_submit(int axis, scpi_angle_t target)
+{
+    uint32_t pos;
+
+    if (!s_motion.hal)
+        return 0;
+
+    pos = scpi_atomic_load(&s_motion.head);
+
+    do
+    {
+        if (pos - scpi_atomic_load(&s_motion.tail) >= SCPI_MOTION_QUEUE_SZ)
+            return k_scpi_err_execution;
+
+    } while (!scpi_atomic_cas(&s_motion.head, &pos, pos + 1));
+
+    //pending from the moment it is accepted, so an *OPC? that follows waits for it
+    scpi_op_begin();
+    scpi_status_set(k_scpi_reg_operation, SCPI_OPER_MOVING);
+
+    s_motion.move[pos & (SCPI_MOTION_QUEUE_SZ - 1)].axis   = axis;
+    s_motion.move[pos & (SCPI_MOTION_QUEUE_SZ - 1)].target = target;
+    scpi_atomic_store(&s_motion.seq[pos & (SCPI_MOTION_QUEUE_SZ - 1)], pos + 1);
+
+    return 0;
+}
+
+// *********************************************************************
+/// A move the drive refuses is retired at once and raises SCPI_QUES_DRIVE;
+/// the limits were checked when the command was accepted.  SCPI_QUES_LIMIT
+/// is raised while any axis ended its last move on a limit switch.
+///
+int scpi_motion_poll(void)
+{
+    const hal_motion_t * hal = s_motion.hal;
+    uint32_t    tail;
+    scpi_move_t move;
+
+    if (!hal)
+        return FALSE;
+
+    if (s_motion.active >= 0)
+    {
+        if (hal->busy(hal->user, s_motion.active))
+            return TRUE;
+
+        if (hal->limit && hal->limit(hal->user, s_motion.active))
+            s_motion.on_limit |=  (1u << s_motion.active);
+        else
+            s_motion.on_limit &= ~(1u << s_motion.active);
+
+        if (s_motion.on_limit)
+            scpi_status_set(k_scpi_reg_questionable, SCPI_QUES_LIMIT);
+        else
+            scpi_status_clear(k_scpi_reg_questionable, SCPI_QUES_LIMIT);
+
+        s_motion.active = -1;
+        scpi_op_end();
+    }
+
+    for (;;)
+    {
+        tail = s_motion.tail;
+
+        //a move still being written by another task is left for the next call
+        if (scpi_atomic_load(&s_motion.seq[tail & (SCPI_MOTION_QUEUE_SZ - 1)]) != tail + 1)
+            break;
+
+        move = s_motion.move[tail & (SCPI_MOTION_QUEUE_SZ - 1)];
+        scpi_atomic_store(&s_motion.tail, tail + 1);
+
+        if (0 <= hal->move(hal->user, move.axis, move.target))
+        {
+            scpi_status_clear(k_scpi_reg_questionable, SCPI_QUES_DRIVE);
+            s_motion.active = move.axis;
+            return TRUE;
+        }
+
+        scpi_status_set(k_scpi_reg_questionable, SCPI_QUES_DRIVE);
+        scpi_op_end();
+    }
+
+    if (tail != scpi_atomic_load(&s_motion.head))
+        return TRUE;
+
+    scpi_status_clear(k_scpi_reg_operation, SCPI_OPER_MOVING);
+
+    //a move queued since the check keeps the bit raised
+    if (tail != scpi_atomic_load(&s_motion.head))
+        scpi_status_set(k_scpi_reg_operation, SCPI_OPER_MOVING);
+
+    return FALSE;
+}
+
+// *********************************************************************
+/// A move another task is still writing stays queued, as in
+/// scpi_motion_poll(); SCPI_OPER_MOVING is left for the next poll to clear.
+///
+void scpi_motion_flush(void)
+{
+    uint32_t tail;
+
+    for (tail = s_motion.tail; scpi_atomic_load(&s_motion.seq[tail & (SCPI_MOTION_QUEUE_SZ - 1)]) == tail + 1; tail++)
+    {
+        scpi_atomic_store(&s_motion.tail, tail + 1);
+        scpi_op_end();
+    }
+}
+
+// *********************************************************************
+//
+//
+int scpi_motion_bound(void)
+{
+    return s_motion.hal ? TRUE : FALSE;
+}
+
+// *********************************************************************
+//
+//
+const hal_motion_t * scpi_motion_hal(void)
+{
+    return s_motion.hal;
+}
+
+// *********************************************************************
+//
+//
+int scpi_motion_idle(void)
+{
+    return s_motion.active < 0 && s_motion.tail == scpi_atomic_load(&s_motion.head);
+}
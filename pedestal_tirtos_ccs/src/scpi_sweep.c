@@ -0,0 +1,445 @@
+/// @file scpi_sweep.c
+///
+/// Measurement sweep started by INITiate[:IMMediate].
+///
+/// Author: Nathan Poppleton
+///
+/// Copyright: University of Utah, College of Engineering
+///
+
+#include "inc/scpi_sweep.h"
+#include "inc/scpi_motion.h"
+
+#include "string.h"
+#include "stdint.h"
+
+
+// ***********************************************
+/// Where the motion task is within the current point
+///
+typedef enum scpi_sweep_phase_e
+{
+    k_scpi_phase_idle                   = 0,
+    k_scpi_phase_begin                  = 1,            //published by scpi_sweep_start()
+    k_scpi_phase_move                   = 2,            //queue the move to the point
+    k_scpi_phase_settle                 = 3,            //wait for the axis to arrive
+    k_scpi_phase_arm                    = 4,            //wait for the VNA, then trigger
+    k_scpi_phase_measure                = 5,            //wait for the measurement
+    k_scpi_phase_run                    = 6,            //continuous: queue the run to the last point
+    k_scpi_phase_track                  = 7,            //continuous: trigger at each crossing
+    k_scpi_phase_finish                 = 8             //continuous: wait for the axis and the VNA
+}   scpi_sweep_phase_t;
+
+// ***********************************************
+/// Sweep state
+///
+/// busy is claimed by scpi_sweep_start() with a compare and swap; run and
+/// phase are then written before the motion task sees the new phase and
+/// belong to the motion task until it releases busy.
+///
+/// The log is a ring with the motion task as its only writer; readers
+/// claim a mark by advancing log_tail with a compare and swap, so a mark is
+/// never overwritten before it is read.
+///
+typedef struct scpi_sweep_s
+{
+    const hal_vna_t *                   vna;
+    config_t                            config;         //settings for the next sweep
+    config_t                            run;            //settings of the running sweep
+    volatile uint32_t                   busy;           //TRUE from start until the sweep is retired
+    volatile uint32_t                   phase;          //scpi_sweep_phase_t
+    volatile uint32_t                   abort;          //TRUE asks the motion task to stop
+    uint32_t                            point;          //motion task only
+    uint32_t                            points;         //written by scpi_sweep_start()
+    uint8_t                             ahead;          //the move to the next point is already queued
+    uint8_t                             continuous;     //trigger on position crossings
+    uint8_t                             rated;          //the drive runs at sweep_rate
+    uint32_t                            t0;             //drive clock at the start
+    scpi_sweep_mark_t                   log[SCPI_SWEEP_LOG_SZ];
+    volatile uint32_t                   log_head;       //next mark written, free running
+    volatile uint32_t                   log_tail;       //next mark read, free running
+}   scpi_sweep_t;
+
+//positions wrap freely, slots are picked with a mask
+typedef char scpi_sweep_log_pow2_t[(SCPI_SWEEP_LOG_SZ >= 2 && !(SCPI_SWEEP_LOG_SZ & (SCPI_SWEEP_LOG_SZ - 1))) ? 1 : -1];
+
+static scpi_sweep_t s_sweep;
+
+
+// *********************************************************************
+/// Target of point n of the running sweep
+///
+static scpi_angle_t scpi_sweep_angle(const config_t * cfg, int32_t n)
+{
+    int32_t step = (cfg->stop_angle < cfg->start_angle) ? -(int32_t)cfg->step_angle : (int32_t)cfg->step_angle;
+
+    return (scpi_angle_t)(cfg->reference_angle + cfg->start_angle + n * step) * (SCPI_ANGLE_SCALE / SCPI_SWEEP_ANGLE_SCALE);
+}
+
+// *********************************************************************
+/// TRUE once the axis at pos has reached point n, in the sweep's direction
+///
+static int scpi_sweep_reached(const config_t * cfg, scpi_angle_t pos, int32_t n)
+{
+    scpi_angle_t angle = scpi_sweep_angle(cfg, n);
+
+    return (cfg->stop_angle < cfg->start_angle) ? pos <= angle : pos >= angle;
+}
+
+// *********************************************************************
+/// Pulses the VNA trigger and logs the point at angle; motion task only
+///
+static void scpi_sweep_fire(const hal_motion_t * hal, scpi_angle_t angle)
+{
+    const hal_vna_t *   vna  = s_sweep.vna;
+    uint32_t            head = s_sweep.log_head;
+    scpi_sweep_mark_t * mark;
+
+    if (vna)
+        vna->trigger(vna->user);
+
+    if (head - scpi_atomic_load(&s_sweep.log_tail) >= SCPI_SWEEP_LOG_SZ)
+    {
+        scpi_status_set(k_scpi_reg_questionable, SCPI_QUES_LOG);
+        return;
+    }
+
+    mark = &s_sweep.log[head & (SCPI_SWEEP_LOG_SZ - 1)];
+    mark->point   = s_sweep.point;
+    mark->angle   = angle;
+    mark->time_us = (hal && hal->now) ? hal->now(hal->user) - s_sweep.t0 : 0;
+
+    scpi_atomic_store(&s_sweep.log_head, head + 1);
+}
+
+// *********************************************************************
+/// Ends the running sweep; motion task only
+///
+static void scpi_sweep_retire(void)
+{
+    const hal_motion_t * hal = scpi_motion_hal();
+
+    if (s_sweep.rated)
+        hal->rate(hal->user, (int)s_sweep.run.active_axis, 0);
+
+    s_sweep.rated = FALSE;
+    s_sweep.phase = k_scpi_phase_idle;
+
+    scpi_status_clear(k_scpi_reg_operation, SCPI_OPER_SWEEPING);
+    scpi_op_end();
+
+    scpi_atomic_store(&s_sweep.busy, FALSE);
+}
+
+// *********************************************************************
+//
+//
+void scpi_sweep_init(const hal_vna_t * vna)
+{
+    //a sweep still running was counted as pending
+    if (s_sweep.busy)
+        scpi_op_end();
+
+    memset(&s_sweep, 0, sizeof(s_sweep));
+
+    s_sweep.vna = vna;
+    scpi_sweep_config_reset();
+
+    scpi_status_clear(k_scpi_reg_operation, SCPI_OPER_SWEEPING | SCPI_OPER_POINT);
+    scpi_status_clear(k_scpi_reg_questionable, SCPI_QUES_LOG);
+}
+
+// *********************************************************************
+//
+//
+config_t * scpi_sweep_config(void)
+{
+    return &s_sweep.config;
+}
+
+// *********************************************************************
+//
+//
+void scpi_sweep_config_reset(void)
+{
+    config_t * cfg = &s_sweep.config;
+
+    memset(cfg, 0, sizeof(*cfg));
+
+    cfg->active_axis     = k_axis_a0;
+    cfg->vna_rdy_pol     = k_vna_pol_active_high;
+    cfg->vna_trig_pol    = k_vna_pol_active_high;
+    cfg->hold_measure    = 1;
+    cfg->step_angle      = SCPI_SWEEP_ANGLE_SCALE;
+}
+
+// *********************************************************************
+//
+//
+int scpi_sweep_start(void)
+{
+    config_t            cfg  = s_sweep.config;
+    const scpi_axis_t * axis = scpi_axis_get((int)cfg.active_axis);
+    uint32_t            busy = FALSE;
+    uint32_t            points;
+    scpi_angle_t        first;
+    scpi_angle_t        last;
+
+    if (!axis || !cfg.step_angle)
+        return k_scpi_err_settings_conflict;
+
+    first = scpi_sweep_angle(&cfg, 0);
+    last  = (scpi_angle_t)(cfg.reference_angle + cfg.stop_angle) * (SCPI_ANGLE_SCALE / SCPI_SWEEP_ANGLE_SCALE);
+
+    if (   axis->limit_enabled
+        && (   first < axis->limit_low || first > axis->limit_high
+            || last  < axis->limit_low || last  > axis->limit_high) )
+    {
+        return k_scpi_err_settings_conflict;
+    }
+
+    if (!scpi_atomic_cas(&s_sweep.busy, &busy, TRUE))
+        return k_scpi_err_init_ignored;
+
+    points = (uint32_t)((cfg.stop_angle < cfg.start_angle)
+                        ? cfg.start_angle - cfg.stop_angle
+                        : cfg.stop_angle  - cfg.start_angle) / cfg.step_angle + 1;
+
+    //nothing to wait for: every point completes as the sweep is accepted
+    if (!s_sweep.vna && !scpi_motion_bound())
+    {
+        scpi_status_set(k_scpi_reg_operation, SCPI_OPER_SWEEPING);
+
+        for (; points; points--)
+        {
+            scpi_status_set(k_scpi_reg_operation, SCPI_OPER_POINT);
+            scpi_status_clear(k_scpi_reg_operation, SCPI_OPER_POINT);
+        }
+
+        scpi_status_clear(k_scpi_reg_operation, SCPI_OPER_SWEEPING);
+        scpi_atomic_store(&s_sweep.busy, FALSE);
+
+        return 0;
+    }
+
+    s_sweep.run    = cfg;
+    s_sweep.points = points;
+    scpi_atomic_store(&s_sweep.abort, FALSE);
+
+    //pending from the moment it is accepted, so an *OPC? that follows waits for it
+    scpi_op_begin();
+    scpi_status_set(k_scpi_reg_operation, SCPI_OPER_SWEEPING);
+
+    scpi_atomic_store(&s_sweep.phase, k_scpi_phase_begin);
+
+    return 0;
+}
+
+// *********************************************************************
+//
+//
+void scpi_sweep_abort(void)
+{
+    if (scpi_atomic_load(&s_sweep.busy))
+        scpi_atomic_store(&s_sweep.abort, TRUE);
+}
+
+// *********************************************************************
+//
+//
+int scpi_sweep_log_pop(scpi_sweep_mark_t * mark)
+{
+    uint32_t tail = scpi_atomic_load(&s_sweep.log_tail);
+
+    //a reader that loses the race copied a mark that may be rewritten; it retries
+    do
+    {
+        if (tail == scpi_atomic_load(&s_sweep.log_head))
+            return FALSE;
+
+        *mark = s_sweep.log[tail & (SCPI_SWEEP_LOG_SZ - 1)];
+
+    } while (!scpi_atomic_cas(&s_sweep.log_tail, &tail, tail + 1));
+
+    return TRUE;
+}
+
+// *********************************************************************
+/// Runs phases until one has to wait.  A move the drive refuses ends the
+/// sweep, as does a continuous run that stops short of the next point.
+///
+int scpi_sweep_poll(void)
+{
+    const hal_vna_t *    vna = s_sweep.vna;
+    const hal_motion_t * hal = scpi_motion_hal();
+    const config_t *     cfg = &s_sweep.run;
+    int                  axis = (int)cfg->active_axis;
+    scpi_angle_t         pos;
+
+    if (vna)
+    {
+        if (vna->ready(vna->user))
+            scpi_status_set(k_scpi_reg_operation, SCPI_OPER_VNA_READY);
+        else
+            scpi_status_clear(k_scpi_reg_operation, SCPI_OPER_VNA_READY);
+    }
+
+    if (k_scpi_phase_idle == scpi_atomic_load(&s_sweep.phase))
+        return FALSE;
+
+    for (;;)
+    {
+        if (scpi_atomic_load(&s_sweep.abort))
+        {
+            //halt the axis before retiring restores the drive's own speed
+            if (hal && hal->stop)
+                hal->stop(hal->user, axis);
+
+            scpi_motion_flush();
+            scpi_sweep_retire();
+            return FALSE;
+        }
+
+        switch (s_sweep.phase)
+        {
+        case k_scpi_phase_begin:
+            s_sweep.point      = 0;
+            s_sweep.ahead      = FALSE;
+            s_sweep.continuous = (!cfg->hold_measure && hal && hal->position);
+            s_sweep.t0         = (hal && hal->now) ? hal->now(hal->user) : 0;
+
+            //the log restarts with the sweep
+            scpi_atomic_store(&s_sweep.log_tail, s_sweep.log_head);
+            scpi_status_clear(k_scpi_reg_questionable, SCPI_QUES_LOG);
+
+            if (vna && vna->polarity)
+            {
+                vna->polarity(vna->user, k_vna_pol_active_high == cfg->vna_trig_pol,
+                                         k_vna_pol_active_high == cfg->vna_rdy_pol);
+            }
+
+            s_sweep.phase = k_scpi_phase_move;
+            break;
+
+        case k_scpi_phase_move:
+            //a full queue is retried on the next call
+            if (scpi_motion_submit(axis, scpi_sweep_angle(cfg, (int32_t)s_sweep.point)) < 0)
+                return TRUE;
+
+            s_sweep.phase = k_scpi_phase_settle;
+            break;
+
+        case k_scpi_phase_settle:
+            if (!scpi_motion_idle())
+                return TRUE;
+
+            if (scpi_status_condition(k_scpi_reg_questionable) & SCPI_QUES_DRIVE)
+            {
+                scpi_sweep_retire();
+                return FALSE;
+            }
+
+            s_sweep.phase = k_scpi_phase_arm;
+            break;
+
+        case k_scpi_phase_arm:
+            if (vna && !vna->ready(vna->user))
+                return TRUE;
+
+            pos = scpi_sweep_angle(cfg, (int32_t)s_sweep.point);
+
+            if (hal && hal->position)
+                pos = hal->position(hal->user, axis);
+
+            scpi_sweep_fire(hal, pos);
+
+            if (s_sweep.continuous)
+            {
+                scpi_status_set(k_scpi_reg_operation, SCPI_OPER_POINT);
+                scpi_status_clear(k_scpi_reg_operation, SCPI_OPER_POINT);
+
+                s_sweep.phase = (++s_sweep.point < s_sweep.points) ? k_scpi_phase_run : k_scpi_phase_finish;
+                break;
+            }
+
+            if (!cfg->hold_measure && s_sweep.point + 1 < s_sweep.points)
+                s_sweep.ahead = (0 <= scpi_motion_submit(axis, scpi_sweep_angle(cfg, (int32_t)s_sweep.point + 1)));
+
+            s_sweep.phase = k_scpi_phase_measure;
+            break;
+
+        case k_scpi_phase_measure:
+            if (vna && !vna->ready(vna->user))
+                return TRUE;
+
+            scpi_status_set(k_scpi_reg_operation, SCPI_OPER_POINT);
+            scpi_status_clear(k_scpi_reg_operation, SCPI_OPER_POINT);
+
+            if (++s_sweep.point >= s_sweep.points)
+            {
+                scpi_sweep_retire();
+                return FALSE;
+            }
+
+            s_sweep.phase = s_sweep.ahead ? k_scpi_phase_settle : k_scpi_phase_move;
+            s_sweep.ahead = FALSE;
+            break;
+
+        case k_scpi_phase_run:
+            if (!s_sweep.rated && cfg->sweep_rate && hal->rate)
+            {
+                hal->rate(hal->user, axis, cfg->sweep_rate);
+                s_sweep.rated = TRUE;
+            }
+
+            if (scpi_motion_submit(axis, scpi_sweep_angle(cfg, (int32_t)s_sweep.points - 1)) < 0)
+                return TRUE;
+
+            s_sweep.phase = k_scpi_phase_track;
+            break;
+
+        case k_scpi_phase_track:
+            pos = hal->position(hal->user, axis);
+
+            while (s_sweep.point < s_sweep.points && scpi_sweep_reached(cfg, pos, (int32_t)s_sweep.point))
+            {
+                //late: the trigger waits for the VNA and the mark shows where it fired
+                if (vna && !vna->ready(vna->user))
+                    return TRUE;
+
+                scpi_sweep_fire(hal, pos);
+
+                scpi_status_set(k_scpi_reg_operation, SCPI_OPER_POINT);
+                scpi_status_clear(k_scpi_reg_operation, SCPI_OPER_POINT);
+
+                s_sweep.point++;
+            }
+
+            if (s_sweep.point >= s_sweep.points)
+            {
+                s_sweep.phase = k_scpi_phase_finish;
+                break;
+            }
+
+            //the move ended (or was refused) short of the next point
+            if (scpi_motion_idle())
+            {
+                scpi_sweep_retire();
+                return FALSE;
+            }
+
+            return TRUE;
+
+        case k_scpi_phase_finish:
+            if (!scpi_motion_idle() || (vna && !vna->ready(vna->user)))
+                return TRUE;
+
+            scpi_sweep_retire();
+            return FALSE;
+
+        default:
+            scpi_sweep_retire();
+            return FALSE;
+        }
+    }
+}
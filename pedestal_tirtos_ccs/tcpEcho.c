@@ -38,86 +38,834 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <errno.h>
 
 #include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
 /* BSD support */
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <sys/select.h>
+#endif
 
 #include <ti/net/slnetutils.h>
 
 #include <ti/display/Display.h>
 
-#include "inc\scpi.h"
+#include "inc/scpi.h"
+#include "inc/scpi_framer.h"
+#include "inc/scpi_motion.h"
+#include "inc/scpi_sweep.h"
 
-#define TCPPACKETSIZE 256
-#define NUMTCPWORKERS 3
 #define MAXPORTLEN    6
 
+/* connection server: 1 for one task multiplexing every client, 0 for a pool of worker tasks */
+#ifndef TCPEVENTLOOP
+#define TCPEVENTLOOP  1
+#endif
+#ifndef NUMTCPCONNS
+#define NUMTCPCONNS   16      /* clients the event loop serves at once */
+#endif
+
+/* one reply buffer for every connection only works while they run on one task */
+#if !TCPEVENTLOOP && SCPI_REPLY_SHARED
+#error "the worker pool needs a reply buffer per connection: build with SCPI_REPLY_SHARED 0"
+#endif
+
+/* with TCPEVENTLOOP 0: workers created up front on static stacks */
+#ifndef NUMTCPWORKERS
+#define NUMTCPWORKERS 3       /* pool workers, each serving one client at a time */
+#endif
+#ifndef TCPCONNQUEUE
+#define TCPCONNQUEUE  4       /* accepted clients waiting for a pool worker, power of two */
+#endif
+
+/* stack sizes may be set by the build; POSIX hosts need at least PTHREAD_STACK_MIN */
+#ifndef TCPWORKERSTACK
+#define TCPWORKERSTACK 3584   /* room for the per-connection SCPI context and framer */
+#endif
+#ifndef MOTIONSTACK
+#define MOTIONSTACK   1024
+#endif
+#define MOTIONPOLLUS  1000    /* motion task and *OPC? / *WAI wait period */
+#define SRQPOLLUS     5000    /* longest an SRQ line waits on an idle connection */
+
+/* axis drive; none on this board yet, so moves complete as they are accepted */
+#define MOTIONHAL     NULL
+
+/* VNA trigger / ready lines; none yet, so a sweep point counts as measured on arrival */
+#define VNAHAL        NULL
+
 extern Display_Handle display;
 
 extern void fdOpenSession();
 extern void fdCloseSession();
 extern void *TaskSelf();
 
+static const char overrunReply[] = "ERROR\n";
+
+#if !TCPEVENTLOOP
+
 /*
- *  ======== tcpWorker ========
- *  Task to handle TCP connection. Can be multiple Tasks running
- *  this function.
+ *  ======== srqNotify ========
+ *  Sends an SRQ line; runs on the task that owns the connection, between
+ *  replies.
  */
-void *tcpWorker(void *arg0)
+static void srqNotify(scpi_ctx_t *ctx, const char *line, size_t len, void *user)
 {
-    int  clientfd = *(int *)arg0;
-    int  bytesRcvd;
-    int  bytesSent;
-    char buffer[TCPPACKETSIZE];
-    char buffer_dbg[TCPPACKETSIZE];
+    send(*(int *)user, line, len, 0);
+}
+
+/*
+ *  ======== tcpSendReply ========
+ *  Sends the reply to one message and the event line that follows it.
+ */
+static int tcpSendReply(int clientfd, const uint8_t *reply, size_t reply_len, uint32_t event)
+{
+    char buffer_dbg[24];
+    int  dbgLen;
 
+    if (send(clientfd, reply, reply_len, 0) < 0) {
+        return (-1);
+    }
+
+    dbgLen = snprintf(buffer_dbg, sizeof(buffer_dbg), "event: 0x%04x\n", (unsigned int)event);
+
+    return (send(clientfd, buffer_dbg, dbgLen, 0));
+}
+
+/*
+ *  ======== tcpServe ========
+ *  Serves one TCP connection until the client closes it, then closes the
+ *  socket. Runs on a worker task.
+ */
+static void tcpServe(int clientfd)
+{
+    int  bytesRcvd;
+    int  bytesSent = 0;
+    int  status;
+    int  rc;
+    int  noDelay = 1;
+
+    uint8_t * dst;
+    size_t room;
+    const char * msg;
+    size_t msg_len;
     uint8_t * reply;
     size_t reply_len;
     uint32_t event;
+    struct timeval rcvTimeout;
+    scpi_ctx_t ctx;           /* parser state owned by this connection */
+    scpi_framer_t framer;     /* received bytes, framed in place */
 
-    fdOpenSession(TaskSelf());
+    scpi_ctx_init(&ctx);
+    scpi_ctx_notify(&ctx, srqNotify, &clientfd);
+    scpi_framer_init(&framer);
+
+    /* wake up now and then to push service requests to a quiet client */
+    rcvTimeout.tv_sec  = 0;
+    rcvTimeout.tv_usec = SRQPOLLUS;
+    setsockopt(clientfd, SOL_SOCKET, SO_RCVTIMEO, &rcvTimeout, sizeof(rcvTimeout));
+
+    /* a reply is two sends; do not hold the event line for the ACK of the reply */
+    setsockopt(clientfd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
 
-    Display_printf(display, 0, 0, "tcpWorker: start clientfd = 0x%x\n",
+    Display_printf(display, 0, 0, "tcpPoolWorker: start clientfd = 0x%x\n",
             clientfd);
 
-    while ((bytesRcvd = recv(clientfd, buffer, TCPPACKETSIZE, 0)) > 0) {
+    while (1) {
 
-        if (bytesRcvd < TCPPACKETSIZE)
-        {
-            if ('\n' == buffer[bytesRcvd-1])
-            {
-                buffer[bytesRcvd-1] = 0;  //Null terminate
-            }
+        room      = scpi_framer_room(&framer, &dst);
+        bytesRcvd = recv(clientfd, dst, room, 0);
+        if (bytesRcvd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            scpi_srq_poll(&ctx);
+            continue;
         }
-        //process SCPI input and get a pointer to reply
-        scpi_input((uint8_t*)buffer, (size_t)bytesRcvd, &reply, &reply_len, &event);
+        if (bytesRcvd <= 0) {
+            break;
+        }
+
+        scpi_framer_fill(&framer, (size_t)bytesRcvd);
+
+        /* TCP may split or merge messages; run each complete line */
+        while ((status = scpi_framer_pop(&framer, &msg, &msg_len)) != 0) {
 
-        bytesSent = send(clientfd, reply, reply_len, 0);
+            if (status < 0) {
+                /* message did not fit the framer and was dropped */
+                scpi_error_push(&ctx, k_scpi_err_input_overrun);
+                reply     = (uint8_t *)overrunReply;
+                reply_len = sizeof(overrunReply) - 1;
+                event     = 0;
+            }
+            else {
+                //process SCPI input and get a pointer to reply
+                rc = scpi_input_ctx(&ctx, (const uint8_t *)msg, msg_len, &reply, &reply_len, &event);
+
+                /* *OPC? and *WAI hold the message until the moves finish; only this connection waits */
+                while (rc == SCPI_INPUT_WAIT) {
+                    while (scpi_input_blocked(&ctx)) {
+                        scpi_srq_poll(&ctx);
+                        usleep(MOTIONPOLLUS);
+                    }
+                    rc = scpi_input_resume(&ctx, &reply, &reply_len, &event);
+                }
+            }
 
-        snprintf(buffer_dbg, 40, "event: 0x%04x\n", event);
-        bytesSent = send(clientfd, buffer_dbg, 14, 0);
+            bytesSent = tcpSendReply(clientfd, reply, reply_len, event);
+            if (bytesSent < 0) {
+                break;
+            }
+
+            scpi_srq_poll(&ctx);
+        }
 
-        if (bytesSent < 0 || bytesSent != bytesRcvd) {
+        if (bytesSent < 0) {
             Display_printf(display, 0, 0, "send failed.\n");
             break;
         }
     }
-    Display_printf(display, 0, 0, "tcpWorker stop clientfd = 0x%x\n", clientfd);
+    Display_printf(display, 0, 0, "tcpPoolWorker stop clientfd = 0x%x\n", clientfd);
 
     close(clientfd);
+}
 
-    fdCloseSession(TaskSelf());
+/*
+ *  ======== tcpConnQueue ========
+ *  Accepted clients on their way from tcpHandler to the pool. While it is
+ *  full tcpHandler stops accepting and later clients wait in the listen
+ *  backlog.
+ */
+static int             tcpConnQueue[TCPCONNQUEUE];
+static unsigned int    tcpConnHead;         /* next entry written, free running */
+static unsigned int    tcpConnTail;         /* next entry read, free running */
+static pthread_mutex_t tcpConnLock;
+static pthread_cond_t  tcpConnNotEmpty;
+static pthread_cond_t  tcpConnNotFull;
 
-    return (NULL);
+/* worker stacks are set aside once, so serving clients never touches the heap */
+static uint64_t        tcpWorkerStacks[NUMTCPWORKERS][TCPWORKERSTACK / sizeof(uint64_t)];
+
+static void tcpConnPut(int clientfd)
+{
+    pthread_mutex_lock(&tcpConnLock);
+
+    while (tcpConnHead - tcpConnTail >= TCPCONNQUEUE) {
+        pthread_cond_wait(&tcpConnNotFull, &tcpConnLock);
+    }
+
+    tcpConnQueue[tcpConnHead++ & (TCPCONNQUEUE - 1)] = clientfd;
+
+    pthread_cond_signal(&tcpConnNotEmpty);
+    pthread_mutex_unlock(&tcpConnLock);
+}
+
+static int tcpConnTake(void)
+{
+    int clientfd;
+
+    pthread_mutex_lock(&tcpConnLock);
+
+    while (tcpConnHead == tcpConnTail) {
+        pthread_cond_wait(&tcpConnNotEmpty, &tcpConnLock);
+    }
+
+    clientfd = tcpConnQueue[tcpConnTail++ & (TCPCONNQUEUE - 1)];
+
+    pthread_cond_signal(&tcpConnNotFull);
+    pthread_mutex_unlock(&tcpConnLock);
+
+    return (clientfd);
+}
+
+/*
+ *  ======== tcpPoolWorker ========
+ *  Pool task; serves the queued clients one after the other.
+ */
+void *tcpPoolWorker(void *arg0)
+{
+    fdOpenSession(TaskSelf());
+
+    while (1) {
+        tcpServe(tcpConnTake());
+    }
+}
+
+/*
+ *  ======== tcpPoolStart ========
+ *  Creates the hand-off queue and the NUMTCPWORKERS pool tasks on their
+ *  static stacks.
+ */
+static int tcpPoolStart(void)
+{
+    pthread_t          thread;
+    pthread_attr_t     attrs;
+    struct sched_param priParam;
+    int                retc;
+    int                i;
+
+    retc  = pthread_mutex_init(&tcpConnLock, NULL);
+    retc |= pthread_cond_init(&tcpConnNotEmpty, NULL);
+    retc |= pthread_cond_init(&tcpConnNotFull, NULL);
+
+    for (i = 0; i < NUMTCPWORKERS && retc == 0; i++) {
+        pthread_attr_init(&attrs);
+        priParam.sched_priority = 3;
+        pthread_attr_setdetachstate(&attrs, PTHREAD_CREATE_DETACHED);
+        pthread_attr_setschedparam(&attrs, &priParam);
+
+        retc  = pthread_attr_setstack(&attrs, tcpWorkerStacks[i], sizeof(tcpWorkerStacks[i]));
+        retc |= pthread_create(&thread, &attrs, tcpPoolWorker, NULL);
+    }
+
+    return (retc);
+}
+
+#endif /* !TCPEVENTLOOP */
+
+#if TCPEVENTLOOP
+
+/* output a client is not taking yet waits in a spare, so the loop never blocks on a send */
+#ifndef TCPOUTBUFS
+#define TCPOUTBUFS    3       /* spares shared by the connections */
+#endif
+#define TCPOUTBUFSZ   (SCPI_TX_BFR_SZ + 24)   /* a reply and its event line, or an SRQ line */
+
+/* readiness reported by tcpPollWait */
+#define TCPREADY_IN   1
+#define TCPREADY_OUT  2
+
+/*
+ *  ======== tcpConn ========
+ *  One client of the event loop. The slots are static, so a connection
+ *  costs its parser context and framer but no task stack; it receives
+ *  straight into the framer.
+ */
+typedef struct tcpConn {
+    int            fd;          /* -1 while the slot is free */
+    int8_t         out;         /* spare holding output the client has not taken, -1 for none */
+    uint8_t        held;        /* a message waits on *OPC? / *WAI */
+    uint8_t        reading;     /* watched for input; not while held or output is pending */
+    uint8_t        events;      /* TCPREADY_* watched for, 0 while out of the poll set */
+    uint8_t        framing;     /* received bytes may hold messages not yet run */
+    uint16_t       outOff;      /* pending output is out[outOff .. outLen) */
+    uint16_t       outLen;
+    uint16_t       sent;        /* reply bytes of the held message already sent */
+    scpi_ctx_t     ctx;
+    scpi_framer_t  framer;
+} tcpConn;
+
+static tcpConn tcpConns[NUMTCPCONNS];
+
+static char    tcpOutBufs[TCPOUTBUFS][TCPOUTBUFSZ];
+static uint8_t tcpOutBusy[TCPOUTBUFS];
+static int     tcpOutIdle = TCPOUTBUFS;   /* spares free; a message only runs while one is */
+
+#ifdef __linux__
+
+/*
+ *  ======== tcpPoll* ========
+ *  Readiness of the listening socket and the connections: epoll on Linux,
+ *  select() (fdSelect) on the NDK. Index NUMTCPCONNS is the listening socket.
+ */
+static int tcpPollFd = -1;
+
+static int tcpPollInit(int server)
+{
+    struct epoll_event ev;
+
+    tcpPollFd = epoll_create1(0);
+
+    ev.events   = EPOLLIN;
+    ev.data.u32 = NUMTCPCONNS;
+
+    return ((tcpPollFd < 0) ? -1 : epoll_ctl(tcpPollFd, EPOLL_CTL_ADD, server, &ev));
+}
+
+/* a connection watched for nothing is taken out of the set: epoll reports
+ * EPOLLHUP / EPOLLERR whatever it is asked for, and would spin on it */
+static void tcpPollWatch(int index)
+{
+    tcpConn           *c = &tcpConns[index];
+    struct epoll_event ev;
+    int                events;
+
+    events = (c->reading ? TCPREADY_IN : 0) | ((c->out >= 0) ? TCPREADY_OUT : 0);
+    if (events == c->events) {
+        return;
+    }
+
+    ev.events   = ((events & TCPREADY_IN) ? EPOLLIN : 0) | ((events & TCPREADY_OUT) ? EPOLLOUT : 0);
+    ev.data.u32 = index;
+
+    epoll_ctl(tcpPollFd, !c->events ? EPOLL_CTL_ADD : !events ? EPOLL_CTL_DEL : EPOLL_CTL_MOD, c->fd, &ev);
+
+    c->events = events;
+}
+
+static int tcpPollWait(int server, uint8_t ready[NUMTCPCONNS + 1], uint32_t timeoutUs)
+{
+    struct epoll_event ev[NUMTCPCONNS + 1];
+    int n;
+    int i;
+
+    n = epoll_wait(tcpPollFd, ev, NUMTCPCONNS + 1, (timeoutUs + 999) / 1000);
+
+    /* a hang-up or error shows as a failed recv() or send() */
+    for (i = 0; i < n; i++) {
+        ready[ev[i].data.u32] = ((ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) ? TCPREADY_IN : 0) |
+                                ((ev[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) ? TCPREADY_OUT : 0);
+    }
+
+    return ((n < 0 && errno != EINTR) ? -1 : 0);
+}
+
+#else
+
+static int tcpPollInit(int server)
+{
+    return (0);
+}
+
+static void tcpPollWatch(int index)
+{
+    tcpConn *c = &tcpConns[index];
+
+    c->events = (c->reading ? TCPREADY_IN : 0) | ((c->out >= 0) ? TCPREADY_OUT : 0);
+}
+
+static int tcpPollWait(int server, uint8_t ready[NUMTCPCONNS + 1], uint32_t timeoutUs)
+{
+    fd_set         readfds;
+    fd_set         writefds;
+    struct timeval timeout;
+    int            maxfd = server;
+    int            n;
+    int            i;
+
+    FD_ZERO(&readfds);
+    FD_ZERO(&writefds);
+    FD_SET(server, &readfds);
+
+    for (i = 0; i < NUMTCPCONNS; i++) {
+        if (tcpConns[i].fd >= 0 && tcpConns[i].events) {
+            if (tcpConns[i].events & TCPREADY_IN) {
+                FD_SET(tcpConns[i].fd, &readfds);
+            }
+            if (tcpConns[i].events & TCPREADY_OUT) {
+                FD_SET(tcpConns[i].fd, &writefds);
+            }
+            maxfd = (tcpConns[i].fd > maxfd) ? tcpConns[i].fd : maxfd;
+        }
+    }
+
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = timeoutUs;
+
+    n = select(maxfd + 1, &readfds, &writefds, NULL, &timeout);
+    if (n <= 0) {
+        return ((n < 0 && errno != EINTR) ? -1 : 0);
+    }
+
+    ready[NUMTCPCONNS] = FD_ISSET(server, &readfds) ? TCPREADY_IN : 0;
+
+    for (i = 0; i < NUMTCPCONNS; i++) {
+        if (tcpConns[i].fd >= 0 && tcpConns[i].events) {
+            ready[i] = (FD_ISSET(tcpConns[i].fd, &readfds) ? TCPREADY_IN : 0) |
+                       (FD_ISSET(tcpConns[i].fd, &writefds) ? TCPREADY_OUT : 0);
+        }
+    }
+
+    return (0);
+}
+
+#endif
+
+/*
+ *  ======== tcpConnSend ========
+ *  Sends what the socket takes now and parks the rest in a spare, behind
+ *  any output already pending. The caller makes sure a spare is free
+ *  (tcpOutIdle) before the output is made, so nothing is ever dropped.
+ */
+static int tcpConnSend(tcpConn *c, const void *data, size_t len)
+{
+    int sent = 0;
+    int i;
+
+    if (c->out < 0) {
+        sent = send(c->fd, data, len, 0);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return (-1);
+            }
+            sent = 0;
+        }
+        if ((size_t)sent == len) {
+            return (0);
+        }
+
+        for (i = 0; tcpOutBusy[i]; i++);
+
+        tcpOutBusy[i] = 1;
+        tcpOutIdle--;
+
+        c->out    = i;
+        c->outOff = 0;
+        c->outLen = 0;
+    }
+
+    memcpy(&tcpOutBufs[c->out][c->outLen], (const char *)data + sent, len - sent);
+    c->outLen += len - sent;
+
+    return (0);
+}
+
+/*
+ *  ======== tcpConnFlush ========
+ *  Sends the pending output the socket takes now; the spare is free again
+ *  once all of it is gone.
+ */
+static int tcpConnFlush(tcpConn *c)
+{
+    int sent;
+
+    sent = send(c->fd, &tcpOutBufs[c->out][c->outOff], c->outLen - c->outOff, 0);
+    if (sent < 0) {
+        return ((errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1);
+    }
+
+    c->outOff += sent;
+
+    if (c->outOff == c->outLen) {
+        tcpOutBusy[c->out] = 0;
+        tcpOutIdle++;
+        c->out = -1;
+    }
+
+    return (0);
+}
+
+/*
+ *  ======== tcpConnReply ========
+ *  Sends the reply to one message and the event line that follows it.
+ */
+static int tcpConnReply(tcpConn *c, const uint8_t *reply, size_t reply_len, uint32_t event)
+{
+    char buffer_dbg[24];
+    int  dbgLen;
+
+    if (tcpConnSend(c, reply, reply_len) < 0) {
+        return (-1);
+    }
+
+    dbgLen = snprintf(buffer_dbg, sizeof(buffer_dbg), "event: 0x%04x\n", (unsigned int)event);
+
+    return (tcpConnSend(c, buffer_dbg, dbgLen));
+}
+
+/*
+ *  ======== srqNotify ========
+ *  Sends an SRQ line; scpi_srq_poll() is only called on a connection with
+ *  no output pending and a spare free, so the line is deferred, never
+ *  dropped.
+ */
+static void srqNotify(scpi_ctx_t *ctx, const char *line, size_t len, void *user)
+{
+    tcpConnSend((tcpConn *)user, line, len);
+}
+
+/*
+ *  ======== tcpConnRun ========
+ *  Runs the complete messages received on a connection until its bytes
+ *  are used up, a message is held on *OPC? / *WAI, or a reply is left
+ *  pending on the client; a held message is resumed once the moves it
+ *  waits on are done. Never blocks.
+ */
+static int tcpConnRun(tcpConn *c)
+{
+    const char * msg;
+    size_t msg_len;
+    uint8_t * reply;
+    size_t reply_len;
+    uint32_t event;
+    int status;
+    int rc;
+
+    if (c->held) {
+        if (scpi_input_blocked(&c->ctx) || (c->out < 0 && !tcpOutIdle)) {
+            return (0);
+        }
+
+        rc = scpi_input_resume(&c->ctx, &reply, &reply_len, &event);
+        if (rc == SCPI_INPUT_WAIT) {
+            return (0);
+        }
+
+        c->held = 0;
+
+        /* the reply before the wait went out when the message was held */
+        rc      = tcpConnReply(c, reply + c->sent, reply_len - c->sent, event);
+        c->sent = 0;
+        if (rc < 0) {
+            return (-1);
+        }
+    }
+
+    /* the held message and the bytes after it stay in the framer until it is done;
+     * so do those after a reply the client has not taken */
+    while (c->out < 0 && tcpOutIdle && c->framing) {
+
+        status = scpi_framer_pop(&c->framer, &msg, &msg_len);
+        if (status == 0) {
+            c->framing = 0;
+            break;
+        }
+
+        if (status < 0) {
+            scpi_error_push(&c->ctx, k_scpi_err_input_overrun);
+            reply     = (uint8_t *)overrunReply;
+            reply_len = sizeof(overrunReply) - 1;
+            event     = 0;
+        }
+        else {
+            rc = scpi_input_ctx(&c->ctx, (const uint8_t *)msg, msg_len, &reply, &reply_len, &event);
+            if (rc == SCPI_INPUT_WAIT) {
+                /* the reply buffer may be shared (SCPI_REPLY_SHARED); what it has
+                 * so far is sent now, only the rest once the message is done */
+                c->held = 1;
+                c->sent = c->ctx.reply_len;
+                return (tcpConnSend(c, c->ctx.reply, c->sent));
+            }
+        }
+
+        if (tcpConnReply(c, reply, reply_len, event) < 0) {
+            return (-1);
+        }
+
+        if (c->out < 0) {
+            scpi_srq_poll(&c->ctx);
+        }
+    }
+
+    return (0);
+}
+
+/*
+ *  ======== tcpConnOpen ========
+ *  Serves an accepted client from a free slot, or closes it when all are
+ *  taken.
+ */
+static void tcpConnOpen(int clientfd)
+{
+    tcpConn *c;
+    int      optval;
+    int      i;
+
+    for (i = 0; i < NUMTCPCONNS && tcpConns[i].fd >= 0; i++);
+
+    if (i == NUMTCPCONNS) {
+        Display_printf(display, 0, 0, "tcpEventLoop: no free connection for clientfd = 0x%x\n", clientfd);
+        close(clientfd);
+        return;
+    }
+
+    /* a reply is two sends; do not hold the event line for the ACK of the reply */
+    optval = 1;
+    setsockopt(clientfd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+
+    /* a client that does not read must not stall the others */
+    fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL, 0) | O_NONBLOCK);
+
+    c = &tcpConns[i];
+    c->fd      = clientfd;
+    c->held    = 0;
+    c->reading = 1;
+    c->events  = 0;
+    c->out     = -1;
+    c->framing = 0;
+    c->sent    = 0;
+    scpi_ctx_init(&c->ctx);
+    scpi_ctx_notify(&c->ctx, srqNotify, c);
+    scpi_framer_init(&c->framer);
+    tcpPollWatch(i);
+
+    Display_printf(display, 0, 0, "tcpConn start clientfd = 0x%x\n", clientfd);
+}
+
+/*
+ *  ======== tcpConnClose ========
+ */
+static void tcpConnClose(tcpConn *c)
+{
+    Display_printf(display, 0, 0, "tcpConn stop clientfd = 0x%x\n", c->fd);
+
+    if (c->out >= 0) {
+        tcpOutBusy[c->out] = 0;
+        tcpOutIdle++;
+        c->out = -1;
+    }
+
+    close(c->fd);
+    c->fd = -1;
+}
+
+/*
+ *  ======== tcpEventLoop ========
+ *  Serves every client from the calling task: accepts into a free slot,
+ *  flushes the output clients are ready to take, reads the connections
+ *  that have input and runs their messages, and checks held messages and
+ *  SRQ lines each pass. A failed accept() only
+ *  drops that client; returns if the listening socket itself fails.
+ */
+static void tcpEventLoop(int server)
+{
+    uint8_t            ready[NUMTCPCONNS + 1];
+    struct sockaddr_in clientAddr;
+    socklen_t          addrlen;
+    tcpConn           *c;
+    uint8_t           *dst;
+    size_t             room;
+    int                clientfd;
+    int                bytesRcvd;
+    int                stalled = 0;
+    int                err;
+    int                acceptErr = 0;   /* errno of the last accept() failure, 0 after a success */
+    int                i;
+
+    for (i = 0; i < NUMTCPCONNS; i++) {
+        tcpConns[i].fd = -1;
+    }
+
+    if (tcpPollInit(server) < 0) {
+        Display_printf(display, 0, 0, "tcpEventLoop: poll set up failed\n");
+        return;
+    }
+
+    while (1) {
+
+        /* a held message or one waiting for a spare is checked every motion period,
+         * SRQ lines less often */
+        memset(ready, 0, sizeof(ready));
+        if (tcpPollWait(server, ready, stalled ? MOTIONPOLLUS : SRQPOLLUS) < 0) {
+            break;
+        }
+
+        if (ready[NUMTCPCONNS]) {
+            addrlen  = sizeof(clientAddr);
+            clientfd = accept(server, (struct sockaddr *)&clientAddr, &addrlen);
+
+            if (clientfd < 0) {
+                err = errno;
+
+                /* only a listening socket that is gone ends the loop */
+                if (err == EBADF || err == ENOTSOCK || err == EINVAL) {
+                    break;
+                }
+
+                /* a client that gave up in the backlog (ECONNABORTED), or no descriptor or
+                 * buffer to spare (EMFILE, ENFILE, ENOBUFS) until a client closes; logged
+                 * once per run of the same failure */
+                if (err != acceptErr) {
+                    Display_printf(display, 0, 0, "tcpEventLoop: accept failed, errno = %d\n", err);
+                }
+                acceptErr = err;
+
+                /* a shortage leaves the listening socket readable; do not spin on it */
+                if (err != ECONNABORTED && err != EINTR) {
+                    usleep(MOTIONPOLLUS);
+                }
+            }
+            else {
+                acceptErr = 0;
+                tcpConnOpen(clientfd);
+            }
+        }
+
+        stalled = 0;
+
+        for (i = 0; i < NUMTCPCONNS; i++) {
+            c = &tcpConns[i];
+
+            if (c->fd < 0) {
+                continue;
+            }
+
+            if ((ready[i] & TCPREADY_OUT) && c->out >= 0 && tcpConnFlush(c) < 0) {
+                Display_printf(display, 0, 0, "send failed.\n");
+                tcpConnClose(c);
+                continue;
+            }
+
+            /* a held message, or bytes not yet framed, may still point into the framer;
+             * it is not read, nor closed on a hang-up, until they are used up */
+            if ((ready[i] & TCPREADY_IN) && c->reading) {
+                room      = scpi_framer_room(&c->framer, &dst);
+                bytesRcvd = recv(c->fd, dst, room, 0);
+                if (bytesRcvd == 0 || (bytesRcvd < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    tcpConnClose(c);
+                    continue;
+                }
+
+                if (bytesRcvd > 0) {
+                    scpi_framer_fill(&c->framer, (size_t)bytesRcvd);
+                    c->framing = 1;
+                }
+            }
+
+            if (tcpConnRun(c) < 0) {
+                Display_printf(display, 0, 0, "send failed.\n");
+                tcpConnClose(c);
+                continue;
+            }
+
+            if (!c->held && c->out < 0 && tcpOutIdle) {
+                scpi_srq_poll(&c->ctx);
+            }
+
+            /* input is read again once the last of it is framed and the replies are taken */
+            c->reading = !c->held && c->out < 0 && !c->framing;
+            tcpPollWatch(i);
+
+            /* waiting on the motion task or on a spare, not on the client */
+            stalled |= c->held || (c->out < 0 && c->framing);
+        }
+    }
+
+    Display_printf(display, 0, 0, "tcpEventLoop: listening socket failed.\n");
+
+    for (i = 0; i < NUMTCPCONNS; i++) {
+        if (tcpConns[i].fd >= 0) {
+            tcpConnClose(&tcpConns[i]);
+        }
+    }
+}
+
+#endif /* TCPEVENTLOOP */
+
+/*
+ *  ======== motionTask ========
+ *  Runs the moves queued by the SCPI handlers and the sweep started by
+ *  INITiate, so a worker is never tied up for the length of a move.
+ */
+void *motionTask(void *arg0)
+{
+    while (1) {
+        scpi_motion_poll();
+        scpi_sweep_poll();
+        usleep(MOTIONPOLLUS);
+    }
 }
 
 /*
  *  ======== tcpHandler ========
- *  Creates new Task to handle new TCP connections.
+ *  Serves TCP connections: from its own event loop, or by handing each
+ *  one to the worker pool.
  */
 void *tcpHandler(void *arg0)
 {
@@ -125,22 +873,41 @@ void *tcpHandler(void *arg0)
     pthread_attr_t     attrs;
     struct sched_param priParam;
     int                retc;
-    int                detachState;
     int                status;
     int                server = -1;
     struct addrinfo    hints;
     struct addrinfo    *res, *p;
-    struct sockaddr_in clientAddr;
     int                optval;
-    static int         clientfd;
     int                optlen = sizeof(optval);
-    socklen_t          addrlen = sizeof(clientAddr);
     char               portNumber[MAXPORTLEN];
+#if !TCPEVENTLOOP
+    struct sockaddr_in clientAddr;
+    int                clientfd;
+    socklen_t          addrlen = sizeof(clientAddr);
+#endif
 
     fdOpenSession(TaskSelf());
 
     Display_printf(display, 0, 0, "TCP Echo example started\n");
 
+    /* bind the SCPI handlers and set up the axes before any worker can parse */
+    scpi_init();
+    scpi_motion_init(MOTIONHAL);
+    scpi_sweep_init(VNAHAL);
+
+    /* the motion task runs above the workers so a move is retired promptly */
+    pthread_attr_init(&attrs);
+    priParam.sched_priority = 4;
+    pthread_attr_setdetachstate(&attrs, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setschedparam(&attrs, &priParam);
+    retc = pthread_attr_setstacksize(&attrs, MOTIONSTACK);
+    retc |= pthread_create(&thread, &attrs, motionTask, NULL);
+    if (retc != 0) {
+        Display_printf(display, 0, 0,
+                "tcpHandler: motion task create failed");
+        while (1);
+    }
+
     sprintf(portNumber, "%d", *(uint16_t *)arg0);
 
     memset(&hints, 0, sizeof(hints));
@@ -162,6 +929,10 @@ void *tcpHandler(void *arg0)
             continue;
         }
 
+        /* a restarted server may bind while its old connections are in TIME_WAIT */
+        optval = 1;
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &optval, optlen);
+
         status = bind(server, p->ai_addr, p->ai_addrlen);
         if (status != -1) {
             break;
@@ -181,7 +952,7 @@ void *tcpHandler(void *arg0)
         res = NULL;
     }
 
-    status = listen(server, NUMTCPWORKERS);
+    status = listen(server, TCPEVENTLOOP ? NUMTCPCONNS : NUMTCPWORKERS);
     if (status == -1) {
         Display_printf(display, 0, 0, "tcpHandler: listen failed\n");
         goto shutdown;
@@ -194,45 +965,28 @@ void *tcpHandler(void *arg0)
         goto shutdown;
     }
 
+#if TCPEVENTLOOP
+    tcpEventLoop(server);
+#else
+    if (tcpPoolStart() != 0) {
+        Display_printf(display, 0, 0, "tcpHandler: worker pool create failed");
+        while (1);
+    }
+
     while ((clientfd =
             accept(server, (struct sockaddr *)&clientAddr, &addrlen)) != -1) {
 
         Display_printf(display, 0, 0,
-                "tcpHandler: Creating thread clientfd = %x\n", clientfd);
+                "tcpHandler: Queueing clientfd = %x\n", clientfd);
 
-        /* Set priority and stack size attributes */
-        pthread_attr_init(&attrs);
-        priParam.sched_priority = 3;
-
-        detachState = PTHREAD_CREATE_DETACHED;
-        retc = pthread_attr_setdetachstate(&attrs, detachState);
-        if (retc != 0) {
-            Display_printf(display, 0, 0,
-                    "tcpHandler: pthread_attr_setdetachstate() failed");
-            while (1);
-        }
-
-        pthread_attr_setschedparam(&attrs, &priParam);
-
-        retc |= pthread_attr_setstacksize(&attrs, 2048);
-        if (retc != 0) {
-            Display_printf(display, 0, 0,
-                    "tcpHandler: pthread_attr_setstacksize() failed");
-            while (1);
-        }
-
-        retc = pthread_create(&thread, &attrs, tcpWorker, (void *)&clientfd);
-        if (retc != 0) {
-            Display_printf(display, 0, 0,
-                    "tcpHandler: pthread_create() failed");
-            while (1);
-        }
+        tcpConnPut(clientfd);
 
         /* addrlen is a value-result param, must reset for next accept call */
         addrlen = sizeof(clientAddr);
     }
 
     Display_printf(display, 0, 0, "tcpHandler: accept failed.\n");
+#endif
 
 shutdown:
     if (res) {
@@ -50,9 +50,14 @@
 #include <ti/display/Display.h>
 #include <ti/drivers/emac/EMACMSP432E4.h>
 
+/* port and stack size may be set by the build */
+#ifndef TCPPORT
 #define TCPPORT 1000
+#endif
 
-#define TCPHANDLERSTACK 2048
+#ifndef TCPHANDLERSTACK
+#define TCPHANDLERSTACK 3072   /* tcpHandler runs the event loop, and with it the SCPI parser */
+#endif
 #define IFPRI  4   /* Ethernet interface priority */
 
 /* Prototypes */
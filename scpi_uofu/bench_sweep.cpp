@@ -0,0 +1,221 @@
+/// @bench_sweep.cpp
+///
+/// End-to-end sweep benchmark; runs a full -180 to 180 degree sweep through
+/// the sequencer against the pedestal and VNA simulator (hal_sim.h), once per
+/// VNA latency distribution and sweep mode, and reports the numbers the lab
+/// schedule is planned on:
+///
+///   points/min      - points measured per minute of sweep
+///   dead ms/pt      - time per point the VNA was not measuring: moving,
+///                     settling and handshake
+///   p99 cycle ms    - 99th percentile of the time between one trigger
+///                     and the next
+///
+/// Time is virtual, so the figures are those of the modelled pedestal (see
+/// hal_sim_init()) and do not depend on the machine running the benchmark.
+///
+/// usage: bench_sweep [--json <out>] [--seed <n>] [--step <degree>] [--spread <pct>]
+///
+
+#include <scpi.h>
+#include <scpi_motion.h>
+#include <scpi_sweep.h>
+#include <hal_sim.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+static const uint32_t  k_poll_us        = 1000;       //motion task period
+static const uint64_t  k_max_us         = 3600000000ull;
+static const uint32_t  k_sweep_us       = 20000;      //median VNA sweep time
+
+
+// **********************************************************************************
+/// One VNA model and sweep mode
+///
+struct bench_case_t
+{
+    const char *        name;
+    hal_sim_latency_t   latency;
+    bool                hold;       //stop-and-go, else continuous
+};
+
+struct bench_result_t
+{
+    string      name;
+    uint32_t    points;
+    uint32_t    missed;             //triggers sent while the VNA was measuring, should be 0
+    double      total_s;
+    double      points_per_min;
+    double      dead_ms;
+    double      mean_cycle_ms;
+    double      p99_cycle_ms;
+};
+
+static const bench_case_t k_cases[] =
+{
+    { "fixed/hold",         k_hal_sim_latency_fixed,        true  },
+    { "normal/hold",        k_hal_sim_latency_normal,       true  },
+    { "long_tail/hold",     k_hal_sim_latency_long_tail,    true  },
+    { "fixed/cont",         k_hal_sim_latency_fixed,        false },
+    { "normal/cont",        k_hal_sim_latency_normal,       false },
+    { "long_tail/cont",     k_hal_sim_latency_long_tail,    false },
+};
+
+
+// **********************************************************************************
+/// Runs one full sweep and collects the trigger times from the sweep log
+///
+static bench_result_t run_case(const bench_case_t & c, uint64_t seed, double step, double spread)
+{
+    static hal_sim_t    sim;
+    bench_result_t      r = { c.name, 0, 0, 0, 0, 0, 0, 0 };
+    vector<uint32_t>    marks;
+    vector<double>      cycles;
+    scpi_sweep_mark_t   mark;
+    uint8_t *           reply;
+    size_t              reply_len;
+    uint32_t            event;
+    char                cmd[128];
+    uint64_t            start;
+    int                 busy = TRUE;
+
+    hal_sim_init(&sim);
+    sim.vna.latency   = c.latency;
+    sim.vna.sweep_us  = k_sweep_us;
+    sim.vna.spread_us = static_cast<uint32_t>(k_sweep_us * spread / 100.0);
+    sim.vna.seed      = seed;
+
+    scpi_motion_init(&sim.motion);
+    scpi_sweep_init(&sim.vna_hal);
+
+    snprintf(cmd, sizeof(cmd), "*RST;*CLS;:SENS:SWE:STAR -180;STOP 180;STEP %.1f;HOLD %s;RATE 0;:INIT:IMM",
+             step, c.hold ? "ON" : "OFF");
+    scpi_input(reinterpret_cast<const uint8_t *>(cmd), strlen(cmd), &reply, &reply_len, &event);
+
+    //the motion task, draining the log as it goes so no mark is dropped
+    for (start = sim.now_us; busy && sim.now_us - start < k_max_us; )
+    {
+        busy = scpi_motion_poll() | scpi_sweep_poll();
+
+        while (scpi_sweep_log_pop(&mark))
+            marks.push_back(mark.time_us);
+
+        if (busy)
+            hal_sim_advance(&sim, k_poll_us);
+    }
+
+    for (size_t i = 1; i < marks.size(); i++)
+        cycles.push_back((marks[i] - marks[i - 1]) / 1000.0);
+
+    sort(cycles.begin(), cycles.end());
+
+    r.points  = sim.vna.triggers;
+    r.missed  = sim.vna.missed;
+    r.total_s = (sim.now_us - start) / 1e6;
+
+    if (r.points && r.total_s > 0)
+    {
+        r.points_per_min = r.points * 60.0 / r.total_s;
+        r.dead_ms        = ((sim.now_us - start) - static_cast<double>(sim.vna.busy_us)) / 1000.0 / r.points;
+    }
+
+    if (!cycles.empty())
+    {
+        double sum = 0;
+
+        for (double ms : cycles)
+            sum += ms;
+
+        r.mean_cycle_ms = sum / cycles.size();
+        r.p99_cycle_ms  = cycles[min(cycles.size() - 1, static_cast<size_t>(0.99 * cycles.size()))];
+    }
+
+    scpi_sweep_init(0);
+    scpi_motion_init(0);
+
+    return r;
+}
+
+// **********************************************************************************
+/// Writes the results as JSON, one object per case
+///
+static bool write_json(const char * path, const vector<bench_result_t> & results, uint64_t seed, double step, double spread)
+{
+    FILE * f = fopen(path, "w");
+
+    if (!f)
+        return false;
+
+    fprintf(f, "{\n  \"benchmark\": \"sweep\",\n  \"seed\": %llu,\n  \"step_deg\": %.1f,\n  \"vna_ms\": %.1f,\n  \"spread_pct\": %.1f,\n  \"cases\": [\n",
+            static_cast<unsigned long long>(seed), step, k_sweep_us / 1000.0, spread);
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const bench_result_t & r = results[i];
+
+        fprintf(f, "    { \"name\": \"%s\", \"points\": %u, \"seconds\": %.3f, \"points_per_min\": %.1f, \"dead_ms_per_point\": %.2f, "
+                   "\"mean_cycle_ms\": %.2f, \"p99_cycle_ms\": %.2f, \"missed_triggers\": %u }%s\n",
+                r.name.c_str(), r.points, r.total_s, r.points_per_min, r.dead_ms, r.mean_cycle_ms, r.p99_cycle_ms, r.missed,
+                (i + 1 < results.size()) ? "," : "");
+    }
+
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+
+    return true;
+}
+
+// **********************************************************************************
+int main(int argc, char ** argv)
+{
+    const char *            json_path = 0;
+    uint64_t                seed = 1;
+    double                  step = 1.0;
+    double                  spread = 25.0;
+    vector<bench_result_t>  results;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (0 == strcmp("--json", argv[i]) && i + 1 < argc)
+            json_path = argv[++i];
+        else if (0 == strcmp("--seed", argv[i]) && i + 1 < argc)
+            seed = strtoull(argv[++i], 0, 0);
+        else if (0 == strcmp("--step", argv[i]) && i + 1 < argc)
+            step = atof(argv[++i]);
+        else if (0 == strcmp("--spread", argv[i]) && i + 1 < argc)
+            spread = atof(argv[++i]);
+        else
+        {
+            fprintf(stderr, "usage: %s [--json <out>] [--seed <n>] [--step <degree>] [--spread <pct>]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    printf("full sweep -180..180 by %.1f degree, VNA %.1f ms median, %.0f%% spread\n", step, k_sweep_us / 1000.0, spread);
+    printf("%-16s %8s %10s %12s %12s %14s %14s %6s\n", "case", "points", "seconds", "points/min", "dead ms/pt", "mean cycle ms", "p99 cycle ms", "missed");
+
+    for (const bench_case_t & c : k_cases)
+    {
+        bench_result_t r = run_case(c, seed, step, spread);
+
+        results.push_back(r);
+
+        printf("%-16s %8u %10.2f %12.1f %12.2f %14.2f %14.2f %6u\n",
+               r.name.c_str(), r.points, r.total_s, r.points_per_min, r.dead_ms, r.mean_cycle_ms, r.p99_cycle_ms, r.missed);
+    }
+
+    if (json_path && !write_json(json_path, results, seed, step, spread))
+    {
+        fprintf(stderr, "cannot write %s\n", json_path);
+        return 1;
+    }
+
+    return 0;
+}
@@ -5,5 +5,6 @@
 ///
 
 #define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_NO_POSIX_SIGNALS   // MINSIGSTKSZ is no longer a constant on recent glibc
 
 #include "catch.hpp"
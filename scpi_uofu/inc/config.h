@@ -60,7 +60,7 @@ typedef struct scpi_cache_s
     int16_t a3_limit_max;
     int16_t a3_limit_angle_ref;  //home / offset
     int16_t a3_limit_angle;      //immediate_angle
-    axis_e  active_axis_sweep;   //only one axis is active for sweep functions at a time
+    axis_t  active_axis_sweep;   //only one axis is active for sweep functions at a time
     uint16_t ax_step_angle;      //active axis step angle
 
 } scpi_cache_t;
@@ -73,11 +73,11 @@ typedef struct config_s
     vna_pol_t
              vna_trig_pol;       //define the polarity of the VNA trigger invoke output
     uint8_t  hold_measure;       //hold for measurement when 1; continue to move pedestal during VNA sweep when 0;
-    uint8_t  sweep_rate_rps;     //axis rotation rate rads/sec;
-    int16_t  reference_angle;    //0-point reference for active axis
-    int16_t  start_angle;        //sweep start angle
-    int16_t  stop_angle;         //sweep stop  angle
-    uint16_t step_angle;         //meas  step  angle
+    uint32_t sweep_rate;         //continuous sweep rate, 1/1000 degree per second, 0 leaves it to the drive
+    int16_t  reference_angle;    //0-point reference for active axis, 0.1 degree
+    int16_t  start_angle;        //sweep start angle, 0.1 degree
+    int16_t  stop_angle;         //sweep stop  angle, 0.1 degree
+    uint16_t step_angle;         //meas  step  angle, 0.1 degree
 } config_t;
 
 typedef struct state_s
@@ -0,0 +1,128 @@
+/// @file hal_sim.h
+///
+/// Pedestal and VNA simulator behind the hal.h tables, for host builds.
+///
+/// Time is virtual: nothing sleeps, hal_sim_advance() moves the clock and
+/// the axes forward, so a sweep that takes minutes in the chamber runs in
+/// milliseconds.  Each axis speeds up and brakes at a fixed acceleration
+/// (the inertia of the pedestal) up to a top speed, stops on its limit
+/// switches and reports its encoder position; the VNA answers a trigger
+/// with ready after a sweep time drawn from a fixed, normal or long-tail
+/// distribution.
+///
+/// Author: Nathan Poppleton
+///
+/// Copyright: University of Utah, College of Engineering
+///
+
+#ifndef INC_HAL_SIM_H_
+#define INC_HAL_SIM_H_
+
+#include "stdint.h"
+
+#include "scpi.h"
+#include "hal.h"
+
+#ifdef    __cplusplus
+extern "C" {
+#endif
+
+#define HAL_SIM_STEP_US         100     //physics integration step
+
+// ***********************************************
+/// One axis; angles in 1/SCPI_ANGLE_SCALE degree
+///
+typedef struct hal_sim_axis_s
+{
+    //model, may be changed after hal_sim_init()
+    double                              speed_max;      //per second
+    double                              accel;          //per second squared, speeding up and braking
+    double                              switch_low;     //limit switch positions
+    double                              switch_high;
+
+    //state
+    double                              pos;
+    double                              vel;
+    double                              target;
+    double                              speed;          //set through hal_motion_t rate, 0 for speed_max
+    int                                 moving;
+    int                                 on_limit;
+}   hal_sim_axis_t;
+
+// ***********************************************
+/// Distribution of the VNA trigger to ready time
+///
+typedef enum hal_sim_latency_e
+{
+    k_hal_sim_latency_fixed = 0,                        //always sweep_us
+    k_hal_sim_latency_normal,                           //mean sweep_us, standard deviation spread_us
+    k_hal_sim_latency_long_tail,                        //lognormal, median sweep_us, sigma spread_us / sweep_us
+}   hal_sim_latency_t;
+
+// ***********************************************
+/// VNA trigger / ready handshake
+///
+typedef struct hal_sim_vna_s
+{
+    //model, may be changed after hal_sim_init()
+    hal_sim_latency_t                   latency;
+    uint32_t                            sweep_us;       //trigger to ready
+    uint32_t                            spread_us;
+    uint64_t                            seed;           //xorshift state, the same seed gives the same run
+
+    //state
+    int                                 trig_high;      //polarities set by the sequencer
+    int                                 rdy_high;
+    int                                 measuring;
+    uint64_t                            ready_at;
+    uint64_t                            busy_us;        //total time spent measuring
+    uint32_t                            triggers;
+    uint32_t                            missed;         //triggers that came while measuring
+}   hal_sim_vna_t;
+
+// ***********************************************
+/// Simulated pedestal
+///
+typedef struct hal_sim_s
+{
+    uint64_t                            now_us;
+    hal_sim_axis_t                      axis[SCPI_NUM_AXES];
+    hal_sim_vna_t                       vna;
+    hal_motion_t                        motion;         //bound to this simulator by hal_sim_init()
+    hal_vna_t                           vna_hal;
+}   hal_sim_t;
+
+// ***********************************************
+/// Puts every axis at 0 at rest and fills in the default model: 30 degree/s,
+/// 60 degree/s^2, limit switches at +/-370 degree, a fixed 20 ms VNA sweep
+///
+/// Bind with scpi_motion_init(&sim->motion) and scpi_sweep_init(&sim->vna_hal).
+///
+void                                    hal_sim_init(hal_sim_t * sim);
+
+// ***********************************************
+/// Draws the next trigger to ready time from the VNA's distribution
+///
+/// @returns            - microseconds
+///
+uint32_t                                hal_sim_vna_latency(hal_sim_vna_t * vna);
+
+// ***********************************************
+/// Moves the virtual clock, the axes and the VNA forward by us
+///
+void                                    hal_sim_advance(hal_sim_t * sim, uint32_t us);
+
+// ***********************************************
+/// Runs the motion task in virtual time: scpi_motion_poll() and
+/// scpi_sweep_poll() every poll_us until neither has work left, or for at
+/// most max_us
+///
+/// @returns            - virtual microseconds that passed
+///
+uint64_t                                hal_sim_run(hal_sim_t * sim, uint32_t poll_us, uint64_t max_us);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* INC_HAL_SIM_H_ */
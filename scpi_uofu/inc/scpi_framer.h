@@ -0,0 +1,112 @@
+/// @file scpi_framer.h
+///
+/// Streaming framer that turns a TCP byte stream into newline terminated
+/// SCPI program messages, independent of how the stream was segmented.
+///
+/// Author: Nathan Poppleton
+///
+/// Copyright: University of Utah, College of Engineering
+///
+
+#ifndef INC_SCPI_FRAMER_H_
+#define INC_SCPI_FRAMER_H_
+
+#include "stddef.h"
+#include "stdint.h"
+
+#include "scpi.h"
+
+#ifdef    __cplusplus
+extern "C" {
+#endif
+
+#ifndef SCPI_FRAMER_BFR_SZ
+#define SCPI_FRAMER_BFR_SZ  SCPI_RX_BFR_SZ          //longest message that can be re-assembled, at most SCPI_RX_BFR_SZ
+#endif
+
+// ***********************************************
+/// Per-connection framer state; holds the partial message between recv() calls
+///
+typedef struct scpi_framer_s
+{
+    char                                buf[SCPI_FRAMER_BFR_SZ];
+    size_t                              len;            //bytes of the partial message held in buf
+    size_t                              head;           //received in place: start of the bytes not yet framed, 0 once all are
+    uint8_t                             overflow;       //TRUE while discarding an over-long message
+}   scpi_framer_t;
+
+// ***********************************************
+/// Prepares a framer for a new connection
+///
+void                                    scpi_framer_init(scpi_framer_t * fr);
+
+// ***********************************************
+/// Consumes received bytes until the next complete message
+///
+/// Call repeatedly with the same data pointer / length until it returns 0;
+/// both are advanced past the bytes consumed.  A message split over several
+/// segments is re-assembled in fr->buf, a message wholly inside the data is
+/// returned in place without a copy.  The terminating '\n' (and a '\r'
+/// before it) is not part of the message; lines left empty are skipped.
+///
+/// @param fr*[i/o]         - framer state
+/// @param p_data**[i/o]    - received bytes not yet consumed
+/// @param p_len*[i/o]      - number of bytes at *p_data
+/// @param msg**[out]       - start of the complete message
+/// @param msg_len*[out]    - length of the complete message
+///
+/// @returns                -  1 a message is available in *msg; valid until the next call
+///                         -  0 all data consumed, the remainder is held for the next segment
+///                         - < 0 a message longer than SCPI_FRAMER_BFR_SZ was discarded
+///
+int                                     scpi_framer_next(scpi_framer_t * fr, const uint8_t ** p_data, size_t * p_len,
+                                                         const char ** msg, size_t * msg_len);
+
+// ***********************************************
+/// Where to receive the next bytes straight into the framer
+///
+/// The in-place alternative to scpi_framer_next(), for a caller that has no
+/// receive buffer of its own: recv() into *dst, hand the byte count to
+/// scpi_framer_fill() and take the messages with scpi_framer_pop().  Only
+/// call it once scpi_framer_pop() has returned 0.  A message needs room for
+/// its '\n' too, so the longest one is SCPI_FRAMER_BFR_SZ - 1 characters.
+/// Do not mix the two forms on one framer.
+///
+/// @param fr*[i/o]         - framer state
+/// @param dst**[out]       - where the received bytes go
+///
+/// @returns                - bytes that fit at *dst, never 0
+///
+size_t                                  scpi_framer_room(scpi_framer_t * fr, uint8_t ** dst);
+
+// ***********************************************
+/// Adds the bytes received at the place scpi_framer_room() gave
+///
+/// @param fr*[i/o]         - framer state
+/// @param len[in]          - bytes received, at most what scpi_framer_room() returned
+///
+void                                    scpi_framer_fill(scpi_framer_t * fr, size_t len);
+
+// ***********************************************
+/// Takes the next complete message out of the received bytes
+///
+/// Call repeatedly until it returns 0.  Messages are framed like
+/// scpi_framer_next() does and returned in place in fr->buf; the bytes
+/// after one stay put until it is done, so a message held on *OPC? / *WAI
+/// stays valid as long as nothing more is popped or received.
+///
+/// @param fr*[i/o]         - framer state
+/// @param msg**[out]       - start of the complete message
+/// @param msg_len*[out]    - length of the complete message
+///
+/// @returns                -  1 a message is available in *msg; valid until the next call
+///                         -  0 no complete message is left, the partial one is kept
+///                         - < 0 a message longer than SCPI_FRAMER_BFR_SZ - 1 was discarded
+///
+int                                     scpi_framer_pop(scpi_framer_t * fr, const char ** msg, size_t * msg_len);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* INC_SCPI_FRAMER_H_ */
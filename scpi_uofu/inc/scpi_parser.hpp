@@ -0,0 +1,728 @@
+/// @file scpi_parser.hpp
+///
+/// Header-only SCPI matcher for host tools (log replay, simulation).
+///
+/// scpi::parser<Tree> resolves program messages exactly as scpi_input_ctx()
+/// does: same units, same relative paths, same return codes and events.
+/// The command tree is a template argument, so every menu compiles into its
+/// own code: the children are compared against constant keywords of known
+/// length and a match descends straight into the child's code.  Nothing is
+/// looked up in a node or keyword table at run time.
+///
+/// The parser only resolves headers; what a command does is up to the
+/// handler passed to parse(), called once per resolved unit.
+///
+/// Requires C++17.
+///
+
+#ifndef INC_SCPI_PARSER_HPP_
+#define INC_SCPI_PARSER_HPP_
+
+#include "scpi_tree.hpp"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <utility>
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__)
+#error "scpi_parser.hpp packs keywords for a little endian host"
+#endif
+
+//the walk of one header is flattened into a single function, the tree
+//depth bounds the code it generates
+#if defined(__GNUC__)
+#define SCPI_PARSER_INLINE  __attribute__((always_inline)) inline
+#else
+#define SCPI_PARSER_INLINE  inline
+#endif
+
+namespace scpi {
+
+// ***********************************************
+/// One resolved program message unit, as handed to the parse() handler
+///
+struct unit
+{
+    int                 rc;             //SCPI_NODE_QUERY or SCPI_NODE_COMMAND
+    uint32_t            event;          //node id with the axis, see SCPI_AXIS_EVENT()
+    std::string_view    param;          //parameter text, white space trimmed
+};
+
+// ***********************************************
+/// Handler accepting every unit; parse() without a handler uses it
+///
+struct accept_all
+{
+    constexpr int operator()(const unit &) const { return 0; }
+};
+
+template <class Tree = tree::definition>
+class parser
+{
+public:
+
+    // ***********************************************
+    /// Parses one program message
+    ///
+    /// @param msg[in]      - message text, ends at the first '\0' or '\n'
+    /// @param event[out]   - event of the last unit parsed
+    /// @param handler[in]  - int(const unit &), a negative result rejects
+    ///                       the unit
+    ///
+    /// @return as scpi_input_ctx(): 1 query, 2 command, -1 syntax error,
+    ///         -2 unknown header, -3 partial header, -5 rejected by handler
+    ///
+    template <class Handler>
+    static int parse(std::string_view msg, uint32_t & event, Handler && handler)
+    {
+        const char * str = msg.data();
+        uint32_t     path = k_scpi_root_none;
+        size_t       len = msg.size();
+        size_t       start = 0;
+        size_t       unit_len;
+        size_t       end;
+        int          rc;
+
+        event = k_scpi_root_none;
+
+        if (SCPI_RX_BFR_SZ < (len + 1))
+            len = SCPI_RX_BFR_SZ;
+
+        //the terminator is found by the unit scan rather than a pass of its own
+        do
+        {
+            rc    = parse_unit(str + start, len - start, &unit_len, path, event, handler);
+            end   = start + unit_len;
+            start = end + 1;
+
+        } while (   0 < rc
+                 && end < len && ';' == str[end]
+                 && start < len && !(k_char_end & char_class(str[start])) );
+
+        return rc;
+    }
+
+    static int parse(std::string_view msg, uint32_t & event)
+    {
+        return parse(msg, event, accept_all());
+    }
+
+private:
+
+    static constexpr const auto &   nodes       = Tree::nodes;
+    static constexpr std::size_t    node_count  = sizeof(Tree::nodes) / sizeof(Tree::nodes[0]);
+
+    enum : uint8_t
+    {
+        k_char_delimiter    = 0x01,     //ends a menu level: ':', white space, terminators
+        k_char_unit         = 0x02,     //';' and the quotes that hide it
+        k_char_end          = 0x04,     //ends the message
+        k_char_token_end    = 0x08,     //ends a menu level before the unit is cut: delimiters and ';'
+    };
+
+    static constexpr std::array<uint8_t, 256> char_classes()
+    {
+        std::array<uint8_t, 256> table = {};
+
+        table[':']  = k_char_delimiter | k_char_token_end;
+        table[' ']  = k_char_delimiter | k_char_token_end;
+        table['\t'] = k_char_delimiter | k_char_token_end;
+        table['\r'] = k_char_delimiter | k_char_token_end;
+        table['\0'] = k_char_delimiter | k_char_token_end | k_char_end;
+        table['\n'] = k_char_delimiter | k_char_token_end | k_char_end;
+        table[';']  = k_char_unit | k_char_token_end;
+        table['"']  = k_char_unit;
+        table['\''] = k_char_unit;
+
+        return table;
+    }
+
+    static uint8_t char_class(char c)
+    {
+        static constexpr std::array<uint8_t, 256> table = char_classes();
+
+        return table[static_cast<uint8_t>(c)];
+    }
+
+    // ***********************************************
+    /// 0x80 in every byte of w equal to c
+    ///
+    static uint64_t bytes_equal(uint64_t w, uint8_t c)
+    {
+        const uint64_t low7 = 0x7f7f7f7f7f7f7f7full;
+        uint64_t       x    = w ^ (0x0101010101010101ull * c);
+
+        return ~(((x & low7) + low7) | x | low7);
+    }
+
+    template <uint8_t Class>
+    static uint64_t class_bytes(uint64_t w)
+    {
+        uint64_t m = 0;
+
+        if constexpr (0 != (Class & k_char_delimiter))
+            m |= bytes_equal(w, ':') | bytes_equal(w, ' ') | bytes_equal(w, '\t') | bytes_equal(w, '\r');
+
+        if constexpr (0 != (Class & k_char_unit))
+            m |= bytes_equal(w, ';') | bytes_equal(w, '"') | bytes_equal(w, '\'');
+
+        if constexpr (0 != (Class & (k_char_delimiter | k_char_end)))
+            m |= bytes_equal(w, '\0') | bytes_equal(w, '\n');
+
+        return m;
+    }
+
+    static size_t first_byte(uint64_t m)
+    {
+#if defined(__GNUC__)
+        return static_cast<size_t>(__builtin_ctzll(m)) / 8;
+#else
+        size_t i = 0;
+
+        while (!(m & 0x80))
+        {
+            m >>= 8;
+            i++;
+        }
+
+        return i;
+#endif
+    }
+
+    // ***********************************************
+    /// First position from pos holding a character of Class, or len;
+    /// eight characters at a time while the message allows
+    ///
+    template <uint8_t Class>
+    static size_t find(const char * str, size_t pos, size_t len)
+    {
+        for (; pos + sizeof(uint64_t) <= len; pos += sizeof(uint64_t))
+        {
+            uint64_t w;
+
+            memcpy(&w, str + pos, sizeof(w));
+
+            uint64_t m = class_bytes<Class>(w);
+
+            if (m)
+                return pos + first_byte(m);
+        }
+
+        while (pos < len && !(Class & char_class(str[pos])))
+            pos++;
+
+        return pos;
+    }
+
+    // ***********************************************
+    /// Splits a header into its menu levels on demand, with the rules of
+    /// scpi_tokenize()
+    ///
+    struct cursor
+    {
+        const char *    str;
+        size_t          len;
+        size_t          pos;
+        size_t          start;
+        size_t          count;
+        bool            done;
+        bool            bad;            //empty level or too many levels
+
+        cursor(const char * s, size_t n)
+            : str(s), len(n), pos(0), start(0), count(0), done(false), bad(false)
+        {
+            if (len && ':' == str[0])
+                pos = start = 1;
+        }
+
+        bool next(const char ** tok, size_t * tok_len)
+        {
+            size_t p = pos;             //scanned in a register, not through *this
+
+            while (!done)
+            {
+                p = find<k_char_delimiter>(str, p, len);
+
+                char c     = (p < len) ? str[p] : '\0';
+                bool found = p > start;
+
+                if (   (!found && ':' == c)
+                    || ( found && SCPI_MAX_LEVELS == count) )
+                {
+                    pos = p;
+                    bad = done = true;
+                    return false;
+                }
+
+                *tok     = str + start;
+                *tok_len = p - start;
+
+                if (':' == c)
+                    start = ++p;
+                else
+                    done = true;        //pos stays on the header terminator
+
+                if (found)
+                {
+                    pos = p;
+                    count++;
+                    return true;
+                }
+            }
+
+            pos = p;
+            return false;
+        }
+
+        // ***********************************************
+        /// Steps over a token of n characters matched at pos
+        ///
+        void consume(size_t n)
+        {
+            pos += n;
+            count++;
+
+            if (pos < len && ':' == str[pos])
+                pos++;
+            else
+                done = true;            //pos stays on the header terminator
+
+            start = pos;
+        }
+    };
+
+    using walk_fn = int (*)(cursor &, uint32_t &, uint32_t &);
+
+    // ***********************************************
+    /// End of the unit starting at pos: the next ';' outside quotes or the
+    /// message terminator ('\0' or '\n')
+    ///
+    static size_t unit_end(const char * msg, size_t pos, size_t len)
+    {
+        for (;;)
+        {
+            pos = find<k_char_unit | k_char_end>(msg, pos, len);
+
+            if (pos >= len || ';' == msg[pos] || (k_char_end & char_class(msg[pos])))
+                break;
+
+            //skip the quoted string; only the terminator ends it early
+            char quote = msg[pos];
+
+            for (pos++; pos < len && quote != msg[pos] && !(k_char_end & char_class(msg[pos])); pos++)
+                ;
+
+            if (pos >= len || quote != msg[pos])
+                break;
+
+            pos++;
+        }
+
+        return pos;
+    }
+
+    static uint32_t fold4(uint32_t w)
+    {
+        uint32_t heptets = w & 0x7f7f7f7fu;
+        uint32_t ge_a    = heptets + 0x3f3f3f3fu;
+        uint32_t gt_z    = heptets + 0x25252525u;
+        uint32_t upper   = (ge_a ^ gt_z) & ~w & 0x80808080u;
+
+        return w | (upper >> 2);
+    }
+
+    // ***********************************************
+    /// Word W of the first N characters of a keyword's long form
+    ///
+    static constexpr uint32_t pack(scpi_menu_string_t kw, std::size_t n, std::size_t w)
+    {
+        uint32_t word = 0;
+
+        for (std::size_t i = 4 * w; i < n && i < 4 * w + 4; i++)
+            word |= static_cast<uint32_t>(static_cast<uint8_t>(Tree::keywords[kw].long_form[i])) << (8 * (i - 4 * w));
+
+        return word;
+    }
+
+    template <scpi_menu_string_t Kw, std::size_t N, std::size_t W>
+    static constexpr uint32_t packed = pack(Kw, N, W);
+
+    // ***********************************************
+    /// Word W of the first N characters at str, folded to lower case; the
+    /// size of every load is a constant
+    ///
+    template <std::size_t N, std::size_t W>
+    static uint32_t load_word(const char * str)
+    {
+        constexpr std::size_t n = (N - 4 * W < 4) ? N - 4 * W : 4;
+        uint32_t              v = 0;
+
+        if constexpr (4 == n)
+        {
+            memcpy(&v, str + 4 * W, n);
+        }
+        else
+        {
+            //assembled in registers; a short memcpy into v would go through
+            //the stack and stall the load that follows
+            for (std::size_t i = 0; i < n; i++)
+                v |= static_cast<uint32_t>(static_cast<uint8_t>(str[4 * W + i])) << (8 * i);
+        }
+
+        return fold4(v);
+    }
+
+    template <scpi_menu_string_t Kw, std::size_t N, std::size_t... W>
+    static bool equal(const char * str, std::index_sequence<W...>)
+    {
+        return ((load_word<N, W>(str) == packed<Kw, N, W>) && ...);
+    }
+
+    // ***********************************************
+    /// True when the token ends n characters into s: '?' first for a query,
+    /// then a delimiter or the end of the unit
+    ///
+    template <bool Query>
+    static bool ends_token(const char * s, size_t rem, size_t n)
+    {
+        if constexpr (Query)
+        {
+            if (n >= rem || '?' != s[n])
+                return false;
+
+            n++;
+        }
+
+        return n >= rem || (k_char_token_end & char_class(s[n]));
+    }
+
+    // ***********************************************
+    /// Case-insensitive match of the short or long form of Kw as the whole
+    /// token at s; the same result as scpi_is_menu_match() on the token
+    ///
+    /// @return length of the token, 0 when it is not Kw
+    ///
+    template <scpi_menu_string_t Kw, bool Query>
+    static size_t match(const char * s, size_t rem)
+    {
+        constexpr std::size_t short_len = Tree::keywords[Kw].short_form.size();
+        constexpr std::size_t long_len  = Tree::keywords[Kw].long_form.size();
+
+        if (   rem >= long_len
+            && equal<Kw, long_len>(s, std::make_index_sequence<(long_len + 3) / 4>())
+            && ends_token<Query>(s, rem, long_len) )
+        {
+            return long_len + Query;
+        }
+
+        if constexpr (short_len != long_len)
+        {
+            if (   rem >= short_len
+                && equal<Kw, short_len>(s, std::make_index_sequence<(short_len + 3) / 4>())
+                && ends_token<Query>(s, rem, short_len) )
+            {
+                return short_len + Query;
+            }
+        }
+
+        return 0;
+    }
+
+    // ***********************************************
+    /// Numeric suffix after n characters of keyword: one or two digits, no
+    /// leading zero, then the end of the token
+    ///
+    template <bool Query>
+    static size_t suffix_end(const char * s, size_t rem, size_t n, uint32_t * suffix)
+    {
+        size_t end = n;
+
+        while (end < rem && '0' <= s[end] && s[end] <= '9')
+            end++;
+
+        if (   end == n
+            || end - n > 2
+            || (end - n > 1 && '0' == s[n])
+            || !ends_token<Query>(s, rem, end) )
+        {
+            return 0;
+        }
+
+        *suffix = 0;
+
+        for (size_t i = n; i < end; i++)
+            *suffix = *suffix * 10 + static_cast<uint32_t>(s[i] - '0');
+
+        return end - n;
+    }
+
+    // ***********************************************
+    /// Kw followed by a numeric suffix as the whole token, as
+    /// scpi_match_suffix()
+    ///
+    template <scpi_menu_string_t Kw, bool Query>
+    static size_t match_suffix(const char * s, size_t rem, uint32_t * suffix)
+    {
+        constexpr std::size_t short_len = Tree::keywords[Kw].short_form.size();
+        constexpr std::size_t long_len  = Tree::keywords[Kw].long_form.size();
+        size_t                digits;
+
+        if (   rem >= long_len
+            && equal<Kw, long_len>(s, std::make_index_sequence<(long_len + 3) / 4>())
+            && 0 != (digits = suffix_end<Query>(s, rem, long_len, suffix)) )
+        {
+            return long_len + digits + Query;
+        }
+
+        if constexpr (short_len != long_len)
+        {
+            if (   rem >= short_len
+                && equal<Kw, short_len>(s, std::make_index_sequence<(short_len + 3) / 4>())
+                && 0 != (digits = suffix_end<Query>(s, rem, short_len, suffix)) )
+            {
+                return short_len + digits + Query;
+            }
+        }
+
+        return 0;
+    }
+
+    // ***********************************************
+    /// Tries child Child of menu Menu on the token at the cursor; on a match
+    /// consumes the token and descends into the child
+    ///
+    /// The first character, folded to lower case, rejects most siblings
+    /// with one compare against a constant.
+    ///
+    template <std::size_t Menu, std::size_t Child>
+    SCPI_PARSER_INLINE static bool try_child(cursor & c, uint32_t & state, uint32_t & parent,
+                          const char * s, size_t rem, char first, uint32_t axis, int & rc)
+    {
+        constexpr const tree::node & child = nodes[Child];
+
+        if constexpr (0 == Child || Menu != static_cast<std::size_t>(child.parent))
+        {
+            return false;
+        }
+        else
+        {
+            constexpr bool query = (SCPI_NODE_QUERY == child.type);
+            size_t         n;
+
+            if (Tree::keywords[child.keyword].long_form[0] != first)
+                return false;
+
+            if constexpr (0 != (child.flags & SCPI_NODE_SUFFIX))
+            {
+                uint32_t suffix;
+
+                if (0 == (n = match_suffix<child.keyword, query>(s, rem, &suffix)) || suffix >= SCPI_NUM_AXES)
+                    return false;
+
+                axis = suffix;
+            }
+            else
+            {
+                if (0 == (n = match<child.keyword, query>(s, rem)))
+                    return false;
+            }
+
+            c.consume(n);
+            state = SCPI_AXIS_EVENT(Child, axis);
+
+            if constexpr (0 != child.type)
+                rc = child.type;
+            else
+                rc = walk<Child>(c, state, parent);
+
+            return true;
+        }
+    }
+
+    template <std::size_t Menu, std::size_t... Child>
+    SCPI_PARSER_INLINE static int match_children(cursor & c, uint32_t & state, uint32_t & parent,
+                              const char * s, size_t rem, char first, std::index_sequence<Child...>)
+    {
+        uint32_t axis = SCPI_EVENT_AXIS(state);
+        int      rc = -2;
+
+        (try_child<Menu, Child>(c, state, parent, s, rem, first, axis, rc) || ...);
+
+        return rc;
+    }
+
+    // ***********************************************
+    /// Resolves the rest of the header from menu Menu
+    ///
+    /// Tokens are matched in place, a keyword then the end of the token, so
+    /// the header is not split up front.  Empty levels and too many levels
+    /// stop the walk and are reported by the syntax check that follows.
+    ///
+    /// @return 0 out of levels, 1 / 2 query / command reached, -2 no match;
+    ///         state is the last node matched, parent the state before it
+    ///
+    template <std::size_t Menu>
+    SCPI_PARSER_INLINE static int walk(cursor & c, uint32_t & state, uint32_t & parent)
+    {
+        if (c.done || SCPI_MAX_LEVELS == c.count)
+            return 0;
+
+        const char * s   = c.str + c.pos;
+        size_t       rem = c.len - c.pos;
+        char         first = rem ? s[0] : '\0';
+
+        if (k_char_token_end & char_class(first))
+            return 0;
+
+        if ('A' <= first && first <= 'Z')
+            first = static_cast<char>(first | 0x20);
+
+        parent = state;
+
+        return match_children<Menu>(c, state, parent, s, rem, first, std::make_index_sequence<node_count>());
+    }
+
+    // ***********************************************
+    /// Keywords are matched in place, so none may hold a character that
+    /// ends a token, a quote or '?', and a suffixed keyword may not end in
+    /// a digit
+    ///
+    static constexpr bool keywords_plain()
+    {
+        constexpr std::array<uint8_t, 256> classes = char_classes();
+
+        for (std::size_t i = 0; i < node_count; i++)
+        {
+            std::string_view kw = Tree::keywords[nodes[i].keyword].long_form;
+
+            for (char ch : kw)
+            {
+                if (classes[static_cast<uint8_t>(ch)] || '?' == ch)
+                    return false;
+            }
+
+            if (   (nodes[i].flags & SCPI_NODE_SUFFIX)
+                && !kw.empty() && '0' <= kw.back() && kw.back() <= '9')
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static_assert(keywords_plain(), "scpi_parser.hpp: a keyword holds a delimiter, quote or '?', or a suffixed keyword ends in a digit");
+
+    template <std::size_t... Node>
+    static constexpr std::array<walk_fn, sizeof...(Node)> walk_table(std::index_sequence<Node...>)
+    {
+        return { { &walk<Node>... } };
+    }
+
+    // ***********************************************
+    /// Resolves one unit, following scpi_input_unit()
+    ///
+    /// The header is walked before the unit is cut at its ';': a token that
+    /// matches holds neither quotes nor ';', so the unit ends where the scan
+    /// from the end of the walk says and the header is scanned only once.
+    ///
+    /// @param str[in]          - unit text, up to the end of the message
+    /// @param len[in]          - characters left in the message
+    /// @param unit_len[out]    - length of the unit, up to its ';'
+    ///
+    template <class Handler>
+    static int parse_unit(const char * str, size_t len, size_t * unit_len, uint32_t & path, uint32_t & event, Handler & handler)
+    {
+        static constexpr auto walks = walk_table(std::make_index_sequence<node_count>());
+
+        uint32_t start = k_scpi_root_none;
+        uint32_t state;
+        uint32_t parent;
+        size_t   lead = 0;
+        bool     common;
+        int      rc;
+
+        while (lead < len && (' ' == str[lead] || '\t' == str[lead]))
+            lead++;
+
+        str += lead;
+        len -= lead;
+
+        common = (len > 0 && '*' == str[0]) || (len > 1 && ':' == str[0] && '*' == str[1]);
+
+        if (len && ':' != str[0] && !common)
+            start = path;
+
+        cursor c(str, len);
+
+        state  = start;
+        parent = start;
+        rc     = (k_scpi_root_none == start) ? walk<k_scpi_root_none>(c, state, parent)
+                                             : walks[SCPI_EVENT_NODE(start)](c, state, parent);
+
+        len       = unit_end(str, c.pos, len);
+        c.len     = len;
+        *unit_len = lead + len;
+
+        //the whole header is checked for syntax, whatever the walk found
+        bool         trailing = false;
+        const char * tok;
+        size_t       tok_len;
+
+        while (c.next(&tok, &tok_len))
+            trailing = true;
+
+        if (c.bad || !c.count)
+        {
+            event = k_scpi_root_none;
+            return -1;
+        }
+
+        event = state;
+
+        if (0 < rc && trailing)
+            return -2;
+
+        switch (rc)
+        {
+        case 0:
+            return -3;
+        case SCPI_NODE_QUERY:
+        case SCPI_NODE_COMMAND:
+            break;
+        default:
+            return -2;
+        }
+
+        //parameter: skip the separating white space, trim the terminator
+        size_t pos = c.pos;
+        size_t param;
+
+        while (pos < len && (' ' == str[pos] || '\t' == str[pos]))
+            pos++;
+
+        param = pos;
+
+        //the unit holds no '\0' or '\n', unit_end() stopped at those
+        const void * cr = memchr(str + param, '\r', len - param);
+
+        pos = cr ? static_cast<size_t>(static_cast<const char *>(cr) - str) : len;
+
+        while (pos > param && (' ' == str[pos-1] || '\t' == str[pos-1]))
+            pos--;
+
+        if (0 > handler(unit{ rc, state, std::string_view(str + param, pos - param) }))
+            return -5;
+
+        if (!common)
+            path = parent;
+
+        return rc;
+    }
+};
+
+} // namespace scpi
+
+#endif /* INC_SCPI_PARSER_HPP_ */
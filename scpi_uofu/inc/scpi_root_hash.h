@@ -0,0 +1,45 @@
+/// @file scpi_root_hash.h
+///
+/// Minimal perfect hash over the root menu keywords (short and long forms).
+/// Generated by tools/gen_root_hash.py -- do not edit by hand.
+///
+
+#ifndef INC_SCPI_ROOT_HASH_H_
+#define INC_SCPI_ROOT_HASH_H_
+
+#define SCPI_ROOT_HASH_SZ           21u
+#define SCPI_ROOT_HASH_BUCKET_BITS  4u
+#define SCPI_ROOT_HASH_SEED1        0x1dc265f3u
+#define SCPI_ROOT_HASH_SEED2        0x63930a39u
+
+static const uint8_t s_root_hash_disp[1u << SCPI_ROOT_HASH_BUCKET_BITS] =
+{
+    0, 0, 0, 5, 0, 0, 0, 0, 0, 0, 7, 1, 0, 6, 18, 4
+};
+
+static const scpi_root_node_t s_root_hash[SCPI_ROOT_HASH_SZ] =
+{
+    /* "*sre"     */ { k_scpi_str_sre      , k_scpi_root_sre       , 2, k_scpi_root_q_sre   },
+    /* "*idn"     */ { k_scpi_str_idn      , k_scpi_root_none      , 0, k_scpi_root_q_idn   },
+    /* "sense"    */ { k_scpi_str_sense    , k_scpi_root_sense     , 0, k_scpi_root_none    },
+    /* "input"    */ { k_scpi_str_input    , k_scpi_root_input     , 0, k_scpi_root_none    },
+    /* "system"   */ { k_scpi_str_system   , k_scpi_root_system    , 0, k_scpi_root_none    },
+    /* "status"   */ { k_scpi_str_status   , k_scpi_root_status    , 0, k_scpi_root_none    },
+    /* "stat"     */ { k_scpi_str_status   , k_scpi_root_status    , 0, k_scpi_root_none    },
+    /* "*stb"     */ { k_scpi_str_stb      , k_scpi_root_none      , 0, k_scpi_root_q_stb   },
+    /* "*wai"     */ { k_scpi_str_wai      , k_scpi_root_wai       , 2, k_scpi_root_none    },
+    /* "abort"    */ { k_scpi_str_abort    , k_scpi_root_abort     , 2, k_scpi_root_none    },
+    /* "syst"     */ { k_scpi_str_system   , k_scpi_root_system    , 0, k_scpi_root_none    },
+    /* "inp"      */ { k_scpi_str_input    , k_scpi_root_input     , 0, k_scpi_root_none    },
+    /* "*esr"     */ { k_scpi_str_esr      , k_scpi_root_none      , 0, k_scpi_root_q_esr   },
+    /* "abor"     */ { k_scpi_str_abort    , k_scpi_root_abort     , 2, k_scpi_root_none    },
+    /* "*opc"     */ { k_scpi_str_opc      , k_scpi_root_opc       , 2, k_scpi_root_q_opc   },
+    /* "init"     */ { k_scpi_str_initiate , k_scpi_root_initiate  , 0, k_scpi_root_none    },
+    /* "*ese"     */ { k_scpi_str_ese      , k_scpi_root_ese       , 2, k_scpi_root_q_ese   },
+    /* "*rst"     */ { k_scpi_str_rst      , k_scpi_root_rst       , 2, k_scpi_root_none    },
+    /* "initiate" */ { k_scpi_str_initiate , k_scpi_root_initiate  , 0, k_scpi_root_none    },
+    /* "*cls"     */ { k_scpi_str_cls      , k_scpi_root_cls       , 2, k_scpi_root_none    },
+    /* "sens"     */ { k_scpi_str_sense    , k_scpi_root_sense     , 0, k_scpi_root_none    }
+};
+
+#endif /* INC_SCPI_ROOT_HASH_H_ */
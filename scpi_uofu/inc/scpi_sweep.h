@@ -0,0 +1,136 @@
+/// @file scpi_sweep.h
+///
+/// Measurement sweep started by INITiate[:IMMediate] (k_sweep_immediate).
+///
+/// The sweep walks config_t active_axis from start_angle towards stop_angle
+/// in step_angle increments.  At every point it waits for the move to
+/// finish, waits for the VNA ready input, pulses the VNA trigger and waits
+/// for ready again before the point counts as measured.
+///
+/// With hold_measure clear and a drive that reports its position the sweep
+/// is continuous: after the first point the axis runs to the last one at
+/// sweep_rate and the trigger fires as the position crosses each point.
+/// A VNA still busy at a crossing delays that trigger, which the logged
+/// position shows.  A drive without position readback instead gets the move
+/// to the next point queued together with the trigger, so the pedestal turns
+/// while the VNA measures.
+///
+/// Every trigger latches the axis position (the target, without readback)
+/// and the time since INITiate into the sweep log, read back with
+/// SENSe:SWEep:LOG?.
+///
+/// The moves go through the motion queue and the sweep is one pending
+/// operation (scpi_op_begin()) from INITiate until its last point, so *OPC,
+/// *OPC? and *WAI wait for the whole sweep.  SCPI_OPER_SWEEPING is raised
+/// while it runs and SCPI_OPER_POINT pulses for each measured point, or for
+/// each trigger of a continuous sweep.
+///
+/// Author: Nathan Poppleton
+///
+/// Copyright: University of Utah, College of Engineering
+///
+
+#ifndef INC_SCPI_SWEEP_H_
+#define INC_SCPI_SWEEP_H_
+
+#include "stddef.h"
+#include "stdint.h"
+
+#include "scpi.h"
+#include "hal.h"
+#include "config.h"
+
+#ifdef    __cplusplus
+extern "C" {
+#endif
+
+#define SCPI_SWEEP_ANGLE_SCALE  10      //config_t angles are in 1/10 degree
+#define SCPI_SWEEP_ANGLE_PER_RAD 57296  //1/SCPI_ANGLE_SCALE degree per radian, for sweep_rate
+#define SCPI_SWEEP_RATE_MAX     (255u * SCPI_SWEEP_ANGLE_PER_RAD)  //highest sweep_rate, 255 rad/s
+
+#ifndef SCPI_SWEEP_LOG_SZ
+#define SCPI_SWEEP_LOG_SZ       64      //marks kept until read, power of two
+#endif
+
+#define SCPI_SWEEP_LOG_REPLY    6       //marks per SENSe:SWEep:LOG? reply, within SCPI_TX_BFR_SZ
+
+// ***********************************************
+/// Position and time latched at a VNA trigger
+///
+typedef struct scpi_sweep_mark_s
+{
+    uint32_t                            point;          //0 for the first point of the sweep
+    scpi_angle_t                        angle;
+    uint32_t                            time_us;        //since the sweep started, 0 without a drive clock
+}   scpi_sweep_mark_t;
+
+// ***********************************************
+/// Binds the VNA lines, drops a running sweep and restores the default settings
+///
+/// With no VNA (vna is 0) every point counts as measured once the axis
+/// arrives; with no drive bound either a sweep completes as it is accepted,
+/// as moves do.  Call at start up, before the motion task runs.
+///
+void                                    scpi_sweep_init(const hal_vna_t * vna);
+
+// ***********************************************
+/// Settings the next sweep starts with; written by the SENSe:SWEep handlers
+///
+/// A running sweep works on the copy taken when it started.
+///
+config_t *                              scpi_sweep_config(void);
+
+// ***********************************************
+/// Restores the default settings: axis A0, a single point at 0, hold
+/// for the measurement, active high VNA lines (*RST)
+///
+void                                    scpi_sweep_config_reset(void);
+
+// ***********************************************
+/// Starts a sweep with the current settings; safe from any task
+///
+/// Points are reference_angle + start_angle + n * step_angle, n = 0, 1, ...
+/// while they do not pass stop_angle, so stop_angle is the last point only
+/// when the span is a multiple of the step.  sweep_rate is left to the
+/// drive.
+///
+/// @returns            -   0 the sweep is started
+///                     - < 0 k_scpi_err_init_ignored when a sweep is running,
+///                           k_scpi_err_settings_conflict for a zero step, an
+///                           unknown axis or an end point outside the enabled
+///                           axis limits
+///
+int                                     scpi_sweep_start(void);
+
+// ***********************************************
+/// Stops a running sweep before its next point; safe from any task
+///
+/// The motion task drops the queued moves and brakes the axis where it is
+/// through hal_motion_t stop; a drive without one finishes the running move.
+///
+void                                    scpi_sweep_abort(void);
+
+// ***********************************************
+/// Takes the oldest mark of the sweep log; safe from any task
+///
+/// The log is emptied when a sweep starts.  A mark that finds it full is
+/// dropped and raises SCPI_QUES_LOG.
+///
+/// @returns            - TRUE when *mark was filled, FALSE once the log is empty
+///
+int                                     scpi_sweep_log_pop(scpi_sweep_mark_t * mark);
+
+// ***********************************************
+/// One step of the sweep; the motion task calls it after scpi_motion_poll()
+///
+/// Also tracks the VNA ready input in SCPI_OPER_VNA_READY.
+///
+/// @returns            - TRUE while a sweep runs
+///
+int                                     scpi_sweep_poll(void);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* INC_SCPI_SWEEP_H_ */
@@ -0,0 +1,214 @@
+/// @file scpi_tree.hpp
+///
+/// constexpr view of the SCPI command tree (scpi_tree.def) for host tools.
+///
+/// Including this header checks the tree at compile time: node order,
+/// parent / child ranges, sibling ambiguity and the keyword forms.  A bad
+/// edit to scpi_tree.def then fails the host build instead of misparsing.
+///
+/// Requires C++17.
+///
+
+#ifndef INC_SCPI_TREE_HPP_
+#define INC_SCPI_TREE_HPP_
+
+#include "scpi.h"
+
+#include <cstddef>
+#include <string_view>
+
+namespace scpi {
+namespace tree {
+
+struct keyword
+{
+    std::string_view    short_form;
+    std::string_view    long_form;
+};
+
+struct node
+{
+    scpi_event_t        id;
+    scpi_event_t        parent;
+    scpi_menu_string_t  keyword;
+    int                 type;           //0 menu, SCPI_NODE_QUERY or SCPI_NODE_COMMAND
+    int                 flags;          //SCPI_NODE_SUFFIX
+    int                 first;          //first child, -1 for a leaf
+};
+
+inline constexpr keyword keywords[] =
+{
+#define SCPI_KEYWORD(name, short_form, long_form)   { short_form, long_form },
+#include "scpi_tree.def"
+#undef  SCPI_KEYWORD
+};
+
+inline constexpr node nodes[] =
+{
+#define SCPI_CHILDREN(menu)
+#define SCPI_MENU(name, parent, keyword, flags)     { k_scpi_##name, k_scpi_##parent, k_scpi_str_##keyword, 0,    flags, k_scpi_first_##name },
+#define SCPI_LEAF(name, parent, keyword, type)      { k_scpi_##name, k_scpi_##parent, k_scpi_str_##keyword, type, 0,     -1                  },
+#include "scpi_tree.def"
+#undef  SCPI_CHILDREN
+#undef  SCPI_MENU
+#undef  SCPI_LEAF
+};
+
+struct group
+{
+    scpi_event_t        menu;
+    int                 first;
+};
+
+// child groups in definition order
+inline constexpr group groups[] =
+{
+#define SCPI_CHILDREN(menu)                         { k_scpi_##menu, k_scpi_first_##menu },
+#define SCPI_MENU(name, parent, keyword, flags)
+#define SCPI_LEAF(name, parent, keyword, type)
+#include "scpi_tree.def"
+#undef  SCPI_CHILDREN
+#undef  SCPI_MENU
+#undef  SCPI_LEAF
+};
+
+inline constexpr std::size_t node_count    = sizeof(nodes) / sizeof(nodes[0]);
+inline constexpr std::size_t keyword_count = sizeof(keywords) / sizeof(keywords[0]);
+inline constexpr std::size_t group_count   = sizeof(groups) / sizeof(groups[0]);
+
+// ***********************************************
+/// One past the last child of a menu: where the next child group starts
+///
+constexpr std::size_t children_end(const node & menu)
+{
+    for (std::size_t g = 0; g < group_count; g++)
+    {
+        if (groups[g].menu == menu.id)
+            return (g + 1 < group_count) ? static_cast<std::size_t>(groups[g + 1].first) : node_count;
+    }
+
+    return 0;
+}
+
+constexpr bool is_lower(std::string_view s)
+{
+    for (char c : s)
+    {
+        if (c >= 'A' && c <= 'Z')
+            return false;
+    }
+
+    return true;
+}
+
+// ***********************************************
+/// Keyword forms are lowercase, fit their storage and the short form
+/// is a prefix of the long form
+///
+constexpr bool keywords_valid()
+{
+    if (keyword_count != k_scpi_str_count)
+        return false;
+
+    for (std::size_t i = 1; i < keyword_count; i++)
+    {
+        const keyword & k = keywords[i];
+
+        if (   k.short_form.empty()
+            || k.short_form.size() >= SCPI_KEYWORD_SHORT_SZ
+            || k.long_form.size()  >= SCPI_KEYWORD_LONG_SZ
+            || k.long_form.substr(0, k.short_form.size()) != k.short_form
+            || !is_lower(k.long_form))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// ***********************************************
+/// Every node sits at its own index, below the axis stride
+///
+constexpr bool ids_valid()
+{
+    if (node_count != k_scpi_node_count || node_count > SCPI_AXIS_STRIDE)
+        return false;
+
+    for (std::size_t i = 0; i < node_count; i++)
+    {
+        if (static_cast<std::size_t>(nodes[i].id) != i)
+            return false;
+    }
+
+    return k_scpi_root_none == nodes[0].id;
+}
+
+// ***********************************************
+/// Every node but the root lies in its parent's child range, only menus
+/// carry a suffix and only menus own a child group
+///
+constexpr bool parents_valid()
+{
+    for (std::size_t g = 0; g < group_count; g++)
+    {
+        if (0 != nodes[groups[g].menu].type)
+            return false;
+    }
+
+    for (std::size_t i = 1; i < node_count; i++)
+    {
+        const node & parent = nodes[nodes[i].parent];
+
+        if (   0 != parent.type
+            || i <  static_cast<std::size_t>(parent.first)
+            || i >= children_end(parent)
+            || (0 != nodes[i].type && 0 != nodes[i].flags))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// ***********************************************
+/// No two siblings answer the same token: same keyword and both queries
+/// or both not
+///
+constexpr bool siblings_unambiguous()
+{
+    for (std::size_t i = 1; i < node_count; i++)
+    {
+        for (std::size_t j = i + 1; j < node_count; j++)
+        {
+            if (   nodes[i].parent  == nodes[j].parent
+                && nodes[i].keyword == nodes[j].keyword
+                && (SCPI_NODE_QUERY == nodes[i].type) == (SCPI_NODE_QUERY == nodes[j].type))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// ***********************************************
+/// The tree as a type, for code specialised on it (scpi_parser.hpp)
+///
+struct definition
+{
+    static constexpr const auto & keywords = tree::keywords;
+    static constexpr const auto & nodes    = tree::nodes;
+};
+
+static_assert(keywords_valid(),       "scpi_tree.def: keyword forms must be lowercase and the short form a prefix of the long form");
+static_assert(ids_valid(),            "scpi_tree.def: node ids must follow definition order and fit below SCPI_AXIS_STRIDE");
+static_assert(parents_valid(),        "scpi_tree.def: every node must follow its parent's SCPI_CHILDREN marker");
+static_assert(siblings_unambiguous(), "scpi_tree.def: two siblings match the same token");
+
+} // namespace tree
+} // namespace scpi
+
+#endif /* INC_SCPI_TREE_HPP_ */
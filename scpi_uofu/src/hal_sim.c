@@ -0,0 +1,282 @@
+/// @file hal_sim.c
+///
+/// Pedestal and VNA simulator behind the hal.h tables, for host builds.
+///
+/// Author: Nathan Poppleton
+///
+/// Copyright: University of Utah, College of Engineering
+///
+
+#include "hal_sim.h"
+#include "scpi_motion.h"
+#include "scpi_sweep.h"
+
+#include "string.h"
+#include "math.h"
+
+
+// *********************************************************************
+/// One integration step of an axis
+///
+/// Brakes as soon as the stopping distance reaches the distance left, so
+/// it arrives at rest; a limit switch stops it dead.
+///
+static void hal_sim_axis_step(hal_sim_axis_t * a, double dt)
+{
+    double left  = a->target - a->pos;
+    double dir   = (left < 0) ? -1.0 : 1.0;
+    double dv    = a->accel * dt;
+    double vmax  = (a->speed > 0 && a->speed < a->speed_max) ? a->speed : a->speed_max;
+    double along = a->vel * dir;
+
+    if (!a->moving)
+        return;
+
+    if (fabs(left) < 0.5 && fabs(a->vel) <= dv)
+    {
+        a->pos    = a->target;
+        a->vel    = 0;
+        a->moving = FALSE;
+        return;
+    }
+
+    if (along < 0)
+        along += dv;                                            //turn around
+    else if (along * along / (2 * a->accel) >= fabs(left))
+        along  = (along > dv) ? along - dv : 0;                 //brake to arrive at rest
+    else if (along > vmax)
+        along  = (along - dv > vmax) ? along - dv : vmax;       //slow down to a lower rate
+    else
+        along  = (along + dv < vmax) ? along + dv : vmax;
+
+    a->vel  = along * dir;
+    a->pos += a->vel * dt;
+
+    if ((a->target - a->pos) * dir < 0)
+    {
+        a->pos    = a->target;
+        a->vel    = 0;
+        a->moving = FALSE;
+    }
+
+    if (a->pos <= a->switch_low || a->pos >= a->switch_high)
+    {
+        a->pos      = (a->pos <= a->switch_low) ? a->switch_low : a->switch_high;
+        a->vel      = 0;
+        a->target   = a->pos;
+        a->moving   = FALSE;
+        a->on_limit = TRUE;
+    }
+}
+
+// *********************************************************************
+// hal_motion_t
+//
+static int hal_sim_move(void * user, int axis, int32_t target)
+{
+    hal_sim_t * sim = (hal_sim_t *)user;
+
+    if (axis < 0 || axis >= SCPI_NUM_AXES)
+        return -1;
+
+    sim->axis[axis].target   = target;
+    sim->axis[axis].moving   = TRUE;
+    sim->axis[axis].on_limit = FALSE;
+
+    return 0;
+}
+
+static int hal_sim_busy(void * user, int axis)
+{
+    return ((hal_sim_t *)user)->axis[axis].moving;
+}
+
+static int32_t hal_sim_position(void * user, int axis)
+{
+    return (int32_t)lround(((hal_sim_t *)user)->axis[axis].pos);
+}
+
+static int hal_sim_rate(void * user, int axis, uint32_t speed)
+{
+    ((hal_sim_t *)user)->axis[axis].speed = speed;
+
+    return 0;
+}
+
+static uint32_t hal_sim_now(void * user)
+{
+    return (uint32_t)((hal_sim_t *)user)->now_us;
+}
+
+static int hal_sim_limit(void * user, int axis)
+{
+    return ((hal_sim_t *)user)->axis[axis].on_limit;
+}
+
+static int hal_sim_stop(void * user, int axis)
+{
+    hal_sim_axis_t * a = &((hal_sim_t *)user)->axis[axis];
+
+    //the braking distance at the present speed becomes the target
+    if (a->moving)
+        a->target = a->pos + a->vel * fabs(a->vel) / (2 * a->accel);
+
+    return 0;
+}
+
+// *********************************************************************
+/// Uniform in (0, 1) from an xorshift64* generator
+///
+static double hal_sim_uniform(uint64_t * state)
+{
+    uint64_t x = *state ? *state : 0x9e3779b97f4a7c15ull;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return ((double)((x * 0x2545f4914f6cdd1dull) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+// *********************************************************************
+/// Standard normal, Box-Muller
+///
+static double hal_sim_gauss(uint64_t * state)
+{
+    double u = hal_sim_uniform(state);
+    double v = hal_sim_uniform(state);
+
+    return sqrt(-2.0 * log(u)) * cos(6.283185307179586 * v);
+}
+
+// *********************************************************************
+//
+//
+uint32_t hal_sim_vna_latency(hal_sim_vna_t * vna)
+{
+    double us = vna->sweep_us;
+
+    switch (vna->latency)
+    {
+    case k_hal_sim_latency_normal:
+        us += vna->spread_us * hal_sim_gauss(&vna->seed);
+        break;
+
+    case k_hal_sim_latency_long_tail:
+        if (vna->sweep_us)
+            us *= exp((double)vna->spread_us / vna->sweep_us * hal_sim_gauss(&vna->seed));
+        break;
+    }
+
+    return (us <= 0) ? 0 : (us >= 4294967295.0) ? 0xFFFFFFFFu : (uint32_t)(us + 0.5);
+}
+
+// *********************************************************************
+// hal_vna_t
+//
+static void hal_sim_vna_polarity(void * user, int trig_active_high, int rdy_active_high)
+{
+    hal_sim_t * sim = (hal_sim_t *)user;
+
+    sim->vna.trig_high = trig_active_high;
+    sim->vna.rdy_high  = rdy_active_high;
+}
+
+static void hal_sim_vna_trigger(void * user)
+{
+    hal_sim_vna_t * vna = &((hal_sim_t *)user)->vna;
+    uint32_t us;
+
+    if (vna->measuring)
+    {
+        vna->missed++;
+        return;
+    }
+
+    us = hal_sim_vna_latency(vna);
+
+    vna->measuring = TRUE;
+    vna->ready_at  = ((hal_sim_t *)user)->now_us + us;
+    vna->busy_us  += us;
+    vna->triggers++;
+}
+
+static int hal_sim_vna_ready(void * user)
+{
+    return !((hal_sim_t *)user)->vna.measuring;
+}
+
+// *********************************************************************
+//
+//
+void hal_sim_init(hal_sim_t * sim)
+{
+    int i;
+
+    memset(sim, 0, sizeof(*sim));
+
+    for (i = 0; i < SCPI_NUM_AXES; i++)
+    {
+        sim->axis[i].speed_max   = SCPI_ANGLE_DEG(30);
+        sim->axis[i].accel       = SCPI_ANGLE_DEG(60);
+        sim->axis[i].switch_low  = SCPI_ANGLE_DEG(-370);
+        sim->axis[i].switch_high = SCPI_ANGLE_DEG(370);
+    }
+
+    sim->vna.latency    = k_hal_sim_latency_fixed;
+    sim->vna.sweep_us   = 20000;
+    sim->vna.spread_us  = 0;
+    sim->vna.seed       = 1;
+    sim->vna.trig_high  = TRUE;
+    sim->vna.rdy_high   = TRUE;
+
+    sim->motion.move     = hal_sim_move;
+    sim->motion.busy     = hal_sim_busy;
+    sim->motion.user     = sim;
+    sim->motion.position = hal_sim_position;
+    sim->motion.rate     = hal_sim_rate;
+    sim->motion.now      = hal_sim_now;
+    sim->motion.limit    = hal_sim_limit;
+    sim->motion.stop     = hal_sim_stop;
+
+    sim->vna_hal.polarity = hal_sim_vna_polarity;
+    sim->vna_hal.trigger  = hal_sim_vna_trigger;
+    sim->vna_hal.ready    = hal_sim_vna_ready;
+    sim->vna_hal.user     = sim;
+}
+
+// *********************************************************************
+//
+//
+void hal_sim_advance(hal_sim_t * sim, uint32_t us)
+{
+    uint32_t step;
+    int i;
+
+    for (; us; us -= step)
+    {
+        step = (us < HAL_SIM_STEP_US) ? us : HAL_SIM_STEP_US;
+
+        sim->now_us += step;
+
+        for (i = 0; i < SCPI_NUM_AXES; i++)
+            hal_sim_axis_step(&sim->axis[i], step * 1e-6);
+
+        if (sim->vna.measuring && sim->now_us >= sim->vna.ready_at)
+            sim->vna.measuring = FALSE;
+    }
+}
+
+// *********************************************************************
+//
+//
+uint64_t hal_sim_run(hal_sim_t * sim, uint32_t poll_us, uint64_t max_us)
+{
+    uint64_t start = sim->now_us;
+
+    while ((scpi_motion_poll() | scpi_sweep_poll()) && sim->now_us - start < max_us)
+        hal_sim_advance(sim, poll_us);
+
+    return sim->now_us - start;
+}
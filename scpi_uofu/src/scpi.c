@@ -9,42 +9,99 @@
 ///
 
 #include "scpi.h"
+#include "scpi_motion.h"
+#include "scpi_sweep.h"
 
 #include <stdio.h>
-#include <ctype.h>
 #include "string.h"
 #include "stdint.h"
 
 //#define SCPI_DBG
 
+#define SCPI_REPLY_EOL                  ""          //appended once to the coalesced reply
+#define SCPI_REPLY_SEP                  ';'         //separates the replies of a compound message
 
-const char * STR_INP        = "inp";           //input shorthand
-const char * STR_INPUT      = "input";
-const char * STR_POS        = "pos";           //position shorthand
-const char * STR_POSITION   = "position";
-const char * STR_A0         = "a0";
-const char * STR_A1         = "a1";
-const char * STR_A2         = "a2";
-const char * STR_A3         = "a3";
-const char * STR_ANGL       = "angl";          //angle shorthand
-const char * STR_ANGLE      = "angle";
-const char * STR_INIT       = "init";          //initiate shorthand
-const char * STR_INITIATE   = "initiate";
-const char * STR_IMM        = "imm";           //immediate shorthand
-const char * STR_IMMEDIATE  = "immediate";
-const char * STR_LIM        = "lim";           //limit shorthand
-const char * STR_LIMIT      = "limit";
-const char * STR_DIR        = "dir";           //direction shorthand
-const char * STR_DIRECTION  = "direction";
-const char * STR_LOW        = "low";
-const char * STR_HIGH       = "high";
-const char * STR_STAT       = "stat";          //state shorthand
-const char * STR_STATE      = "state";
-const char * STR_SENS       = "sens";          //sense shorthand
-const char * STR_SENSE      = "sense";
-const char * STR_OPC        = "*opc";
-const char * STR_IDN        = "*idn";
-const char * STR_RST        = "*rst";
+// *********************************************************************
+/// Root menu node, one per keyword form in the generated root hash
+///
+typedef struct
+{
+    scpi_menu_string_t                  keyword;        //verified against the token
+    scpi_menu_root_t                    state;          //command form; k_scpi_root_none if query only
+    uint8_t                             rc;             //scpi_menu_sm() return for the command form
+    scpi_menu_root_t                    query_state;    //query form; k_scpi_root_none if no query
+}   scpi_root_node_t;
+
+#include "scpi_root_hash.h"
+
+
+// *********************************************************************
+/// Keyword table indexed by scpi_menu_string_t
+///
+/// All forms are stored lowercase; the short form is always the leading
+/// characters of the long form (SCPI rule) so a single compare against the
+/// long form text resolves either.  Kept const so it is placed in flash.
+///
+static const scpi_keyword_t s_keywords[k_scpi_str_count] =
+{
+#define SCPI_KEYWORD(name, short_form, long_form)   { short_form, long_form, sizeof(short_form) - 1, sizeof(long_form) - 1 },
+#include "scpi_tree.def"
+#undef  SCPI_KEYWORD
+};
+
+// *********************************************************************
+/// Command tree tables, indexed by scpi_event_t; built from scpi_tree.def
+///
+/// The children of a menu are the contiguous nodes
+/// s_menu_first[menu] .. s_menu_first[menu + 1] - 1.  Leaves use the
+/// extra menu past the last one, whose range is empty.
+///
+typedef struct
+{
+    uint8_t                             keyword;        //scpi_menu_string_t
+    uint8_t                             type;           //0 menu, SCPI_NODE_QUERY or SCPI_NODE_COMMAND
+    uint8_t                             flags;          //SCPI_NODE_SUFFIX
+    uint8_t                             menu;           //index into s_menu_first
+}   scpi_node_t;
+
+enum scpi_menu_index_e
+{
+#define SCPI_CHILDREN(menu)                         k_scpi_menu_##menu,
+#define SCPI_MENU(name, parent, keyword, flags)
+#define SCPI_LEAF(name, parent, keyword, type)
+#include "scpi_tree.def"
+#undef  SCPI_CHILDREN
+#undef  SCPI_MENU
+#undef  SCPI_LEAF
+    k_scpi_menu_count
+};
+
+static const scpi_node_t s_nodes[k_scpi_node_count] =
+{
+#define SCPI_CHILDREN(menu)
+#define SCPI_MENU(name, parent, keyword, flags)     { k_scpi_str_##keyword, 0,    flags, k_scpi_menu_##name },
+#define SCPI_LEAF(name, parent, keyword, type)      { k_scpi_str_##keyword, type, 0,     k_scpi_menu_count  },
+#include "scpi_tree.def"
+#undef  SCPI_CHILDREN
+#undef  SCPI_MENU
+#undef  SCPI_LEAF
+};
+
+static const uint8_t s_menu_first[k_scpi_menu_count + 2] =
+{
+#define SCPI_CHILDREN(menu)                         k_scpi_first_##menu,
+#define SCPI_MENU(name, parent, keyword, flags)
+#define SCPI_LEAF(name, parent, keyword, type)
+#include "scpi_tree.def"
+#undef  SCPI_CHILDREN
+#undef  SCPI_MENU
+#undef  SCPI_LEAF
+    k_scpi_node_count,
+    k_scpi_node_count
+};
+
+//every node id must fit below the axis suffix
+typedef char scpi_tree_fits_stride_t[(k_scpi_node_count <= SCPI_AXIS_STRIDE) ? 1 : -1];
 
 //Replies
 const char * STR_REPLY_OK1              = "OK_QUERY";
@@ -53,62 +110,131 @@ const char * STR_REPLY_ERR              = "ERROR";
 const char * STR_REPLY_ERR_PARTIAL      = "ERROR_PARTIAL";
 const char * STR_REPLY_IDN              = "Antenna Rotator Controller v0.1; University of Utah; Nov. 2019";
 
-static uint8_t s_reply[SCPI_TX_BFR_SZ];
+#if SCPI_REPLY_SHARED
+static uint8_t    s_reply[SCPI_TX_BFR_SZ];     //the reply buffer every context writes to
+static scpi_ctx_t s_ctx = { s_reply };          //context behind the legacy scpi_input() entry point
+#else
+static scpi_ctx_t s_ctx;                        //context behind the legacy scpi_input() entry point
+#endif
+
+static scpi_axis_t s_axes[SCPI_NUM_AXES];      //power-on settings are applied by scpi_init()
+static int         s_ready = FALSE;             //scpi_init() has run
+
+static volatile uint32_t s_ops_pending;          //operations begun and not yet ended
+static volatile uint32_t s_ops_idle;             //times s_ops_pending fell to zero
+
+// ***********************************************
+/// OPERation / QUEStionable register; shared, updated lock-free
+///
+typedef struct
+{
+    volatile uint32_t                   condition;
+    volatile uint32_t                   event;          //latched positive transitions
+    volatile uint32_t                   enable;
+}   scpi_status_t;
+
+static scpi_status_t s_status[k_scpi_reg_count];
+static volatile uint32_t s_srq_rises;           //enabled OPERation / QUEStionable bits raised, counted
+
+#if SCPI_NUM_AXES > SCPI_AXIS_MAX
+#error "SCPI_NUM_AXES exceeds the axes the event encoding can carry"
+#endif
+
+
+inline
+static const scpi_keyword_t * keyword(scpi_menu_string_t item)
+{
+    return ((unsigned)item < k_scpi_str_count) ? &s_keywords[item] : &s_keywords[k_scpi_str_unknown];
+}
+
+// *********************************************************************
+/// Appends one reply to the coalesced reply of the current message
+///
+/// Replies of a compound message are separated by SCPI_REPLY_SEP; room for
+/// SCPI_REPLY_EOL is always kept free at the end of the buffer.
+///
+void scpi_reply_str(scpi_ctx_t * ctx, const char * str)
+{
+    size_t len   = strlen(str);
+    size_t avail = SCPI_TX_BFR_SZ - sizeof(SCPI_REPLY_EOL) - ctx->reply_len;
+
+    if (!len)
+        return;
+
+    if (ctx->reply_len && avail)
+    {
+        ctx->reply[ctx->reply_len++] = SCPI_REPLY_SEP;
+        avail--;
+    }
 
+    if (len > avail)
+        len = avail;
+
+    memcpy(&ctx->reply[ctx->reply_len], str, len);
+    ctx->reply_len += len;
+    ctx->reply[ctx->reply_len] = 0;
+}
 
+// *********************************************************************
+/// Folds the ASCII upper case letters of 4 packed bytes to lower case
+///
+/// SWAR: bit 7 of each byte is set when that byte lies in 'A'..'Z'; no
+/// carries cross byte lanes, so the word can be tested in one go.
+///
 inline
-static int menu_len_match(size_t len, scpi_menu_string_t str)
+static uint32_t scpi_fold4(uint32_t w)
 {
-    return (len == scpi_str_len_short(str) || len == scpi_str_len_long(str)) ? TRUE : FALSE;
+    uint32_t heptets = w & 0x7f7f7f7fu;
+    uint32_t ge_a    = heptets + 0x3f3f3f3fu;   //bit 7 set for bytes >= 'A'
+    uint32_t gt_z    = heptets + 0x25252525u;   //bit 7 set for bytes >  'Z'
+    uint32_t upper   = (ge_a ^ gt_z) & ~w & 0x80808080u;
+
+    return w | (upper >> 2);                    //0x80 >> 2 == 'a' - 'A'
 }
 
 // *********************************************************************
 //
 //
-const char *  scpi_str_short(scpi_menu_string_t item)
+int scpi_str_eq_nocase(const char * str, const char * lower, size_t len)
 {
-    switch (item)
+    uint32_t a;
+    uint32_t b;
+
+    while (len >= sizeof(uint32_t))
     {
-    case k_scpi_str_opc:
-        return STR_OPC;
-    case k_scpi_str_idn:
-        return STR_IDN;
-    case k_scpi_str_rst:
-        return STR_RST;
-    case k_scpi_str_input:
-        return STR_INP;
-    case k_scpi_str_position:
-        return STR_POS;
-    case k_scpi_str_a0:
-        return STR_A0;
-    case k_scpi_str_a1:
-        return STR_A1;
-    case k_scpi_str_a2:
-        return STR_A2;
-    case k_scpi_str_a3:
-        return STR_A3;
-    case k_scpi_str_angle:
-        return STR_ANGL;
-    case k_scpi_str_immediate:
-        return STR_IMM;
-    case k_scpi_str_initiate:
-        return STR_INIT;
-    case k_scpi_str_direction:
-        return STR_DIR;
-    case k_scpi_str_limit:
-        return STR_LIM;
-    case k_scpi_str_low:
-        return STR_LOW;
-    case k_scpi_str_high:
-        return STR_HIGH;
-    case k_scpi_str_state:
-        return STR_STAT;
-    case k_scpi_str_sense:
-        return STR_SENS;
-    case k_scpi_str_unknown:
-    default:
-        return 0;
+        memcpy(&a, str, sizeof(a));             //unaligned word loads are fine on the M4
+        memcpy(&b, lower, sizeof(b));
+
+        if (scpi_fold4(a) != b)
+            return FALSE;
+
+        str   += sizeof(uint32_t);
+        lower += sizeof(uint32_t);
+        len   -= sizeof(uint32_t);
+    }
+
+    if (len)
+    {
+        a = 0;
+        b = 0;
+        memcpy(&a, str, len);
+        memcpy(&b, lower, len);
+
+        if (scpi_fold4(a) != b)
+            return FALSE;
     }
+
+    return TRUE;
+}
+
+// *********************************************************************
+//
+//
+const char *  scpi_str_short(scpi_menu_string_t item)
+{
+    const scpi_keyword_t * kw = keyword(item);
+
+    return kw->short_len ? kw->short_form : 0;
 }
 
 // *********************************************************************
@@ -116,49 +242,9 @@ const char *  scpi_str_short(scpi_menu_string_t item)
 //
 const char *  scpi_str_long(scpi_menu_string_t item)
 {
+    const scpi_keyword_t * kw = keyword(item);
 
-    switch (item)
-    {
-    case k_scpi_str_opc:
-        return STR_OPC;
-    case k_scpi_str_idn:
-        return STR_IDN;
-    case k_scpi_str_rst:
-        return STR_RST;
-    case k_scpi_str_input:
-        return STR_INPUT;
-    case k_scpi_str_position:
-        return STR_POSITION;
-    case k_scpi_str_a0:
-        return STR_A0;
-    case k_scpi_str_a1:
-        return STR_A1;
-    case k_scpi_str_a2:
-        return STR_A2;
-    case k_scpi_str_a3:
-        return STR_A3;
-    case k_scpi_str_angle:
-        return STR_ANGLE;
-    case k_scpi_str_immediate:
-        return STR_IMMEDIATE;
-    case k_scpi_str_initiate:
-        return STR_INITIATE;
-    case k_scpi_str_direction:
-        return STR_DIRECTION;
-    case k_scpi_str_limit:
-        return STR_LIMIT;
-    case k_scpi_str_low:
-        return STR_LOW;
-    case k_scpi_str_high:
-        return STR_HIGH;
-    case k_scpi_str_state:
-        return STR_STATE;
-    case k_scpi_str_sense:
-        return STR_SENSE;
-    case k_scpi_str_unknown:
-    default:
-        return 0;
-    }
+    return kw->long_len ? kw->long_form : 0;
 }
 
 // *********************************************************************
@@ -166,92 +252,15 @@ const char *  scpi_str_long(scpi_menu_string_t item)
 //
 size_t  scpi_str_len_short(scpi_menu_string_t item)
 {
-    switch (item)
-    {
-    case k_scpi_str_opc:
-        return 4;
-    case k_scpi_str_idn:
-        return 4;
-    case k_scpi_str_rst:
-        return 4;
-    case k_scpi_str_input:
-        return 3;
-    case k_scpi_str_position:
-        return 3;
-    case k_scpi_str_a0:
-    case k_scpi_str_a1:
-    case k_scpi_str_a2:
-    case k_scpi_str_a3:
-        return 2;
-    case k_scpi_str_angle:
-        return 4;
-    case k_scpi_str_immediate:
-        return 3;
-    case k_scpi_str_initiate:
-        return 4;
-    case k_scpi_str_direction:
-        return 3;
-    case k_scpi_str_limit:
-        return 3;
-    case k_scpi_str_low:
-        return 3;
-    case k_scpi_str_high:
-        return 4;
-    case k_scpi_str_state:
-        return 4;
-    case k_scpi_str_sense:
-        return 4;
-    case k_scpi_str_unknown:
-    default:
-        return 0;
-    }
+    return keyword(item)->short_len;
 }
 
-
 // *********************************************************************
 //
 //
 size_t  scpi_str_len_long(scpi_menu_string_t item)
 {
-    switch (item)
-    {
-    case k_scpi_str_opc:
-        return 4;
-    case k_scpi_str_idn:
-        return 4;
-    case k_scpi_str_rst:
-        return 4;
-    case k_scpi_str_input:
-        return 5;
-    case k_scpi_str_position:
-        return 8;
-    case k_scpi_str_a0:
-    case k_scpi_str_a1:
-    case k_scpi_str_a2:
-    case k_scpi_str_a3:
-        return 2;
-    case k_scpi_str_angle:
-        return 5;
-    case k_scpi_str_immediate:
-        return 9;
-    case k_scpi_str_initiate:
-        return 8;
-    case k_scpi_str_direction:
-        return 9;
-    case k_scpi_str_limit:
-        return 5;
-    case k_scpi_str_low:
-        return 3;
-    case k_scpi_str_high:
-        return 4;
-    case k_scpi_str_state:
-        return 5;
-    case k_scpi_str_sense:
-        return 5;
-    case k_scpi_str_unknown:
-    default:
-        return 0;
-    }
+    return keyword(item)->long_len;
 }
 
 // *********************************************************************
@@ -259,763 +268,2024 @@ size_t  scpi_str_len_long(scpi_menu_string_t item)
 //
 int scpi_is_menu_match(const char * buffer, size_t len, scpi_menu_string_t item)
 {
-    //get long and short form lengths
-    size_t llen = scpi_str_len_long(item);
-    size_t slen = scpi_str_len_short(item);
-    const char * stxt = scpi_str_short(item);
-    const char * ltxt = scpi_str_long(item);
-    int rc = 0;
+    const scpi_keyword_t * kw = keyword(item);
 
-    //perform a valid length check and compare if length is correct menu_item being checked
-    if (len < slen)
-    {
-        //unable to test anything
-        rc = TRUE;  //This will force a failure to match since strncmp should return 0
-    }
-    else if (len == slen)
-    {
-        //only test for shortform...
-        rc = strncmp(buffer, stxt, slen);
-    }
-    else if (len == llen)
-    {
-        rc = strncmp(buffer, ltxt, llen);
-    }
-    else
+    //only the short or the long form length can match; the short form is a
+    //prefix of the long form so one compare covers both
+    if (   !len
+        || (len != kw->short_len && len != kw->long_len))
     {
-        rc = TRUE;  //This will force a failure to match since strncmp should return 0
+        return FALSE;
     }
 
-    return (0 == rc ) ? TRUE : FALSE;
+    return scpi_str_eq_nocase(buffer, kw->long_form, len);
 }
 
-
 // *********************************************************************
 //
 //
-int scpi_find_level(char * buffer, size_t len, int level, char ** found, size_t * found_len)
+scpi_menu_string_t scpi_match_menu(const char * buffer, size_t len, const scpi_menu_string_t * expect, size_t expect_sz)
 {
-    if (   !buffer
-        || (len < SCPI_RX_MIN_LEN))   //Test parameters
-        return -1;
-
-    char * seek = buffer;
-    size_t remain = len;
-    char * needle1 = 0;
-    char * needle2 = 0;
-    char * needle3 = 0;
-
-    if (   ':' == buffer[0] )
-    {
-        seek++;
-        remain--;
-    }
-
-    //if seeking the 0-th menu level this won't even run
-    while (level && remain)
-    {
-        if (':' == *seek)
-        {
-            level--;
-        }
-
-        seek++;
-        remain--;
-    }
+    size_t i;
 
-    if (!level)
+    for (i = 0; i < expect_sz; i++)
     {
-        //try to find the next delimiter if it exists:
-        needle1 = strchr(seek, ':');
-        needle2 = strchr(seek, ' ');
-        needle3 = strchr(seek, '\0');
-
-        if (needle1 > seek)
+        if (scpi_is_menu_match(buffer, len, expect[i]))
         {
-            *found_len = (needle1 - seek);
+            return expect[i];
         }
-        else if (needle2 > seek)
-        {
-            *found_len = (needle2 - seek);
-        }
-        else if (needle3 > seek)
-        {
-            *found_len = (needle3 - seek);
-        }
-        else
-        {
-            *found_len = remain;
-        }
-
-        *found = seek;
-        return 0;
     }
 
-    //unable to find menu level(x)
-    return -2;
-
+    return k_scpi_str_unknown;
 }
 
-
 // *********************************************************************
 //
 //
-int scpi_query_event_handler(uint32_t evt)
+int scpi_match_suffix(const char * buffer, size_t len, scpi_menu_string_t item, uint32_t * suffix)
 {
-    switch(evt)
-    {
-    case k_scpi_root_q_idn:
-        strncpy((char *)s_reply, STR_REPLY_IDN, strlen(STR_REPLY_IDN) + 1);
-        break;
-    case k_scpi_root_q_opc:
-        strncpy((char *)s_reply, STR_REPLY_OK1, strlen(STR_REPLY_OK1) + 1);
-        break;
-    default:
-        break;
-    }
+    size_t digits = len;
+    size_t i;
 
-    return 0;
-}
+    while (digits && '0' <= buffer[digits-1] && buffer[digits-1] <= '9')
+        digits--;
 
-int                                     scpi_write_event_handler(uint32_t evt)
-{
+    //the suffix is required here (our axes count from 0) and has no leading zeros
+    if (   digits == len
+        || len - digits > 2
+        || (len - digits > 1 && '0' == buffer[digits])
+        || !scpi_is_menu_match(buffer, digits, item) )
+    {
+        return FALSE;
+    }
 
-    strncpy((char *)s_reply, STR_REPLY_OK2, strlen(STR_REPLY_OK2) + 1);
+    *suffix = 0;
 
-//    switch(evt)
-//    {
-//    case k_scpi_root_rst:
-//        strncpy((char *)s_reply, STR_REPLY_OK2, strlen(STR_REPLY_OK2) + 1);
-//        break;
-//    case k_scpi_root_opc:
-//        strncpy((char *)s_reply, STR_REPLY_OK2, strlen(STR_REPLY_OK2) + 1);
-//        break;
-//    default:
-//        break;
-//    }
+    for (i = digits; i < len; i++)
+        *suffix = *suffix * 10 + (uint32_t)(buffer[i] - '0');
 
-    return 0;
+    return TRUE;
 }
 
-int                                     scpi_error_event_handler()
+
+// *********************************************************************
+/// Locates the parameter that follows a header ending at pos
+///
+/// Skips the separating white space and trims the message terminator and
+/// trailing white space.
+///
+static void scpi_param_span(const char * buffer, size_t pos, size_t len, scpi_header_t * hdr)
 {
-    strncpy((char *)s_reply, STR_REPLY_ERR, strlen(STR_REPLY_ERR) + 1);
+    size_t  start;
 
-    return 0;
-}
+    while (pos < len && (' ' == buffer[pos] || '\t' == buffer[pos]))
+        pos++;
 
-int                                     scpi_error_partial_event_handler()
-{
-    strncpy((char *)s_reply, STR_REPLY_ERR_PARTIAL, strlen(STR_REPLY_ERR_PARTIAL) + 1);
+    start = pos;
 
-    return 0;
+    while (   pos < len
+           && '\0' != buffer[pos]
+           && '\r' != buffer[pos]
+           && '\n' != buffer[pos] )
+        pos++;
+
+    while (pos > start && (' ' == buffer[pos-1] || '\t' == buffer[pos-1]))
+        pos--;
+
+    hdr->param_offset   = (uint16_t)start;
+    hdr->param_len      = (uint16_t)(pos - start);
 }
 
 // *********************************************************************
 //
 //
-int scpi_input(const uint8_t * p_buf, size_t len, uint8_t ** p_reply, size_t * p_reply_len, uint32_t * event)
+int scpi_tokenize(const char * buffer, size_t len, scpi_header_t * hdr)
 {
-    static char       c_buffer[SCPI_RX_BFR_SZ];     //create a copy so we can manipulate the buffer
-    int level         = 0;                          //scpi menu level
+    if (!buffer || !hdr)
+        return -1;
 
-    size_t remain = len;
+    size_t  pos     = 0;
+    size_t  start   = 0;
+    char    c       = 0;
 
-    scpi_menu_root_t    root_state = k_scpi_root_none;
-    scpi_menu_input_t   input_state = k_scpi_input_none;
+    hdr->count          = 0;
+    hdr->absolute       = FALSE;
+    hdr->param_offset   = 0;
+    hdr->param_len      = 0;
 
-    scpi_menu_input_position_axis_angle_t
-                        angle_state = k_scpi_input_position_axis_none;
+    if (len && ':' == buffer[0])
+    {
+        hdr->absolute = TRUE;
+        pos++;
+    }
 
-    uint32_t last_state = 0;
+    start = pos;
 
-    size_t cpy_len = len;
+    //single pass over the header; each ':' closes a token, white space or
+    //the end of the message closes the header
+    for (;;)
+    {
+        c = (pos < len) ? buffer[pos] : '\0';
+
+        if (   ':'  == c
+            || ' '  == c
+            || '\t' == c
+            || '\0' == c
+            || '\r' == c
+            || '\n' == c )
+        {
+            if (pos > start)
+            {
+                if (SCPI_MAX_LEVELS == hdr->count)
+                {
+                    return -2;      //too many menu levels
+                }
+
+                hdr->token[hdr->count].offset = (uint16_t)start;
+                hdr->token[hdr->count].len    = (uint16_t)(pos - start);
+                hdr->count++;
+            }
+            else if (':' == c)
+            {
+                return -3;          //empty menu level, e.g. "inp::pos"
+            }
+
+            if (':' != c)
+                break;
+
+            start = pos + 1;
+        }
 
-    //clip as needed to prevent segfault
-    if (SCPI_RX_BFR_SZ < (len+1)) {
-        cpy_len = SCPI_RX_BFR_SZ;
+        pos++;
     }
 
-    memcpy(c_buffer, p_buf, cpy_len);
+    scpi_param_span(buffer, pos, len, hdr);
 
-    //put all characters in lowercase form
-    int i=0;
+    return 0;
+}
 
-    for (i = 0; i < cpy_len; i++)
-        c_buffer[i] = tolower(c_buffer[i]);
+// *********************************************************************
+//
+//
+int scpi_find_level(char * buffer, size_t len, int level, char ** found, size_t * found_len)
+{
+    if (   !buffer
+        || (len < SCPI_RX_MIN_LEN))   //Test parameters
+        return -1;
 
-    //parse the root level command / menu
-    char * p_menu = 0;
-    size_t menu_len;
+    scpi_header_t hdr;
 
-    int rc = scpi_find_level(c_buffer, len, level, &p_menu, &menu_len);
-    if (0 > rc || 0 == p_menu)
+    if (   0 > scpi_tokenize(buffer, len, &hdr)
+        || 0 > level
+        || level >= hdr.count )
     {
-        scpi_error_event_handler();
-        *p_reply = s_reply;
-        *p_reply_len = strlen((char *)s_reply);
-        return -1;
+        //unable to find menu level(x)
+        return -2;
     }
 
-    remain -= menu_len;
+    *found      = buffer + hdr.token[level].offset;
+    *found_len  = hdr.token[level].len;
 
-#ifdef SCPI_DBG
-    printf("scpi_find_level() done; root_state:0x%x p_menu:0x%x str: %s menu_len:0x%x\n", root_state, p_menu, p_menu, menu_len);
+    return 0;
+}
+
+
+// *********************************************************************
+//
+//
+void scpi_ctx_init(scpi_ctx_t * ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+#if SCPI_REPLY_SHARED
+    ctx->reply  = s_reply;
 #endif
+    ctx->path   = k_scpi_root_none;
+    ctx->event  = k_scpi_root_none;
+}
 
-    rc = scpi_menu_root_sm(&root_state, p_menu, menu_len);
-    last_state = (uint32_t)root_state;
+// *********************************************************************
+//
+//
+void scpi_hdr_cache_stats(const scpi_ctx_t * ctx, uint32_t * hits, uint32_t * misses)
+{
+    *hits   = ctx->cache.hits;
+    *misses = ctx->cache.misses;
+}
 
-    // 2   - indicates finished processing, with a command type
-    // 1   - indicates finished processing, with a query type
-    // 0   - continue down submenus
-    // < 0 - error
-    switch (rc)
-    {
-    case 0:
-        level++;
-        break;
-    case 1:
-        scpi_query_event_handler(last_state);
-        *event = last_state;
-        *p_reply = s_reply;
-        *p_reply_len = strlen((char *)s_reply);
-        return 1;
-    case 2:
-        scpi_write_event_handler(last_state);
-        *event = last_state;
-        *p_reply = s_reply;
-        *p_reply_len = strlen((char *)s_reply);
-        return 2;
-    default:
-        scpi_error_event_handler();
-        *event = last_state;
-        *p_reply = s_reply;
-        *p_reply_len = strlen((char *)s_reply);
-        return -2;
-    }
+//positions wrap freely, slots are picked with a mask
+typedef char scpi_err_queue_pow2_t[(SCPI_ERR_QUEUE_SZ >= 2 && !(SCPI_ERR_QUEUE_SZ & (SCPI_ERR_QUEUE_SZ - 1))) ? 1 : -1];
+
+// *********************************************************************
+/// Queues an error; lock-free, safe against other producers
+///
+/// One entry is left for the overflow error: once SCPI_ERR_QUEUE_SZ-2
+/// errors wait, later ones only raise the overflow flag.
+///
+void scpi_error_push(scpi_ctx_t * ctx, int16_t code)
+{
+    scpi_err_queue_t * q = &ctx->errors;
+    uint32_t pos;
 
-    // dive into lower sub-menus until the final command is resolved
-    while (!rc)
+    //the error class is latched in the ESR even when the queue is full
+    if (code <= -100 && code > -500)
     {
+        static const uint8_t k_esr_class[4] = { SCPI_ESR_CME, SCPI_ESR_EXE, SCPI_ESR_DDE, SCPI_ESR_QYE };
 
-#ifdef SCPI_DBG
-        printf("scpi_find_level(%d) last_state:0x%x\n", level, last_state);
-#endif
-        // find next level! e.g. level(1)
-        rc = scpi_find_level(c_buffer, len, level, &p_menu, &menu_len);
-        if (0 > rc)
-        {
-            scpi_error_partial_event_handler();
-            *event = last_state;          //return the partial command match (root menu)
-            *p_reply = s_reply;
-            *p_reply_len = strlen((char *)s_reply);
-#ifdef SCPI_DBG
-            printf("scpi_find_level() - failed last_state:0x%x\n", *event);
-#endif
-            return -3;
-        }
+        scpi_atomic_or(&ctx->esr, k_esr_class[-code / 100 - 1]);
 
-#ifdef SCPI_DBG
-        printf("scpi_find_level() done; last_state:0x%x p_menu:0x%x str: %s menu_len:0x%x\n", last_state, p_menu, p_menu, menu_len);
-#endif
-        remain -= menu_len;
+        if ((k_esr_class[-code / 100 - 1] & ctx->ese) || (SCPI_STB_EAV & ctx->sre))
+            scpi_atomic_add(&ctx->srq_rises, 1);
+    }
 
+    pos = scpi_atomic_load(&q->head);
 
-        switch (last_state)
+    do
+    {
+        if (pos - scpi_atomic_load(&q->tail) >= SCPI_ERR_QUEUE_SZ - 2)
         {
-        case k_scpi_root_input:
-        case k_scpi_input_position:
-        case k_scpi_input_position_a0:
-        case k_scpi_input_position_a1:
-        case k_scpi_input_position_a2:
-        case k_scpi_input_position_a3:
-            rc = scpi_menu_input_sm(((scpi_menu_input_t *)(&last_state)), p_menu, menu_len);
-            break;
-        case k_scpi_root_initiate:
-            rc = scpi_menu_initiate_sm(((scpi_menu_initiate_t *)(&last_state)), p_menu, menu_len);
-            break;
-        case k_scpi_root_sense:
-            rc = scpi_menu_input_sm(((scpi_menu_input_t *)(&last_state)), p_menu, menu_len);
-            break;
-            //input submenus
-
-        case k_scpi_input_position_a0_angle:
-        case k_scpi_input_position_a1_angle:
-        case k_scpi_input_position_a2_angle:
-        case k_scpi_input_position_a3_angle:
-            rc = scpi_menu_input_pos_sm((scpi_menu_input_position_axis_angle_t *)&last_state, p_menu, menu_len);
-            break;
+            scpi_atomic_store(&q->overflow, TRUE);
+            return;
         }
 
-        //continue seeking?
-        if (!rc)
-        {
-            level++;
-        }
-    }
+    } while (!scpi_atomic_cas(&q->head, &pos, pos + 1));
 
+    q->code[pos & (SCPI_ERR_QUEUE_SZ - 1)] = code;
+    scpi_atomic_store(&q->seq[pos & (SCPI_ERR_QUEUE_SZ - 1)], pos + 1);
+}
 
-    // 2   - indicates finished processing, with a command type
-    // 1   - indicates finished processing, with a query type
-    // 0   - continue down submenus
-    // < 0 - error
-    switch (rc)
+// *********************************************************************
+/// Oldest error; the overflow error follows the errors that were queued
+///
+/// An error still being written by another task is left for the next call.
+///
+int16_t scpi_error_pop(scpi_ctx_t * ctx)
+{
+    scpi_err_queue_t * q = &ctx->errors;
+    uint32_t tail = q->tail;
+    int16_t code;
+
+    if (scpi_atomic_load(&q->seq[tail & (SCPI_ERR_QUEUE_SZ - 1)]) != tail + 1)
     {
-    case 0:
-        level++;
-        break;
-    case 1:
-        scpi_query_event_handler(last_state);
-        *event = last_state;
-        *p_reply = s_reply;
-        *p_reply_len = strlen((char *)s_reply);
-        return 1;
-    case 2:
-        scpi_write_event_handler(last_state);
-        *event = last_state;
-        *p_reply = s_reply;
-        *p_reply_len = strlen((char *)s_reply);
-        return 2;
-    default:
-        scpi_error_event_handler();
-        *event = last_state;
-        *p_reply = s_reply;
-        *p_reply_len = strlen((char *)s_reply);
-        return -2;
+        if (tail == scpi_atomic_load(&q->head) && scpi_atomic_exchange(&q->overflow, FALSE))
+            return k_scpi_err_queue_overflow;
+
+        return k_scpi_err_none;
     }
 
+    code = q->code[tail & (SCPI_ERR_QUEUE_SZ - 1)];
+    scpi_atomic_store(&q->tail, tail + 1);
 
+    return code;
+}
 
-//    // level should be "1"...
-//    //root_state should already be a valid sub-menu
-//    switch(root_state)
-//    {
-//    case k_scpi_root_input:
-//
-//        break;
-//    case k_scpi_root_initiate:
-//        break;
-//    case k_scpi_root_sense:
-//        break;
-//    default:
-//        scpi_error_event_handler();
-//        *event = last_state;          //return the partial command match (root menu)
-//        *p_reply = s_reply;
-//        *p_reply_len = strlen((char *)s_reply);
-//        return -4;
-//    }
+// *********************************************************************
 //
-//    rc = scpi_find_level(p_menu, menu_len, level, &p_menu, &menu_len);
-//    if (0 > rc)
-//    {
-//        scpi_error_event_handler();
-//        *event = last_state;          //return the partial command match (root menu)
-//        *p_reply = s_reply;
-//        *p_reply_len = strlen((char *)s_reply);
-//        return -3;
-//    }
+//
+uint32_t scpi_error_count(const scpi_ctx_t * ctx)
+{
+    const scpi_err_queue_t * q = &ctx->errors;
 
-    return -5;
+    return (scpi_atomic_load(&q->head) - scpi_atomic_load(&q->tail)) + (scpi_atomic_load(&q->overflow) ? 1 : 0);
 }
 
-// **********************************************************************************
-// Menu state machine handlers
+// *********************************************************************
 //
-int scpi_menu_root_sm(scpi_menu_root_t *state, const char * str, size_t str_len )
+//
+const char * scpi_error_str(int16_t code)
 {
-    if (!str || !str_len)
-        return -1;
-
-    char filter = 0;
-
-    //pre-filter on the first character so we don't test every string under the sun when parsing for a match
-    if (str_len > 1)
+    switch (code)
     {
-        if ('*' == str[0])
-        {
-            filter = str[1];
-        }
-        else
-        {
-            filter = str[0];
-        }
+    case k_scpi_err_none:                   return "No error";
+    case k_scpi_err_syntax:                 return "Syntax error";
+    case k_scpi_err_data_type:              return "Data type error";
+    case k_scpi_err_missing_parameter:      return "Missing parameter";
+    case k_scpi_err_undefined_header:       return "Undefined header";
+    case k_scpi_err_numeric_data:           return "Numeric data error";
+    case k_scpi_err_invalid_char_in_number: return "Invalid character in number";
+    case k_scpi_err_execution:              return "Execution error";
+    case k_scpi_err_init_ignored:           return "Init ignored";
+    case k_scpi_err_settings_conflict:      return "Settings conflict";
+    case k_scpi_err_out_of_range:           return "Data out of range";
+    case k_scpi_err_queue_overflow:         return "Queue overflow";
+    case k_scpi_err_input_overrun:          return "Input buffer overrun";
+    default:                                return "";
     }
+}
 
-    switch (filter)
-    {
-    case 'i':
-        if (   scpi_is_menu_match(str, str_len-1, k_scpi_str_idn)
-            && '?' == str[str_len-1]                              )
-        {
-            *state = k_scpi_root_q_idn;
-            return 1;
-        }
-        else if (scpi_is_menu_match(str, str_len, k_scpi_str_input))
-        {
-            *state = k_scpi_root_input;
-            return 0;
-        }
-        else if (scpi_is_menu_match(str, str_len, k_scpi_str_initiate))
-        {
-            *state = k_scpi_root_initiate;
-            return 0;
-        }
-        break;
-    case 'o':
-        if (scpi_is_menu_match(str, str_len-1, k_scpi_str_opc)
-                && '?' == str[str_len-1]                              )
-        {
-            *state = k_scpi_root_q_opc;
-            return 1;
-
-        }
-        else if (scpi_is_menu_match(str, str_len, k_scpi_str_opc))
-        {
-            *state = k_scpi_root_opc;
-            return 2;
-        }
-        break;
-    case 'r':
-        if (scpi_is_menu_match(str, str_len, k_scpi_str_rst))
-        {
-            *state = k_scpi_root_rst;
-            return 2;
-        }
-        break;
-    case 's':
-        if (scpi_is_menu_match(str, str_len, k_scpi_str_sense))
-        {
-            *state = k_scpi_root_sense;
-            return 0;
-        }
-        break;
+// *********************************************************************
+//
+//
+void scpi_op_begin(void)
+{
+    scpi_atomic_add(&s_ops_pending, 1);
+}
+
+void scpi_op_end(void)
+{
+    if (0 == scpi_atomic_add(&s_ops_pending, -1))
+        scpi_atomic_add(&s_ops_idle, 1);
+}
+
+uint32_t scpi_ops_pending(void)
+{
+    return scpi_atomic_load(&s_ops_pending);
+}
+
+uint32_t scpi_ops_idle(void)
+{
+    return scpi_atomic_load(&s_ops_idle);
+}
+
+// *********************************************************************
+/// TRUE once the operations pending when idle was sampled have finished
+///
+static int scpi_ops_done_since(uint32_t idle)
+{
+    return (0 == scpi_ops_pending() || idle != scpi_ops_idle()) ? TRUE : FALSE;
+}
+
+// *********************************************************************
+/// Sets SCPI_ESR_OPC once the operations pending at *OPC have finished
+///
+static void scpi_opc_update(scpi_ctx_t * ctx)
+{
+    if (ctx->opc_armed && scpi_ops_done_since(ctx->opc_idle))
+    {
+        ctx->opc_armed = FALSE;
+        scpi_atomic_or(&ctx->esr, SCPI_ESR_OPC);
+
+        if (SCPI_ESR_OPC & ctx->ese)
+            scpi_atomic_add(&ctx->srq_rises, 1);
     }
+}
+
+// *********************************************************************
+//
+//
+uint32_t scpi_esr_get(scpi_ctx_t * ctx)
+{
+    scpi_opc_update(ctx);
+
+    return scpi_atomic_load(&ctx->esr);
+}
+
+// *********************************************************************
+//
+//
+uint32_t scpi_stb_get(scpi_ctx_t * ctx)
+{
+    uint32_t stb = 0;
 
+    if (scpi_error_count(ctx))
+        stb |= SCPI_STB_EAV;
 
+    if (scpi_atomic_load(&s_status[k_scpi_reg_questionable].event) & s_status[k_scpi_reg_questionable].enable)
+        stb |= SCPI_STB_QUES;
 
-    return -1;
+    if (scpi_esr_get(ctx) & ctx->ese)
+        stb |= SCPI_STB_ESB;
+
+    if (scpi_atomic_load(&s_status[k_scpi_reg_operation].event) & s_status[k_scpi_reg_operation].enable)
+        stb |= SCPI_STB_OPER;
+
+    if (stb & ctx->sre)
+        stb |= SCPI_STB_MSS;
+
+    return stb;
 }
 
 // *********************************************************************
 //
 //
-int scpi_menu_input_sm(scpi_menu_input_t *state, const char * str, size_t str_len )
+void scpi_status_set(scpi_status_reg_t reg, uint32_t bits)
 {
-    if (!str || !str_len)
-        return -1;
+    scpi_status_t * r = &s_status[reg];
+    uint32_t rising = bits & ~scpi_atomic_or(&r->condition, bits);
+
+    if (rising)
+    {
+        scpi_atomic_or(&r->event, rising);
+
+        if (rising & scpi_atomic_load(&r->enable))
+            scpi_atomic_add(&s_srq_rises, 1);
+    }
+}
+
+void scpi_status_clear(scpi_status_reg_t reg, uint32_t bits)
+{
+    scpi_atomic_and(&s_status[reg].condition, ~bits);
+}
+
+uint32_t scpi_status_condition(scpi_status_reg_t reg)
+{
+    return scpi_atomic_load(&s_status[reg].condition);
+}
 
-    const int expect_sz  = 4;
-    scpi_menu_string_t expect[expect_sz];
-    scpi_menu_string_t matched = k_scpi_str_unknown;
+// *********************************************************************
+//
+//
+void scpi_ctx_notify(scpi_ctx_t * ctx, scpi_notify_fn fn, void * user)
+{
+    ctx->notify      = fn;
+    ctx->notify_user = user;
+}
+
+// *********************************************************************
+/// Both counts only grow, so their sum changes whenever either does
+///
+static uint32_t scpi_srq_rises(const scpi_ctx_t * ctx)
+{
+    return scpi_atomic_load(&s_srq_rises) + scpi_atomic_load(&ctx->srq_rises);
+}
 
-    for (int i = 0; i < expect_sz; i++)
+// *********************************************************************
+//
+//
+int scpi_parse_nrf(const char * str, size_t len, scpi_angle_t * value)
+{
+    uint64_t    mant        = 0;        //significant digits, at most 18
+    int         exp10       = 0;        //power of ten applied to mant
+    int         exp_val     = 0;
+    int         neg         = FALSE;
+    int         exp_neg     = FALSE;
+    int         digits      = 0;
+    int         seen_point  = FALSE;
+    uint64_t    pow10       = 1;
+    uint64_t    scaled;
+    size_t      pos         = 0;
+    int         shift;
+
+    if (pos < len && ('+' == str[pos] || '-' == str[pos]))
     {
-        expect[i] = k_scpi_str_unknown;
+        neg = ('-' == str[pos]);
+        pos++;
     }
 
-    switch (*state)
+    //mantissa: digits with an optional decimal point
+    for (; pos < len; pos++)
     {
+        char c = str[pos];
 
-    case k_scpi_input:
-        expect[0] = k_scpi_str_position;
-        break;
-    case k_scpi_input_position:
-        expect[0] = k_scpi_str_a0;
-        expect[1] = k_scpi_str_a1;
-        expect[2] = k_scpi_str_a2;
-        expect[3] = k_scpi_str_a3;
-        break;
-    case k_scpi_input_position_a0:
-    case k_scpi_input_position_a1:
-    case k_scpi_input_position_a2:
-    case k_scpi_input_position_a3:
-        expect[0] = k_scpi_str_angle;
-        break;
+        if ('0' <= c && c <= '9')
+        {
+            if (mant < 100000000000000000ull)
+            {
+                mant = mant * 10 + (uint64_t)(c - '0');
+                if (seen_point)
+                    exp10--;
+            }
+            else if (!seen_point)
+            {
+                exp10++;                //too many digits to keep, track magnitude only
+            }
+            digits++;
+        }
+        else if ('.' == c && !seen_point)
+        {
+            seen_point = TRUE;
+        }
+        else
+        {
+            break;
+        }
     }
 
-    for (int i = 0; i < expect_sz; i++)
+    if (!digits)
+        return k_scpi_err_numeric_data;
+
+    //optional exponent
+    if (pos < len && ('e' == (str[pos] | 0x20)))
     {
-        if (k_scpi_str_unknown == expect[i])
+        pos++;
+
+        if (pos < len && ('+' == str[pos] || '-' == str[pos]))
         {
-            break;
+            exp_neg = ('-' == str[pos]);
+            pos++;
         }
-        else if ( scpi_is_menu_match(str, str_len, expect[i]) )
+
+        if (pos == len || str[pos] < '0' || str[pos] > '9')
+            return k_scpi_err_numeric_data;
+
+        for (; pos < len && '0' <= str[pos] && str[pos] <= '9'; pos++)
         {
-            matched = expect[i];
-            break;
+            if (exp_val < 1000)
+                exp_val = exp_val * 10 + (str[pos] - '0');
         }
+
+        exp10 += exp_neg ? -exp_val : exp_val;
     }
 
-    if (!(int)matched)
+    if (pos != len)
+        return k_scpi_err_invalid_char_in_number;
+
+    //scale to fixed point: value = mant * 10^(exp10 + SCPI_ANGLE_DIGITS)
+    shift = exp10 + SCPI_ANGLE_DIGITS;
+
+    if (!mant || shift < -19)
     {
-        return -2;  //failed to match a valid string, exit
+        scaled = 0;
     }
+    else if (shift < 0)
+    {
+        while (shift++ < 0)
+            pow10 *= 10;
 
-    switch (matched)
+        scaled = (mant + pow10 / 2) / pow10;        //round half away from zero
+    }
+    else
     {
-    case k_scpi_str_position:
-        *state = k_scpi_input_position;
-        return 0;   //continue seek
-    case k_scpi_str_a0:
-        *state = k_scpi_input_position_a0;
-        return 0;
-    case k_scpi_str_a1:
-        *state = k_scpi_input_position_a1;
-        return 0;
-    case k_scpi_str_a2:
-        *state = k_scpi_input_position_a2;
-        return 0;
-    case k_scpi_str_a3:
-        *state = k_scpi_input_position_a3;
-        return 0;
-    case k_scpi_str_angle:
+        scaled = mant;
 
-        switch (*state)
+        while (shift-- > 0)
         {
-        case k_scpi_input_position_a0:
-            *state = k_scpi_input_position_a0_angle;
-            return 0;
-        case k_scpi_input_position_a1:
-            *state = k_scpi_input_position_a1_angle;
-            return 0;
-        case k_scpi_input_position_a2:
-            *state = k_scpi_input_position_a2_angle;
-            return 0;
-        case k_scpi_input_position_a3:
-            *state = k_scpi_input_position_a3_angle;
-            return 0;
-        }
+            if (scaled > (uint64_t)INT32_MAX)
+                return k_scpi_err_out_of_range;
 
-        break;
+            scaled *= 10;
+        }
     }
 
-    return -3;
+    if (scaled > (uint64_t)INT32_MAX)
+        return k_scpi_err_out_of_range;
+
+    *value = neg ? -(scpi_angle_t)scaled : (scpi_angle_t)scaled;
+
+    return 0;
 }
 
 // *********************************************************************
 //
 //
-int scpi_menu_initiate_sm(scpi_menu_initiate_t *state, const char * str, size_t str_len )
+int scpi_parse_numeric(const char * str, size_t len, scpi_param_t * param)
 {
-    if (!str || !str_len)
-        return -1;
+    param->kind  = k_scpi_num_none;
+    param->value = 0;
 
-    scpi_menu_string_t expect = k_scpi_str_unknown;
-    scpi_menu_string_t matched = k_scpi_str_unknown;
+    if (!len)
+        return 0;
 
-    switch (*state)
+    if (   (3 == len && scpi_str_eq_nocase(str, "min", 3))
+        || (7 == len && scpi_str_eq_nocase(str, "minimum", 7)) )
     {
-
-    case k_scpi_initiate:
-        expect = k_scpi_str_immediate;
-        break;
+        param->kind = k_scpi_num_min;
+        return 0;
     }
 
-
-    if (k_scpi_str_unknown == expect)
+    if (   (3 == len && scpi_str_eq_nocase(str, "max", 3))
+        || (7 == len && scpi_str_eq_nocase(str, "maximum", 7)) )
     {
-        return -2;
+        param->kind = k_scpi_num_max;
+        return 0;
     }
-    else if (   scpi_is_menu_match(str, str_len, expect) )
+
+    if (   (3 == len && scpi_str_eq_nocase(str, "def", 3))
+        || (7 == len && scpi_str_eq_nocase(str, "default", 7)) )
     {
-        matched = expect;
+        param->kind = k_scpi_num_def;
+        return 0;
     }
 
+    param->kind = k_scpi_num_value;
+
+    return scpi_parse_nrf(str, len, &param->value);
+}
+
+// *********************************************************************
+//
+//
+int scpi_parse_bool(const char * str, size_t len, uint8_t * value)
+{
+    scpi_angle_t num;
 
-    if (!(int)matched)
+    if (2 == len && scpi_str_eq_nocase(str, "on", 2))
     {
-        return -3;  //failed to match a valid string, exit
+        *value = TRUE;
+        return 0;
     }
 
-    switch (matched)
+    if (3 == len && scpi_str_eq_nocase(str, "off", 3))
     {
-    case k_scpi_str_immediate:
-        *state = k_scpi_initiate_immediate;
-        return 1;   //Accept command
+        *value = FALSE;
+        return 0;
     }
 
-    return -4;
+    if (0 > scpi_parse_nrf(str, len, &num))
+        return k_scpi_err_data_type;
+
+    *value = (num != 0) ? TRUE : FALSE;
+
+    return 0;
 }
 
 // *********************************************************************
 //
 //
-int scpi_menu_input_pos_sm(scpi_menu_input_position_axis_angle_t *state, const char * str, size_t str_len )
+const scpi_axis_t * scpi_axis_get(int axis)
 {
-    if (!str || !str_len)
-        return -1;
+    if (!s_ready)
+        scpi_init();
 
-    const int expect_sz  = 4;
-    scpi_menu_string_t expect[expect_sz];
-    scpi_menu_string_t matched = k_scpi_str_unknown;
+    return (0 <= axis && axis < SCPI_NUM_AXES) ? &s_axes[axis] : 0;
+}
 
-    for (int i = 0; i < expect_sz; i++)
-    {
-        expect[i] = k_scpi_str_unknown;
-    }
+// *********************************************************************
+//
+//
+void scpi_axis_reset(void)
+{
+    int i;
 
-    switch (*state)
+    for (i = 0; i < SCPI_NUM_AXES; i++)
     {
-        case k_scpi_input_position_axis_none:
-            break;
-        case k_scpi_input_position_a0_axis:
-        case k_scpi_input_position_a1_axis:
-        case k_scpi_input_position_a2_axis:
-        case k_scpi_input_position_a3_axis:
-            expect[0] = k_scpi_str_limit;
-            expect[1] = k_scpi_str_direction;
-            expect[2] = k_scpi_str_immediate;
-            break;
-        case k_scpi_input_position_a0_limit:
-        case k_scpi_input_position_a1_limit:
-        case k_scpi_input_position_a2_limit:
-        case k_scpi_input_position_a3_limit:
-            expect[0] = k_scpi_str_low;
-            expect[1] = k_scpi_str_high;
-            expect[2] = k_scpi_str_state;
-            break;
-        default:
-            break;
+        s_axes[i].limit_low     = SCPI_ANGLE_LIMIT_LOW_DEF;
+        s_axes[i].limit_high    = SCPI_ANGLE_LIMIT_HIGH_DEF;
+        s_axes[i].target        = 0;
+        s_axes[i].limit_enabled = TRUE;
     }
+}
+
+// *********************************************************************
+/// Applies a parsed angle parameter to one end of an axis limit
+///
+static int scpi_write_limit(scpi_axis_t * axis, const scpi_param_t * param, int high)
+{
+    scpi_angle_t angle;
 
-    for (int i = 0; i < expect_sz; i++)
+    switch (param->kind)
     {
-        if (k_scpi_str_unknown == expect[i])
-        {
-            break;
-        }
-        else if ( scpi_is_menu_match(str, str_len, expect[i]) )
-        {
-            matched = expect[i];
-            break;
-        }
+    case k_scpi_num_none:
+        return 0;
+    case k_scpi_num_min:
+        angle = SCPI_ANGLE_LIMIT_LOW_DEF;
+        break;
+    case k_scpi_num_max:
+        angle = SCPI_ANGLE_LIMIT_HIGH_DEF;
+        break;
+    case k_scpi_num_def:
+        angle = high ? SCPI_ANGLE_LIMIT_HIGH_DEF : SCPI_ANGLE_LIMIT_LOW_DEF;
+        break;
+    default:
+        angle = param->value;
+        break;
     }
 
-    if (!(int)matched)
+    if (   angle < SCPI_ANGLE_LIMIT_LOW_DEF
+        || angle > SCPI_ANGLE_LIMIT_HIGH_DEF
+        || ( high && angle < axis->limit_low)
+        || (!high && angle > axis->limit_high) )
     {
-        return -2;  //failed to match a valid string, exit
+        return k_scpi_err_out_of_range;
     }
 
-    switch (matched)
+    if (high)
+        axis->limit_high = angle;
+    else
+        axis->limit_low  = angle;
+
+    return 0;
+}
+
+// *********************************************************************
+/// Resolves a parsed angle parameter into a target for the axis; the
+/// axis is not changed, the caller stores the target once the move is queued
+///
+static int scpi_read_target(const scpi_axis_t * axis, const scpi_param_t * param, scpi_angle_t * angle)
+{
+    switch (param->kind)
     {
-    case k_scpi_str_immediate:
-        switch (*state)
-        {
-        case k_scpi_input_position_a0_axis:
-            *state = k_scpi_input_position_a0_immediate;
-            return 2;
-        case k_scpi_input_position_a1_axis:
-            *state = k_scpi_input_position_a1_immediate;
-            return 2;
-        case k_scpi_input_position_a2_axis:
-            *state = k_scpi_input_position_a2_immediate;
-            return 2;
-        case k_scpi_input_position_a3_axis:
-            *state = k_scpi_input_position_a3_immediate;
-            return 2;
-        default:
-            break;
-        }
-        break;
-    case k_scpi_str_limit:
-        switch (*state)
-        {
-        case k_scpi_input_position_a0_axis:
-            *state = k_scpi_input_position_a0_limit;
-            return 0;
-        case k_scpi_input_position_a1_axis:
-            *state = k_scpi_input_position_a1_limit;
-            return 0;
-        case k_scpi_input_position_a2_axis:
-            *state = k_scpi_input_position_a2_limit;
-            return 0;
-        case k_scpi_input_position_a3_axis:
-            *state = k_scpi_input_position_a3_limit;
-            return 0;
-        default:
-            break;
-        }
-        break;
-    case k_scpi_str_direction:
-        switch (*state)
-        {
-        case k_scpi_input_position_a0_axis:
-            *state = k_scpi_input_position_a0_dir;
-            return 2;
-        case k_scpi_input_position_a1_axis:
-            *state = k_scpi_input_position_a1_dir;
-            return 2;
-        case k_scpi_input_position_a2_axis:
-            *state = k_scpi_input_position_a2_dir;
-            return 2;
-        case k_scpi_input_position_a3_axis:
-            *state = k_scpi_input_position_a3_dir;
-            return 2;
-        default:
-            break;
-        }
+    case k_scpi_num_min:
+        *angle = axis->limit_low;
         break;
-    case k_scpi_str_low:
-        switch (*state)
-        {
-        case k_scpi_input_position_a0_limit:
-            *state = k_scpi_input_position_a0_limit_low;
-            return 2;
-        case k_scpi_input_position_a1_limit:
-            *state = k_scpi_input_position_a1_limit_low;
-            return 2;
-        case k_scpi_input_position_a2_limit:
-            *state = k_scpi_input_position_a2_limit_low;
-            return 2;
-        case k_scpi_input_position_a3_limit:
-            *state = k_scpi_input_position_a3_limit_low;
-            return 2;
-        default:
-            break;
-        }
+    case k_scpi_num_max:
+        *angle = axis->limit_high;
         break;
-    case k_scpi_str_high:
-        switch (*state)
-        {
-        case k_scpi_input_position_a0_limit:
-            *state = k_scpi_input_position_a0_limit_high;
-            return 2;
-        case k_scpi_input_position_a1_limit:
-            *state = k_scpi_input_position_a1_limit_high;
-            return 2;
-        case k_scpi_input_position_a2_limit:
-            *state = k_scpi_input_position_a2_limit_high;
-            return 2;
-        case k_scpi_input_position_a3_limit:
-            *state = k_scpi_input_position_a3_limit_high;
-            return 2;
-        default:
-            break;
-        }
+    case k_scpi_num_def:
+        *angle = 0;
         break;
-    case k_scpi_str_state:
-        switch (*state)
-        {
-        case k_scpi_input_position_a0_limit:
-            *state = k_scpi_input_position_a0_limit_state;
-            return 2;
-        case k_scpi_input_position_a1_limit:
-            *state = k_scpi_input_position_a1_limit_state;
-            return 2;
-        case k_scpi_input_position_a2_limit:
-            *state = k_scpi_input_position_a2_limit_state;
-            return 2;
-        case k_scpi_input_position_a3_limit:
-            *state = k_scpi_input_position_a3_limit_state;
-            return 2;
-        default:
-            break;
-        }
+    default:
+        *angle = param->value;
         break;
     }
 
-    return -3;
+    if (   axis->limit_enabled
+        && (*angle < axis->limit_low || *angle > axis->limit_high) )
+    {
+        return k_scpi_err_out_of_range;
+    }
+
+    return 0;
+}
+
+// *********************************************************************
+// Built-in handlers, bound by scpi_handlers_reset()
+//
+static int scpi_on_idn(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_reply_str(ctx, STR_REPLY_IDN);
+
+    return 0;
+}
+
+// *OPC - arms SCPI_ESR_OPC
+static int scpi_on_opc(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    ctx->opc_idle  = scpi_ops_idle();
+    ctx->opc_armed = TRUE;
+    scpi_opc_update(ctx);
+
+    return 0;
+}
+
+// *OPC? - replies once nothing is pending; until then the message waits
+static int scpi_on_opc_query(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    uint32_t idle = scpi_ops_idle();
+
+    if (scpi_ops_done_since(idle))
+    {
+        scpi_reply_str(ctx, STR_REPLY_OK1);
+    }
+    else
+    {
+        ctx->wait      = SCPI_WAIT_OPC_Q;
+        ctx->wait_idle = idle;
+    }
+
+    return 0;
+}
+
+// *WAI - the units that follow wait until nothing is pending
+static int scpi_on_wai(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    uint32_t idle = scpi_ops_idle();
+
+    if (!scpi_ops_done_since(idle))
+    {
+        ctx->wait      = SCPI_WAIT_WAI;
+        ctx->wait_idle = idle;
+    }
+
+    return 0;
+}
+
+static int scpi_on_rst(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_axis_reset();
+    scpi_sweep_abort();
+    scpi_sweep_config_reset();
+
+    //*RST returns to the operation complete idle state
+    ctx->opc_armed = FALSE;
+
+    return 0;
+}
+
+// *********************************************************************
+/// Decimal text of an unsigned value; buf holds at least 11 characters
+///
+static char * scpi_fmt_uint(char * buf, uint32_t value)
+{
+    char        digits[10];
+    int         n = 0;
+    char *      out = buf;
+
+    do
+    {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+
+    } while (value);
+
+    while (n)
+        *out++ = digits[--n];
+
+    *out = 0;
+
+    return out;
+}
+
+// *********************************************************************
+/// Decimal text of a signed value; buf holds at least 12 characters
+///
+static char * scpi_fmt_int(char * buf, int32_t value)
+{
+    if (value < 0)
+    {
+        *buf++ = '-';
+        return scpi_fmt_uint(buf, 0u - (uint32_t)value);
+    }
+
+    return scpi_fmt_uint(buf, (uint32_t)value);
+}
+
+// *********************************************************************
+/// Angle in degrees with SCPI_ANGLE_DIGITS decimals; buf holds at least 16 characters
+///
+static char * scpi_fmt_angle(char * buf, scpi_angle_t value)
+{
+    uint32_t    mag = (value < 0) ? 0u - (uint32_t)value : (uint32_t)value;
+    char *      out = buf;
+    int         n;
+
+    if (value < 0)
+        *out++ = '-';
+
+    out = scpi_fmt_uint(out, mag / SCPI_ANGLE_SCALE);
+    *out++ = '.';
+
+    for (n = SCPI_ANGLE_DIGITS, mag %= SCPI_ANGLE_SCALE; n--; mag /= 10)
+        out[n] = (char)('0' + mag % 10);
+
+    out += SCPI_ANGLE_DIGITS;
+    *out = 0;
+
+    return out;
+}
+
+// SYSTem:ERRor[:NEXT]? - <code>,"<description>"
+static int scpi_on_error_next(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    char        reply[64];
+    int16_t     code = scpi_error_pop(ctx);
+    const char * str = scpi_error_str(code);
+    char *      end = scpi_fmt_int(reply, code);
+    size_t      len = strlen(str);
+
+    if (len > sizeof(reply) - (size_t)(end - reply) - 4)
+        len = sizeof(reply) - (size_t)(end - reply) - 4;
+
+    *end++ = ',';
+    *end++ = '"';
+    memcpy(end, str, len);
+    end += len;
+    *end++ = '"';
+    *end   = 0;
+
+    scpi_reply_str(ctx, reply);
+
+    return 0;
+}
+
+// SYSTem:ERRor:COUNt?
+static int scpi_on_error_count(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    char reply[12];
+
+    scpi_fmt_int(reply, (int32_t)scpi_error_count(ctx));
+    scpi_reply_str(ctx, reply);
+
+    return 0;
+}
+
+// *********************************************************************
+/// Reads a register value parameter, <NRf> rounded to an integer 0..max
+///
+static int scpi_param_reg(const scpi_ctx_t * ctx, uint32_t max, uint32_t * value)
+{
+    scpi_param_t param;
+    uint32_t reg;
+    int rc = scpi_parse_numeric(ctx->param, ctx->param_len, &param);
+
+    if (rc)
+        return rc;
+
+    switch (param.kind)
+    {
+    case k_scpi_num_none:
+        return k_scpi_err_missing_parameter;
+    case k_scpi_num_max:
+        *value = max;
+        return 0;
+    case k_scpi_num_min:
+    case k_scpi_num_def:
+        *value = 0;
+        return 0;
+    default:
+        break;
+    }
+
+    if (param.value < -(SCPI_ANGLE_SCALE / 2))
+        return k_scpi_err_out_of_range;
+
+    //rounded in unsigned arithmetic; the half added in int would overflow near INT32_MAX
+    reg = ((uint32_t)param.value + SCPI_ANGLE_SCALE / 2) / SCPI_ANGLE_SCALE;
+
+    if (reg > max)
+        return k_scpi_err_out_of_range;
+
+    *value = reg;
+
+    return 0;
+}
+
+static void scpi_reply_uint(scpi_ctx_t * ctx, uint32_t value)
+{
+    char reply[12];
+
+    scpi_fmt_uint(reply, value);
+    scpi_reply_str(ctx, reply);
+}
+
+// *********************************************************************
+//
+//
+int scpi_srq_poll(scpi_ctx_t * ctx)
+{
+    char        line[4 + 12 + sizeof(SCPI_REPLY_EOL)] = "SRQ ";
+    char *      end;
+    uint32_t    rises;
+    uint32_t    stb;
+
+    if (!ctx->srq_on || !ctx->notify)
+        return FALSE;
+
+    scpi_opc_update(ctx);
+
+    rises = scpi_srq_rises(ctx);
+    if (rises == ctx->srq_seen)
+        return FALSE;
+
+    ctx->srq_seen = rises;
+
+    stb = scpi_stb_get(ctx);
+    if (!(stb & SCPI_STB_MSS))
+        return FALSE;
+
+    end = scpi_fmt_int(line + 4, (int32_t)stb);
+    memcpy(end, SCPI_REPLY_EOL, sizeof(SCPI_REPLY_EOL));
+
+    ctx->notify(ctx, line, (size_t)(end - line) + sizeof(SCPI_REPLY_EOL) - 1, ctx->notify_user);
+
+    return TRUE;
+}
+
+// SYSTem:SRQ ON|OFF - only rises after subscribing are pushed
+static int scpi_on_srq(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    uint8_t on;
+    int rc;
+
+    if (!ctx->param_len)
+        return k_scpi_err_missing_parameter;
+
+    rc = scpi_parse_bool(ctx->param, ctx->param_len, &on);
+    if (rc)
+        return rc;
+
+    scpi_opc_update(ctx);
+
+    ctx->srq_seen = scpi_srq_rises(ctx);
+    ctx->srq_on   = on;
+
+    return 0;
+}
+
+static int scpi_on_srq_query(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_reply_str(ctx, ctx->srq_on ? "1" : "0");
+
+    return 0;
+}
+
+// *CLS - clears the event registers and the error queue
+static int scpi_on_cls(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    int i;
+
+    while (k_scpi_err_none != scpi_error_pop(ctx))
+        ;
+
+    for (i = 0; i < k_scpi_reg_count; i++)
+        scpi_atomic_exchange(&s_status[i].event, 0);
+
+    //*CLS also returns to the operation complete idle state
+    ctx->opc_armed = FALSE;
+    scpi_atomic_exchange(&ctx->esr, 0);
+
+    return 0;
+}
+
+// *ESE <n> / *SRE <n>
+static int scpi_on_ese(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    return scpi_param_reg(ctx, 0xff, &ctx->ese);
+}
+
+static int scpi_on_sre(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    int rc = scpi_param_reg(ctx, 0xff, &ctx->sre);
+
+    //MSS cannot enable itself
+    ctx->sre &= ~SCPI_STB_MSS;
+
+    return rc;
+}
+
+static int scpi_on_ese_query(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_reply_uint(ctx, ctx->ese);
+
+    return 0;
+}
+
+static int scpi_on_sre_query(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_reply_uint(ctx, ctx->sre);
+
+    return 0;
+}
+
+// *ESR? - reading clears it
+static int scpi_on_esr_query(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_opc_update(ctx);
+    scpi_reply_uint(ctx, scpi_atomic_exchange(&ctx->esr, 0));
+
+    return 0;
+}
+
+static int scpi_on_stb_query(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_reply_uint(ctx, scpi_stb_get(ctx));
+
+    return 0;
+}
+
+// STATus:OPERation|QUEStionable[:EVENt]? - reading clears it; user is the register
+static int scpi_on_status_event(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_reply_uint(ctx, scpi_atomic_exchange(&((scpi_status_t *)user)->event, 0));
+
+    return 0;
+}
+
+static int scpi_on_status_condition(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_reply_uint(ctx, scpi_atomic_load(&((scpi_status_t *)user)->condition));
+
+    return 0;
+}
+
+static int scpi_on_status_enable(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    uint32_t value;
+    int rc = scpi_param_reg(ctx, SCPI_STATUS_MASK, &value);
+
+    if (!rc)
+        scpi_atomic_store(&((scpi_status_t *)user)->enable, value);
+
+    return rc;
+}
+
+static int scpi_on_status_enable_query(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_reply_uint(ctx, scpi_atomic_load(&((scpi_status_t *)user)->enable));
+
+    return 0;
+}
+
+// STATus:PRESet - disables the OPERation and QUEStionable summaries
+static int scpi_on_status_preset(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    int i;
+
+    for (i = 0; i < k_scpi_reg_count; i++)
+        scpi_atomic_store(&s_status[i].enable, 0);
+
+    return 0;
+}
+
+// queues the move and returns; the motion task runs it
+static int scpi_on_axis_target(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_axis_t * axis = (scpi_axis_t *)user;
+    scpi_param_t param;
+    scpi_angle_t angle;
+    int rc = scpi_parse_numeric(ctx->param, ctx->param_len, &param);
+
+    if (!rc && k_scpi_num_none == param.kind)
+        rc = k_scpi_err_missing_parameter;
+
+    if (!rc)
+        rc = scpi_read_target(axis, &param, &angle);
+
+    if (!rc)
+        rc = scpi_motion_submit((int)(axis - s_axes), angle);
+
+    //a move that was not queued leaves the last accepted target
+    if (!rc)
+        axis->target = angle;
+
+    return rc;
+}
+
+static int scpi_on_axis_limit_low(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_param_t param;
+    int rc = scpi_parse_numeric(ctx->param, ctx->param_len, &param);
+
+    if (!rc && k_scpi_num_none == param.kind)
+        rc = k_scpi_err_missing_parameter;
+
+    return rc ? rc : scpi_write_limit((scpi_axis_t *)user, &param, FALSE);
+}
+
+static int scpi_on_axis_limit_high(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_param_t param;
+    int rc = scpi_parse_numeric(ctx->param, ctx->param_len, &param);
+
+    if (!rc && k_scpi_num_none == param.kind)
+        rc = k_scpi_err_missing_parameter;
+
+    return rc ? rc : scpi_write_limit((scpi_axis_t *)user, &param, TRUE);
+}
+
+static int scpi_on_axis_limit_state(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    if (!ctx->param_len)
+        return k_scpi_err_missing_parameter;
+
+    return scpi_parse_bool(ctx->param, ctx->param_len, &((scpi_axis_t *)user)->limit_enabled);
+}
+
+// INITiate[:IMMediate] - starts a sweep with the SENSe:SWEep settings; the motion task runs it
+static int scpi_on_initiate(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    return scpi_sweep_start();
+}
+
+// ABORt - stops the running sweep
+static int scpi_on_abort(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_sweep_abort();
+
+    return 0;
+}
+
+// *********************************************************************
+/// Reads a sweep angle parameter into 1/SCPI_SWEEP_ANGLE_SCALE degree,
+/// low..high; MINimum / MAXimum / DEFault give low, high and def
+///
+static int scpi_param_sweep_angle(const scpi_ctx_t * ctx, scpi_angle_t low, scpi_angle_t high, scpi_angle_t def, int32_t * value)
+{
+    const scpi_angle_t unit = SCPI_ANGLE_SCALE / SCPI_SWEEP_ANGLE_SCALE;
+    scpi_param_t param;
+    scpi_angle_t angle;
+    int rc = scpi_parse_numeric(ctx->param, ctx->param_len, &param);
+
+    if (rc)
+        return rc;
+
+    switch (param.kind)
+    {
+    case k_scpi_num_none:
+        return k_scpi_err_missing_parameter;
+    case k_scpi_num_min:
+        angle = low;
+        break;
+    case k_scpi_num_max:
+        angle = high;
+        break;
+    case k_scpi_num_def:
+        angle = def;
+        break;
+    default:
+        angle = param.value;
+        break;
+    }
+
+    angle = ((angle < 0) ? angle - unit / 2 : angle + unit / 2) / unit * unit;
+
+    if (angle < low || angle > high)
+        return k_scpi_err_out_of_range;
+
+    *value = angle / unit;
+
+    return 0;
+}
+
+// SENSe:SWEep:STARt / STOP <angle> - user is the config_t field
+static int scpi_on_sweep_end(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    int32_t value;
+    int rc = scpi_param_sweep_angle(ctx, SCPI_ANGLE_LIMIT_LOW_DEF, SCPI_ANGLE_LIMIT_HIGH_DEF, 0, &value);
+
+    if (!rc)
+        *(int16_t *)user = (int16_t)value;
+
+    return rc;
+}
+
+// SENSe:SWEep:STEP <angle>
+static int scpi_on_sweep_step(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    int32_t value;
+    int rc = scpi_param_sweep_angle(ctx, SCPI_ANGLE_SCALE / SCPI_SWEEP_ANGLE_SCALE, SCPI_ANGLE_LIMIT_HIGH_DEF, SCPI_ANGLE_DEG(1), &value);
+
+    if (!rc)
+        scpi_sweep_config()->step_angle = (uint16_t)value;
+
+    return rc;
+}
+
+// SENSe:SWEep:AXIS <n>
+static int scpi_on_sweep_axis(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    uint32_t value;
+    int rc = scpi_param_reg(ctx, SCPI_NUM_AXES - 1, &value);
+
+    if (!rc)
+        scpi_sweep_config()->active_axis = (axis_t)value;
+
+    return rc;
+}
+
+// SENSe:SWEep:RATE <rad/s> - speed of a continuous sweep, resolved to 1/1000 rad/s and
+// kept in angle units per second; 0 (MIN, DEF) leaves it to the drive, MAX is 255 rad/s
+static int scpi_on_sweep_rate(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_param_t param;
+    int64_t rate;
+    int rc = scpi_parse_numeric(ctx->param, ctx->param_len, &param);
+
+    if (rc)
+        return rc;
+
+    switch (param.kind)
+    {
+    case k_scpi_num_none:
+        return k_scpi_err_missing_parameter;
+    case k_scpi_num_max:
+        rate = SCPI_SWEEP_RATE_MAX;
+        break;
+    case k_scpi_num_min:
+    case k_scpi_num_def:
+        rate = 0;
+        break;
+    default:
+        //param.value is in 1/SCPI_ANGLE_SCALE rad/s
+        rate = (int64_t)param.value * SCPI_SWEEP_ANGLE_PER_RAD / SCPI_ANGLE_SCALE;
+        break;
+    }
+
+    if (rate < 0 || rate > SCPI_SWEEP_RATE_MAX)
+        return k_scpi_err_out_of_range;
+
+    scpi_sweep_config()->sweep_rate = (uint32_t)rate;
+
+    return 0;
+}
+
+// SENSe:SWEep:LOG? - <count>[,<point>,<angle>,<us>]... takes up to
+// SCPI_SWEEP_LOG_REPLY of the oldest marks; query again until count is 0
+static int scpi_on_sweep_log(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_sweep_mark_t   mark[SCPI_SWEEP_LOG_REPLY];
+    char                reply[4 + SCPI_SWEEP_LOG_REPLY * 36];
+    char *              end;
+    uint32_t            n;
+    uint32_t            i;
+
+    for (n = 0; n < SCPI_SWEEP_LOG_REPLY && scpi_sweep_log_pop(&mark[n]); n++)
+        ;
+
+    end = scpi_fmt_uint(reply, n);
+
+    for (i = 0; i < n; i++)
+    {
+        *end++ = ',';
+        end = scpi_fmt_uint(end, mark[i].point);
+        *end++ = ',';
+        end = scpi_fmt_angle(end, mark[i].angle);
+        *end++ = ',';
+        end = scpi_fmt_uint(end, mark[i].time_us);
+    }
+
+    scpi_reply_str(ctx, reply);
+
+    return 0;
+}
+
+// SENSe:SWEep:HOLD <bool> - hold the axis still while the VNA measures
+static int scpi_on_sweep_hold(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    if (!ctx->param_len)
+        return k_scpi_err_missing_parameter;
+
+    return scpi_parse_bool(ctx->param, ctx->param_len, &scpi_sweep_config()->hold_measure);
+}
+
+// *********************************************************************
+/// Handler table, open addressed on the event id
+///
+/// An event keeps its slot once bound (fn is cleared to unbind) so probe
+/// chains never break.
+///
+typedef struct
+{
+    uint32_t                            evt;            //k_scpi_root_none marks a free slot
+    scpi_handler_fn                     fn;
+    void *                              user;
+}   scpi_handler_entry_t;
+
+static scpi_handler_entry_t s_handlers[SCPI_HANDLER_TABLE_SZ];
+
+// *********************************************************************
+/// Finds the slot bound to evt, or the free slot it would take
+///
+/// @returns            - the slot, 0 when the table is full
+///
+static scpi_handler_entry_t * scpi_handler_slot(uint32_t evt)
+{
+    uint32_t slot = (evt * 2654435761u) >> (32u - SCPI_HANDLER_TABLE_BITS);
+    uint32_t n;
+
+    for (n = 0; n < SCPI_HANDLER_TABLE_SZ; n++)
+    {
+        scpi_handler_entry_t * e = &s_handlers[slot];
+
+        if (evt == e->evt || k_scpi_root_none == e->evt)
+            return e;
+
+        slot = (slot + 1) & (SCPI_HANDLER_TABLE_SZ - 1);
+    }
+
+    return 0;
+}
+
+// *********************************************************************
+/// Handler bound to evt, 0 when there is none
+///
+static const scpi_handler_entry_t * scpi_handler_lookup(uint32_t evt)
+{
+    const scpi_handler_entry_t * e;
+
+    if (!s_ready)
+        scpi_init();
+
+    e = scpi_handler_slot(evt);
+
+    return (e && e->fn && evt == e->evt) ? e : 0;
+}
+
+// *********************************************************************
+//
+//
+int scpi_register_handler(uint32_t evt, scpi_handler_fn fn, void * user)
+{
+    scpi_handler_entry_t * e;
+
+    if (!s_ready)
+        scpi_init();
+
+    e = scpi_handler_slot(evt);
+
+    if (!e || k_scpi_root_none == evt)
+        return -1;
+
+    e->evt  = evt;
+    e->fn   = fn;
+    e->user = user;
+
+    return 0;
+}
+
+// *********************************************************************
+//
+//
+void scpi_handlers_reset(void)
+{
+    int i;
+
+    s_ready = TRUE;
+    memset(s_handlers, 0, sizeof(s_handlers));
+
+    scpi_register_handler(k_scpi_root_q_idn,  scpi_on_idn,       0);
+    scpi_register_handler(k_scpi_root_opc,    scpi_on_opc,       0);
+    scpi_register_handler(k_scpi_root_q_opc,  scpi_on_opc_query, 0);
+    scpi_register_handler(k_scpi_root_wai,    scpi_on_wai,       0);
+    scpi_register_handler(k_scpi_root_cls,    scpi_on_cls,       0);
+    scpi_register_handler(k_scpi_root_ese,    scpi_on_ese,       0);
+    scpi_register_handler(k_scpi_root_q_ese,  scpi_on_ese_query, 0);
+    scpi_register_handler(k_scpi_root_q_esr,  scpi_on_esr_query, 0);
+    scpi_register_handler(k_scpi_root_sre,    scpi_on_sre,       0);
+    scpi_register_handler(k_scpi_root_q_sre,  scpi_on_sre_query, 0);
+    scpi_register_handler(k_scpi_root_q_stb,  scpi_on_stb_query, 0);
+    scpi_register_handler(k_scpi_root_rst,    scpi_on_rst,       0);
+
+    scpi_register_handler(k_scpi_system_q_error,        scpi_on_error_next,  0);
+    scpi_register_handler(k_scpi_system_error_q_next,   scpi_on_error_next,  0);
+    scpi_register_handler(k_scpi_system_error_q_count,  scpi_on_error_count, 0);
+    scpi_register_handler(k_scpi_system_srq,            scpi_on_srq,         0);
+    scpi_register_handler(k_scpi_system_q_srq,          scpi_on_srq_query,   0);
+
+    scpi_register_handler(k_scpi_status_q_operation,            scpi_on_status_event,        &s_status[k_scpi_reg_operation]);
+    scpi_register_handler(k_scpi_status_operation_q_event,      scpi_on_status_event,        &s_status[k_scpi_reg_operation]);
+    scpi_register_handler(k_scpi_status_operation_q_condition,  scpi_on_status_condition,    &s_status[k_scpi_reg_operation]);
+    scpi_register_handler(k_scpi_status_operation_enable,       scpi_on_status_enable,       &s_status[k_scpi_reg_operation]);
+    scpi_register_handler(k_scpi_status_operation_q_enable,     scpi_on_status_enable_query, &s_status[k_scpi_reg_operation]);
+    scpi_register_handler(k_scpi_status_q_questionable,         scpi_on_status_event,        &s_status[k_scpi_reg_questionable]);
+    scpi_register_handler(k_scpi_status_questionable_q_event,   scpi_on_status_event,        &s_status[k_scpi_reg_questionable]);
+    scpi_register_handler(k_scpi_status_questionable_q_condition, scpi_on_status_condition,  &s_status[k_scpi_reg_questionable]);
+    scpi_register_handler(k_scpi_status_questionable_enable,    scpi_on_status_enable,       &s_status[k_scpi_reg_questionable]);
+    scpi_register_handler(k_scpi_status_questionable_q_enable,  scpi_on_status_enable_query, &s_status[k_scpi_reg_questionable]);
+    scpi_register_handler(k_scpi_status_preset,                 scpi_on_status_preset,       0);
+
+    scpi_register_handler(k_scpi_initiate_immediate,    scpi_on_initiate,   0);
+    scpi_register_handler(k_scpi_root_abort,            scpi_on_abort,      0);
+    scpi_register_handler(k_scpi_sense_sweep_start,     scpi_on_sweep_end,  &scpi_sweep_config()->start_angle);
+    scpi_register_handler(k_scpi_sense_sweep_stop,      scpi_on_sweep_end,  &scpi_sweep_config()->stop_angle);
+    scpi_register_handler(k_scpi_sense_sweep_step,      scpi_on_sweep_step, 0);
+    scpi_register_handler(k_scpi_sense_sweep_axis,      scpi_on_sweep_axis, 0);
+    scpi_register_handler(k_scpi_sense_sweep_hold,      scpi_on_sweep_hold, 0);
+    scpi_register_handler(k_scpi_sense_sweep_rate,      scpi_on_sweep_rate, 0);
+    scpi_register_handler(k_scpi_sense_sweep_q_log,     scpi_on_sweep_log,  0);
+
+    for (i = 0; i < SCPI_NUM_AXES; i++)
+    {
+        scpi_register_handler(SCPI_AXIS_EVENT(k_scpi_input_position_a0_immediate,   i), scpi_on_axis_target,      &s_axes[i]);
+        scpi_register_handler(SCPI_AXIS_EVENT(k_scpi_input_position_a0_limit_low,   i), scpi_on_axis_limit_low,   &s_axes[i]);
+        scpi_register_handler(SCPI_AXIS_EVENT(k_scpi_input_position_a0_limit_high,  i), scpi_on_axis_limit_high,  &s_axes[i]);
+        scpi_register_handler(SCPI_AXIS_EVENT(k_scpi_input_position_a0_limit_state, i), scpi_on_axis_limit_state, &s_axes[i]);
+    }
+}
+
+// *********************************************************************
+//
+//
+void scpi_init(void)
+{
+    scpi_handlers_reset();
+    scpi_axis_reset();
+}
+
+// *********************************************************************
+//
+//
+int scpi_query_event_handler(scpi_ctx_t * ctx, uint32_t evt)
+{
+    const scpi_handler_entry_t * e = scpi_handler_lookup(evt);
+
+    return e ? e->fn(ctx, evt, e->user) : 0;
+}
+
+int                                     scpi_write_event_handler(scpi_ctx_t * ctx, uint32_t evt)
+{
+    const scpi_handler_entry_t * e = scpi_handler_lookup(evt);
+    int rc = 0;
+
+    if (e)
+        rc = e->fn(ctx, evt, e->user);
+
+    if (0 > rc)
+        return rc;
+
+    scpi_reply_str(ctx, STR_REPLY_OK2);
+
+    return 0;
+}
+
+int                                     scpi_error_event_handler(scpi_ctx_t * ctx)
+{
+    scpi_reply_str(ctx, STR_REPLY_ERR);
+
+    return 0;
+}
+
+int                                     scpi_error_partial_event_handler(scpi_ctx_t * ctx)
+{
+    scpi_reply_str(ctx, STR_REPLY_ERR_PARTIAL);
+
+    return 0;
+}
+
+// *********************************************************************
+//
+//
+int scpi_input(const uint8_t * p_buf, size_t len, uint8_t ** p_reply, size_t * p_reply_len, uint32_t * event)
+{
+    return scpi_input_ctx(&s_ctx, p_buf, len, p_reply, p_reply_len, event);
+}
+
+// *********************************************************************
+/// Finds the end of the program message unit starting at msg[start]
+///
+/// Units are separated by ';' outside of quoted strings.
+///
+static size_t scpi_unit_end(const char * msg, size_t start, size_t len)
+{
+    char quote = 0;
+    size_t pos;
+
+    for (pos = start; pos < len; pos++)
+    {
+        if (quote)
+        {
+            if (quote == msg[pos])
+                quote = 0;
+        }
+        else if ('"' == msg[pos] || '\'' == msg[pos])
+        {
+            quote = msg[pos];
+        }
+        else if (';' == msg[pos])
+        {
+            break;
+        }
+    }
+
+    return pos;
+}
+
+#if SCPI_HDR_CACHE_SZ
+
+// *********************************************************************
+/// Hashes the header at the start of a unit, folded to lower case
+///
+/// @param unit*[in]    - unit text, white space already skipped
+/// @param len[in]      - length of the unit
+/// @param start[in]    - menu state the header is resolved from
+/// @param hdr_len*[o]  - length of the header
+///
+/// @returns            - FNV-1a hash of start and the folded header
+///
+static uint32_t scpi_hdr_hash(const char * unit, size_t len, uint32_t start, size_t * hdr_len)
+{
+    uint32_t hash = 2166136261u ^ start;
+    size_t   i;
+    char     c;
+
+    for (i = 0; i < len; i++)
+    {
+        c = unit[i];
+
+        if (' ' == c || '\t' == c || '\0' == c || '\r' == c || '\n' == c)
+            break;
+
+        if (c >= 'A' && c <= 'Z')
+            c |= 0x20;
+
+        hash = (hash ^ (uint8_t)c) * 16777619u;
+    }
+
+    *hdr_len = i;
+
+    return hash;
+}
+
+//two way set associative: a pair of hot headers sharing a set do not evict each other.
+//The low bits of an FNV product only see the low bits of its input, so fold the high half in
+#define SCPI_HDR_CACHE_WAYS             2
+#define SCPI_HDR_CACHE_SET(hash)        ((((hash) ^ ((hash) >> 16)) & (SCPI_HDR_CACHE_SZ / SCPI_HDR_CACHE_WAYS - 1)) * SCPI_HDR_CACHE_WAYS)
+
+// *********************************************************************
+/// Looks up a header in the context's cache
+///
+/// @returns            - the entry on a hit, 0 otherwise
+///
+static const scpi_hdr_cache_entry_t * scpi_hdr_cache_find(const scpi_ctx_t * ctx, const char * unit, size_t hdr_len, uint32_t start, uint32_t hash)
+{
+    const scpi_hdr_cache_entry_t * e = &ctx->cache.entry[SCPI_HDR_CACHE_SET(hash)];
+    int way;
+
+    for (way = 0; way < SCPI_HDR_CACHE_WAYS; way++, e++)
+    {
+        if (   e->len   == hdr_len
+            && e->hash  == hash
+            && e->start == start
+            && scpi_str_eq_nocase(unit, e->hdr, hdr_len))
+        {
+            return e;
+        }
+    }
+
+    return 0;
+}
+
+// *********************************************************************
+/// Records a resolved header as the newest of its set, dropping the oldest
+///
+static void scpi_hdr_cache_store(scpi_ctx_t * ctx, const char * unit, size_t hdr_len, uint32_t start, uint32_t hash,
+                                 int rc, uint32_t event, uint32_t parent)
+{
+    scpi_hdr_cache_entry_t * e = &ctx->cache.entry[SCPI_HDR_CACHE_SET(hash)];
+    size_t i;
+    char   c;
+
+    if (!hdr_len || SCPI_HDR_CACHE_KEY_SZ < hdr_len)
+        return;
+
+    for (i = SCPI_HDR_CACHE_WAYS - 1; i > 0; i--)
+        e[i] = e[i - 1];
+
+    for (i = 0; i < hdr_len; i++)
+    {
+        c = unit[i];
+        e->hdr[i] = (c >= 'A' && c <= 'Z') ? (char)(c | 0x20) : c;
+    }
+
+    e->hash     = hash;
+    e->start    = start;
+    e->event    = event;
+    e->parent   = parent;
+    e->rc       = (uint8_t)rc;
+    e->len      = (uint8_t)hdr_len;
+}
+
+#endif /* SCPI_HDR_CACHE_SZ */
+
+// *********************************************************************
+/// Parses and executes a single program message unit
+///
+/// Relative headers start from ctx->path, absolute headers (leading ':')
+/// from the root.  Common commands ('*') never change the path.
+///
+/// Resolved headers are remembered per context; a repeated header costs a
+/// hash and a compare instead of the level by level menu walk.  Without
+/// the cache (SCPI_HDR_CACHE_SZ 0) every header is walked.
+///
+static int scpi_input_unit(scpi_ctx_t * ctx, const char * unit, size_t len, uint32_t * event)
+{
+    const scpi_hdr_cache_entry_t * hit = 0;
+    scpi_header_t     hdr;
+    uint32_t          start = k_scpi_root_none;
+    uint32_t          last_state = k_scpi_root_none;
+    uint32_t          prev_state = k_scpi_root_none;
+#if SCPI_HDR_CACHE_SZ
+    uint32_t          hash;
+    size_t            hdr_len;
+#endif
+    int               common = FALSE;
+    size_t            i;
+    int               rc;
+    int               err;
+
+    //white space may follow the ';'
+    while (len && (' ' == *unit || '\t' == *unit))
+    {
+        unit++;
+        len--;
+    }
+
+    //common commands may carry a leading ':' too
+    common = (   (len > 0 && '*' == unit[0])
+              || (len > 1 && ':' == unit[0] && '*' == unit[1])) ? TRUE : FALSE;
+
+    if (len && ':' != unit[0] && !common)
+    {
+        start = ctx->path;
+    }
+
+#if SCPI_HDR_CACHE_SZ
+    hash = scpi_hdr_hash(unit, len, start, &hdr_len);
+    hit  = scpi_hdr_cache_find(ctx, unit, hdr_len, start, hash);
+#endif
+
+    if (hit)
+    {
+        ctx->cache.hits++;
+
+#if SCPI_HDR_CACHE_SZ
+        scpi_param_span(unit, hdr_len, len, &hdr);
+#endif
+
+        rc          = hit->rc;
+        last_state  = hit->event;
+        prev_state  = hit->parent;
+    }
+    else
+    {
+        ctx->cache.misses++;
+
+        //split the header into its menu levels once, up front
+        rc = scpi_tokenize(unit, len, &hdr);
+        if (0 > rc || !hdr.count)
+        {
+            scpi_error_push(ctx, k_scpi_err_syntax);
+            scpi_error_event_handler(ctx);
+            *event = last_state;
+            return -1;
+        }
+
+        last_state = start;
+
+        // dive into the sub-menus until the final command is resolved
+        // 2   - indicates finished processing, with a command type
+        // 1   - indicates finished processing, with a query type
+        // 0   - continue down submenus
+        // < 0 - error
+        rc = 0;
+
+        for (i = 0; i < hdr.count && !rc; i++)
+        {
+            prev_state = last_state;
+            rc = scpi_menu_sm(&last_state, unit + hdr.token[i].offset, hdr.token[i].len);
+
+#ifdef SCPI_DBG
+            printf("scpi_menu_sm(%d) rc:%d last_state:0x%x\n", (int)i, rc, last_state);
+#endif
+        }
+
+        if (0 < rc && i < hdr.count)
+        {
+            rc = -4;    //trailing menu levels after a complete command
+        }
+
+#if SCPI_HDR_CACHE_SZ
+        if (0 < rc)
+        {
+            scpi_hdr_cache_store(ctx, unit, hdr_len, start, hash, rc, last_state, prev_state);
+        }
+#endif
+    }
+
+    ctx->param      = unit + hdr.param_offset;
+    ctx->param_len  = hdr.param_len;
+
+    switch (rc)
+    {
+    case 0:
+        //ran out of menu levels before reaching a command
+        scpi_error_push(ctx, k_scpi_err_undefined_header);
+        scpi_error_partial_event_handler(ctx);
+        rc = -3;
+        break;
+    case 1:
+    case 2:
+        err = (1 == rc) ? scpi_query_event_handler(ctx, last_state) : scpi_write_event_handler(ctx, last_state);
+        if (0 > err)
+        {
+            //header was understood but its handler rejected it
+            scpi_error_push(ctx, (int16_t)err);
+            scpi_error_event_handler(ctx);
+            rc = -5;
+        }
+        break;
+    default:
+        scpi_error_push(ctx, k_scpi_err_undefined_header);
+        scpi_error_event_handler(ctx);
+        rc = -2;
+        break;
+    }
+
+    //relative headers that follow continue from the parent of the command
+    if (0 < rc && !common)
+    {
+        ctx->path = prev_state;
+    }
+
+    *event = last_state;
+
+    return rc;
+}
+
+// *********************************************************************
+/// Runs the units left in ctx->rest and completes the reply
+///
+/// Stops at the first unit in error, or after a unit that leaves the
+/// message waiting (*OPC?, *WAI) with the units that follow kept in
+/// ctx->rest.  rc is the result of the unit run last, 0 before the first.
+///
+static int scpi_input_run(scpi_ctx_t * ctx, int rc, uint8_t ** p_reply, size_t * p_reply_len, uint32_t * event)
+{
+    const char *      msg = ctx->rest;
+    size_t            msg_len = ctx->rest_len;
+    uint32_t          last_state = ctx->event;
+    size_t            start = 0;
+    size_t            end;
+
+    // execute each ';' separated unit in order, stopping at the first error;
+    // a message holds at least one unit, even when empty
+    while (0 == rc || (0 < rc && start < msg_len))
+    {
+        end   = scpi_unit_end(msg, start, msg_len);
+        rc    = scpi_input_unit(ctx, msg + start, end - start, &last_state);
+        start = end + 1;
+
+        if (0 < rc && SCPI_WAIT_NONE != ctx->wait)
+        {
+            ctx->rest       = msg + ((start < msg_len) ? start : msg_len);
+            ctx->rest_len   = (start < msg_len) ? msg_len - start : 0;
+            ctx->wait_rc    = rc;
+            ctx->event      = last_state;
+
+            *event          = last_state;
+            *p_reply        = ctx->reply;
+            *p_reply_len    = 0;
+
+            return SCPI_INPUT_WAIT;
+        }
+    }
+
+    ctx->rest       = 0;
+    ctx->rest_len   = 0;
+
+    memcpy(&ctx->reply[ctx->reply_len], SCPI_REPLY_EOL, sizeof(SCPI_REPLY_EOL));
+    ctx->reply_len += sizeof(SCPI_REPLY_EOL) - 1;
+
+    ctx->event      = last_state;
+
+    *event          = last_state;
+    *p_reply        = ctx->reply;
+    *p_reply_len    = ctx->reply_len;
+
+    return rc;
+}
+
+// *********************************************************************
+//
+//
+int scpi_input_ctx(scpi_ctx_t * ctx, const uint8_t * p_buf, size_t len, uint8_t ** p_reply, size_t * p_reply_len, uint32_t * event)
+{
+    const char *      msg = (const char *)p_buf;    //parsed in place, matching ignores case
+    size_t            msg_len = 0;
+
+    //only the first SCPI_RX_BFR_SZ characters are parsed
+    if (SCPI_RX_BFR_SZ < (len+1)) {
+        len = SCPI_RX_BFR_SZ;
+    }
+
+    //the program message ends at its terminator
+    while (msg_len < len && '\0' != msg[msg_len] && '\n' != msg[msg_len])
+        msg_len++;
+
+    //every program message starts at the root and builds one reply
+    ctx->path       = k_scpi_root_none;
+    ctx->event      = k_scpi_root_none;
+    ctx->reply_len  = 0;
+    ctx->reply[0]   = 0;
+    ctx->wait       = SCPI_WAIT_NONE;
+    ctx->rest       = msg;
+    ctx->rest_len   = msg_len;
+
+    scpi_opc_update(ctx);
+
+    return scpi_input_run(ctx, 0, p_reply, p_reply_len, event);
+}
+
+// *********************************************************************
+//
+//
+int scpi_input_blocked(const scpi_ctx_t * ctx)
+{
+    return (SCPI_WAIT_NONE != ctx->wait && !scpi_ops_done_since(ctx->wait_idle)) ? TRUE : FALSE;
+}
+
+// *********************************************************************
+//
+//
+int scpi_input_resume(scpi_ctx_t * ctx, uint8_t ** p_reply, size_t * p_reply_len, uint32_t * event)
+{
+    if (SCPI_WAIT_NONE == ctx->wait)
+    {
+        *event          = ctx->event;
+        *p_reply        = ctx->reply;
+        *p_reply_len    = ctx->reply_len;
+
+        return 0;
+    }
+
+    if (scpi_input_blocked(ctx))
+    {
+        *event          = ctx->event;
+        *p_reply        = ctx->reply;
+        *p_reply_len    = 0;
+
+        return SCPI_INPUT_WAIT;
+    }
+
+    if (SCPI_WAIT_OPC_Q == ctx->wait)
+    {
+        scpi_reply_str(ctx, STR_REPLY_OK1);
+    }
+
+    ctx->wait = SCPI_WAIT_NONE;
+
+    scpi_opc_update(ctx);
+
+    return scpi_input_run(ctx, ctx->wait_rc, p_reply, p_reply_len, event);
+}
+
+// **********************************************************************************
+// Menu state machine handlers
+//
+int scpi_menu_sm(uint32_t *state, const char * str, size_t str_len )
+{
+    uint32_t axis = SCPI_EVENT_AXIS(*state);
+    uint32_t node = SCPI_EVENT_NODE(*state);
+    uint32_t suffix;
+    int      query;
+    size_t   i;
+    size_t   end;
+
+    if (!str || !str_len || node >= k_scpi_node_count)
+        return -1;
+
+    if (k_scpi_root_none == node)
+    {
+        scpi_menu_root_t root_state = k_scpi_root_none;
+        int rc = scpi_menu_root_sm(&root_state, str, str_len);
+
+        if (0 <= rc)
+            *state = (uint32_t)root_state;
+
+        return rc;
+    }
+
+    query = ('?' == str[str_len - 1]);
+    if (query)
+        str_len--;
+
+    //children of a menu are contiguous; leaves have an empty range
+    i   = s_menu_first[s_nodes[node].menu];
+    end = s_menu_first[s_nodes[node].menu + 1];
+
+    for (; i < end; i++)
+    {
+        const scpi_node_t * child = &s_nodes[i];
+
+        if (query != (SCPI_NODE_QUERY == child->type))
+            continue;
+
+        if (child->flags & SCPI_NODE_SUFFIX)
+        {
+            if (   !scpi_match_suffix(str, str_len, (scpi_menu_string_t)child->keyword, &suffix)
+                || suffix >= SCPI_NUM_AXES )
+            {
+                continue;
+            }
+
+            axis = suffix;
+        }
+        else if (!scpi_is_menu_match(str, str_len, (scpi_menu_string_t)child->keyword))
+        {
+            continue;
+        }
+
+        *state = SCPI_AXIS_EVENT(i, axis);
+        return child->type;
+    }
+
+    return -2;  //failed to match a valid string
+}
+
+// *********************************************************************
+/// Folds a root token into the root hash key
+///
+/// Covers the length, the first three characters and the last character
+/// so every form in the root menu gets a unique key (e.g. *ESE / *ESR).
+/// Must match root_key() in tools/gen_root_hash.py.
+///
+inline static uint32_t scpi_root_key(const char * str, size_t len)
+{
+    return (  (uint32_t)(uint8_t)(str[0]       | 0x20)
+            | (uint32_t)(uint8_t)(str[1]       | 0x20) << 8
+            | (uint32_t)(uint8_t)(str[2]       | 0x20) << 16
+            | (uint32_t)(uint8_t)(str[len - 1] | 0x20) << 24) + (uint32_t)len;
+}
+
+int scpi_menu_root_sm(scpi_menu_root_t *state, const char * str, size_t str_len )
+{
+    if (!str || !str_len)
+        return -1;
+
+    int query = ('?' == str[str_len - 1]);
+
+    if (query)
+        str_len--;
+
+    //no root keyword is shorter than three characters
+    if (str_len < 3)
+        return -1;
+
+    //the hash leaves exactly one candidate whatever the size of the root menu,
+    //a single compare then accepts or rejects the token
+    uint32_t key    = scpi_root_key(str, str_len);
+    uint32_t bucket = (key * SCPI_ROOT_HASH_SEED1) >> (32u - SCPI_ROOT_HASH_BUCKET_BITS);
+    uint32_t slot   = (((key * SCPI_ROOT_HASH_SEED2) >> 16) + s_root_hash_disp[bucket]) % SCPI_ROOT_HASH_SZ;
+
+    const scpi_root_node_t * node = &s_root_hash[slot];
+
+    if (!scpi_is_menu_match(str, str_len, node->keyword))
+        return -1;
+
+    if (query)
+    {
+        if (k_scpi_root_none == node->query_state)
+            return -1;
+
+        *state = node->query_state;
+        return 1;
+    }
+
+    if (k_scpi_root_none == node->state)
+        return -1;
+
+    *state = node->state;
+    return node->rc;
 }
 
 
@@ -0,0 +1,190 @@
+/// @file scpi_framer.c
+///
+/// Streaming framer that turns a TCP byte stream into newline terminated
+/// SCPI program messages, independent of how the stream was segmented.
+///
+/// Author: Nathan Poppleton
+///
+/// Copyright: University of Utah, College of Engineering
+///
+
+#include "scpi_framer.h"
+
+#include "string.h"
+#include "stdint.h"
+
+
+// *********************************************************************
+//
+//
+void scpi_framer_init(scpi_framer_t * fr)
+{
+    fr->len      = 0;
+    fr->head     = 0;
+    fr->overflow = FALSE;
+}
+
+// *********************************************************************
+//
+//
+int scpi_framer_next(scpi_framer_t * fr, const uint8_t ** p_data, size_t * p_len,
+                     const char ** msg, size_t * msg_len)
+{
+    const char * data   = (const char *)*p_data;
+    size_t       remain = *p_len;
+    const char * eol;
+    size_t       seg_len;
+
+    while (remain)
+    {
+        eol = (const char *)memchr(data, '\n', remain);
+        seg_len = eol ? (size_t)(eol - data) : remain;
+
+        if (fr->overflow)
+        {
+            //drop the rest of an over-long message, report it once it ends
+            *p_data = (const uint8_t *)(data + seg_len + (eol ? 1 : 0));
+            *p_len  = remain - seg_len - (eol ? 1 : 0);
+
+            if (!eol)
+                return 0;
+
+            fr->overflow = FALSE;
+            return -1;
+        }
+
+        if (!eol)
+        {
+            //partial message, keep it for the next segment
+            if (fr->len + seg_len > SCPI_FRAMER_BFR_SZ)
+            {
+                fr->len      = 0;
+                fr->overflow = TRUE;
+                data   += seg_len;
+                remain -= seg_len;
+                continue;
+            }
+
+            memcpy(&fr->buf[fr->len], data, seg_len);
+            fr->len += seg_len;
+
+            *p_data = (const uint8_t *)(data + seg_len);
+            *p_len  = 0;
+            return 0;
+        }
+
+        *p_data = (const uint8_t *)(eol + 1);
+        *p_len  = remain - seg_len - 1;
+
+        if (   fr->len + seg_len > SCPI_FRAMER_BFR_SZ )
+        {
+            fr->len = 0;
+            return -1;
+        }
+        else if (!fr->len)
+        {
+            //whole message inside this segment, hand it out in place
+            *msg     = data;
+            *msg_len = seg_len;
+        }
+        else
+        {
+            memcpy(&fr->buf[fr->len], data, seg_len);
+            *msg     = fr->buf;
+            *msg_len = fr->len + seg_len;
+            fr->len  = 0;
+        }
+
+        if (*msg_len && '\r' == (*msg)[*msg_len - 1])
+            (*msg_len)--;
+
+        if (!*msg_len)
+        {
+            //blank line (a bare Enter from a terminal), nothing to run or answer
+            data    = eol + 1;
+            remain -= seg_len + 1;
+            continue;
+        }
+
+        return 1;
+    }
+
+    *p_data = (const uint8_t *)data;
+    *p_len  = 0;
+
+    return 0;
+}
+
+// *********************************************************************
+//
+//
+size_t scpi_framer_room(scpi_framer_t * fr, uint8_t ** dst)
+{
+    *dst = (uint8_t *)&fr->buf[fr->len];
+
+    return SCPI_FRAMER_BFR_SZ - fr->len;
+}
+
+// *********************************************************************
+//
+//
+void scpi_framer_fill(scpi_framer_t * fr, size_t len)
+{
+    fr->len += len;
+}
+
+// *********************************************************************
+//
+//
+int scpi_framer_pop(scpi_framer_t * fr, const char ** msg, size_t * msg_len)
+{
+    char *       data;
+    const char * eol;
+    size_t       seg_len;
+
+    while (fr->head < fr->len)
+    {
+        data = &fr->buf[fr->head];
+        eol  = (const char *)memchr(data, '\n', fr->len - fr->head);
+
+        if (!eol)
+        {
+            //a full buffer without an end can only be an over-long message; drop it
+            //until it ends, otherwise keep the partial one
+            if (fr->overflow || (!fr->head && SCPI_FRAMER_BFR_SZ == fr->len))
+            {
+                fr->overflow = TRUE;
+                fr->head     = fr->len;
+            }
+            break;
+        }
+
+        seg_len   = (size_t)(eol - data);
+        fr->head += seg_len + 1;
+
+        if (fr->overflow)
+        {
+            fr->overflow = FALSE;
+            return -1;
+        }
+
+        if (seg_len && '\r' == data[seg_len - 1])
+            seg_len--;
+
+        //blank line (a bare Enter from a terminal), nothing to run or answer
+        if (!seg_len)
+            continue;
+
+        *msg     = data;
+        *msg_len = seg_len;
+
+        return 1;
+    }
+
+    //every message is done; move the partial one to the front to make room
+    fr->len -= fr->head;
+    memmove(fr->buf, &fr->buf[fr->head], fr->len);
+    fr->head = 0;
+
+    return 0;
+}
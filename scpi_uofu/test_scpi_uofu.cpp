@@ -7,13 +7,28 @@
 
 #include <catch/catch.hpp>
 #include <scpi.h>
+#include <scpi_framer.h>
+#include <scpi_motion.h>
+#include <scpi_sweep.h>
+#include <hal_sim.h>
+#include <scpi_tree.hpp>
+#include <scpi_parser.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstring>
 #include <string.h>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
 
 #define SCPI_LOCAL
 
 #define TEST_SCPI(x)        rc = test_adapter(x, &reply, &reply_len, &event)
 #define REQUIRE_REPLY(x) REQUIRE(0 == strncmp(reinterpret_cast<char*>(reply), x, reply_len))
+#define TEST_CTX(c, x)      rc = scpi_input_ctx(&c, reinterpret_cast<const uint8_t*>(x), strlen(x), &reply, &reply_len, &event)
+#define REPLY_IS(x)         (0 == strcmp(reinterpret_cast<char*>(reply), x))
 
 using namespace std;
 
@@ -246,7 +261,6 @@ TEST_CASE("Menu :INPut:", "")
 
 }
 
-
 //  ****************************************************************************
 TEST_CASE("Menu :INITiate:", "")
 {
@@ -347,7 +361,6 @@ TEST_CASE("Menu :SENSe:", "")
 
 }
 
-
 //  ****************************************************************************
 TEST_CASE("Menu :INPut:POSition:", "")
 {
@@ -408,7 +421,6 @@ TEST_CASE("Menu :INPut:POSition:", "")
 
 }
 
-
 //  ****************************************************************************
 TEST_CASE("Menu :INPut:POSition:a0[|a1|a2|a3]", "")
 {
@@ -544,7 +556,6 @@ TEST_CASE("Menu :INPut:POSition:a0:ANGLe", "")
 
 }
 
-
 //  ****************************************************************************
 TEST_CASE("Menu :INPut:POSition:a0:ANGLe:IMMediate", "")
 {
@@ -554,11 +565,11 @@ TEST_CASE("Menu :INPut:POSition:a0:ANGLe:IMMediate", "")
     int rc;
     char * needle;
 
-    static const char * immediate       = ":INP:POS:a0:ANGLe:IMMediate";
-    static const char * imm             = ":INP:POS:a0:ANGL:IMM";
-    static const char * a1              = ":INP:POS:a1:ANGL:IMM";
-    static const char * a2              = ":INP:POS:a2:ANGL:IMM";
-    static const char * a3              = ":INP:POS:a3:ANGL:IMM";
+    static const char * immediate       = ":INP:POS:a0:ANGLe:IMMediate 0";
+    static const char * imm             = ":INP:POS:a0:ANGL:IMM 0";
+    static const char * a1              = ":INP:POS:a1:ANGL:IMM 0";
+    static const char * a2              = ":INP:POS:a2:ANGL:IMM 0";
+    static const char * a3              = ":INP:POS:a3:ANGL:IMM 0";
     static const char * a0_e1           = ":INP:POS:a0:ANGL:IM";
     static const char * a0_e2           = ":INP:POS:a0:ANGL:IM1";
     static const char * a0_e3           = ":INP:POS:a0:ANGL:IMMediate1";
@@ -620,5 +631,2367 @@ TEST_CASE("Menu :INPut:POSition:a0:ANGLe:IMMediate", "")
 
 }
 
+//  ****************************************************************************
+TEST_CASE("Menu :INPut:POSition:a0:ANGLe:LIMit / DIRection", "")
+{
+    uint8_t * reply;
+    uint32_t event;
+    size_t reply_len;
+    int rc;
+
+    SECTION("LIMit:LOW / HIGH / STATe - Success")
+    {
+        TEST_SCPI(":INP:POS:a0:ANGL:LIM:LOW DEF");
+        REQUIRE(2 == rc);
+        REQUIRE_REPLY("OK_CMD");
+        REQUIRE(k_scpi_input_position_a0_limit_low == event);
+
+        TEST_SCPI(":INPut:POSition:a2:ANGLe:LIMit:HIGH DEF");
+        REQUIRE(2 == rc);
+        REQUIRE(k_scpi_input_position_a2_limit_high == event);
+
+        TEST_SCPI(":INP:POS:a3:ANGL:LIM:STAT ON");
+        REQUIRE(2 == rc);
+        REQUIRE(k_scpi_input_position_a3_limit_state == event);
+
+        TEST_SCPI(":INP:POS:a1:ANGL:DIR");
+        REQUIRE(2 == rc);
+        REQUIRE(k_scpi_input_position_a1_dir == event);
+    }
+
+    SECTION("Failures")
+    {
+        TEST_SCPI(":INP:POS:a0:ANGL:LIM");
+        REQUIRE(0 > rc);
+        REQUIRE_REPLY("ERROR_PARTIAL");
+        REQUIRE(k_scpi_input_position_a0_limit == event);
+
+        TEST_SCPI(":INP:POS:a0:ANGL:LIM:LOWER");
+        REQUIRE(0 > rc);
+        REQUIRE_REPLY("ERROR");
+        REQUIRE(k_scpi_input_position_a0_limit == event);
+
+        TEST_SCPI(":INP:POS:a0:ANGL:IMM:LOW");
+        REQUIRE(0 > rc);
+        REQUIRE_REPLY("ERROR");
+    }
+}
+
+//  ****************************************************************************
+TEST_CASE("Numeric parameters", "")
+{
+    uint8_t * reply;
+    uint32_t event;
+    size_t reply_len;
+    int rc;
+    scpi_angle_t angle;
+    scpi_param_t param;
+
+    #define NRF(x)  scpi_parse_nrf(x, strlen(x), &angle)
+
+    scpi_axis_reset();
+
+    SECTION("<NRf> to fixed point")
+    {
+        REQUIRE(0 == NRF("12.5"));          REQUIRE(12500 == angle);
+        REQUIRE(0 == NRF("-9.0E1"));        REQUIRE(-90000 == angle);
+        REQUIRE(0 == NRF("+.25"));          REQUIRE(250 == angle);
+        REQUIRE(0 == NRF("7."));            REQUIRE(7000 == angle);
+        REQUIRE(0 == NRF("1e-3"));          REQUIRE(1 == angle);
+        REQUIRE(0 == NRF("0.0005"));        REQUIRE(1 == angle);
+        REQUIRE(0 == NRF("-0.0004"));       REQUIRE(0 == angle);
+        REQUIRE(0 == NRF("0.1234567"));     REQUIRE(123 == angle);
+        REQUIRE(0 == NRF("3600E-1"));       REQUIRE(360000 == angle);
+        REQUIRE(0 == NRF("1e-40"));         REQUIRE(0 == angle);
+        REQUIRE(0 == NRF("000000000000000000000012"));  REQUIRE(12000 == angle);
+        REQUIRE(0 == NRF("2147483.647"));   REQUIRE(2147483647 == angle);
+    }
+
+    SECTION("<NRf> errors")
+    {
+        REQUIRE(k_scpi_err_numeric_data == NRF(""));
+        REQUIRE(k_scpi_err_numeric_data == NRF("-"));
+        REQUIRE(k_scpi_err_numeric_data == NRF("."));
+        REQUIRE(k_scpi_err_numeric_data == NRF("1e"));
+        REQUIRE(k_scpi_err_numeric_data == NRF("1e+"));
+        REQUIRE(k_scpi_err_invalid_char_in_number == NRF("12x"));
+        REQUIRE(k_scpi_err_invalid_char_in_number == NRF("1.2.3"));
+        REQUIRE(k_scpi_err_out_of_range == NRF("2147483.648"));
+        REQUIRE(k_scpi_err_out_of_range == NRF("1e30"));
+        REQUIRE(k_scpi_err_out_of_range == NRF("123456789012345678901234567890"));
+    }
+
+    SECTION("MIN / MAX / DEF keywords")
+    {
+        REQUIRE(0 == scpi_parse_numeric("MIN", 3, &param));
+        REQUIRE(k_scpi_num_min == param.kind);
+        REQUIRE(0 == scpi_parse_numeric("maximum", 7, &param));
+        REQUIRE(k_scpi_num_max == param.kind);
+        REQUIRE(0 == scpi_parse_numeric("Def", 3, &param));
+        REQUIRE(k_scpi_num_def == param.kind);
+        REQUIRE(0 == scpi_parse_numeric("", 0, &param));
+        REQUIRE(k_scpi_num_none == param.kind);
+    }
+
+    SECTION("Values reach the axis settings")
+    {
+        TEST_SCPI(":INP:POS:A1:ANGL:LIM:LOW -90;HIGH 90.5;:INP:POS:A1:ANGL:IMM 12.5");
+        REQUIRE(2 == rc);
+        REQUIRE(SCPI_ANGLE_DEG(-90) == scpi_axis_get(1)->limit_low);
+        REQUIRE(90500 == scpi_axis_get(1)->limit_high);
+        REQUIRE(12500 == scpi_axis_get(1)->target);
+        REQUIRE(0 == scpi_axis_get(0)->target);
+
+        TEST_SCPI(":INP:POS:A1:ANGL:IMM MAX");
+        REQUIRE(2 == rc);
+        REQUIRE(90500 == scpi_axis_get(1)->target);
+
+        TEST_SCPI(":INP:POS:A1:ANGL:LIM:STAT OFF");
+        REQUIRE(2 == rc);
+        REQUIRE(!scpi_axis_get(1)->limit_enabled);
+
+        TEST_SCPI("*RST");
+        REQUIRE(SCPI_ANGLE_LIMIT_HIGH_DEF == scpi_axis_get(1)->limit_high);
+        REQUIRE(scpi_axis_get(1)->limit_enabled);
+    }
+
+    SECTION("Range and data errors are queued")
+    {
+        static scpi_ctx_t ctx;
+        static const char * cmd = ":INP:POS:A2:ANGL:LIM:HIGH 45;:INP:POS:A2:ANGL:IMM 46";
+        static const char * bad = ":INP:POS:A2:ANGL:IMM 4x";
+
+        scpi_ctx_init(&ctx);
+
+        rc = scpi_input_ctx(&ctx, reinterpret_cast<const uint8_t*>(cmd), strlen(cmd), &reply, &reply_len, &event);
+        REQUIRE(0 > rc);
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "OK_CMD;ERROR"));
+        REQUIRE(k_scpi_input_position_a2_immediate == event);
+        REQUIRE(0 == scpi_axis_get(2)->target);
+
+        rc = scpi_input_ctx(&ctx, reinterpret_cast<const uint8_t*>(bad), strlen(bad), &reply, &reply_len, &event);
+        REQUIRE(0 > rc);
+
+        REQUIRE(k_scpi_err_out_of_range == scpi_error_pop(&ctx));
+        REQUIRE(k_scpi_err_invalid_char_in_number == scpi_error_pop(&ctx));
+
+        TEST_SCPI(":INP:POS:A2:ANGL:LIM:LOW 50");
+        REQUIRE(0 > rc);
+        TEST_SCPI(":INP:POS:A2:ANGL:LIM:STAT maybe");
+        REQUIRE(0 > rc);
+    }
+
+    SECTION("A missing value is an error, not a no-op")
+    {
+        static scpi_ctx_t ctx;
+        static const char * imm   = ":INP:POS:A2:ANGL:IMM";
+        static const char * state = ":INP:POS:A2:ANGL:LIM:STAT";
+        static const char * low   = ":INP:POS:A2:ANGL:LIM:LOW";
+        static const char * high  = ":INP:POS:A2:ANGL:LIM:HIGH";
+
+        scpi_ctx_init(&ctx);
+
+        rc = scpi_input_ctx(&ctx, reinterpret_cast<const uint8_t*>(imm), strlen(imm), &reply, &reply_len, &event);
+        REQUIRE(0 > rc);
+        REQUIRE_REPLY("ERROR");
+        REQUIRE(k_scpi_err_missing_parameter == scpi_error_pop(&ctx));
+        REQUIRE(0 == scpi_axis_get(2)->target);
+
+        rc = scpi_input_ctx(&ctx, reinterpret_cast<const uint8_t*>(state), strlen(state), &reply, &reply_len, &event);
+        REQUIRE(0 > rc);
+        REQUIRE_REPLY("ERROR");
+        REQUIRE(k_scpi_err_missing_parameter == scpi_error_pop(&ctx));
+        REQUIRE(scpi_axis_get(2)->limit_enabled);
+
+        rc = scpi_input_ctx(&ctx, reinterpret_cast<const uint8_t*>(low), strlen(low), &reply, &reply_len, &event);
+        REQUIRE(0 > rc);
+        REQUIRE_REPLY("ERROR");
+        REQUIRE(k_scpi_err_missing_parameter == scpi_error_pop(&ctx));
+        REQUIRE(SCPI_ANGLE_LIMIT_LOW_DEF == scpi_axis_get(2)->limit_low);
+
+        rc = scpi_input_ctx(&ctx, reinterpret_cast<const uint8_t*>(high), strlen(high), &reply, &reply_len, &event);
+        REQUIRE(0 > rc);
+        REQUIRE_REPLY("ERROR");
+        REQUIRE(k_scpi_err_missing_parameter == scpi_error_pop(&ctx));
+        REQUIRE(SCPI_ANGLE_LIMIT_HIGH_DEF == scpi_axis_get(2)->limit_high);
+    }
+
+    #undef NRF
+    scpi_axis_reset();
+}
+
+//  ****************************************************************************
+TEST_CASE("Keyword table", "")
+{
+    static const scpi_menu_string_t expect[] = { k_scpi_str_low, k_scpi_str_high, k_scpi_str_state };
+
+    SECTION("Short / long forms and lengths")
+    {
+        REQUIRE(0 == strcmp("pos", scpi_str_short(k_scpi_str_position)));
+        REQUIRE(0 == strcmp("position", scpi_str_long(k_scpi_str_position)));
+        REQUIRE(3 == scpi_str_len_short(k_scpi_str_position));
+        REQUIRE(8 == scpi_str_len_long(k_scpi_str_position));
+        REQUIRE(0 == scpi_str_short(k_scpi_str_unknown));
+        REQUIRE(0 == scpi_str_long(k_scpi_str_count));
+        REQUIRE(0 == scpi_str_len_long(k_scpi_str_count));
+    }
+
+    SECTION("Short form is a prefix of the long form for every keyword")
+    {
+        for (int i = 1; i < k_scpi_str_count; i++)
+        {
+            scpi_menu_string_t item = static_cast<scpi_menu_string_t>(i);
+
+            REQUIRE(strlen(scpi_str_short(item)) == scpi_str_len_short(item));
+            REQUIRE(strlen(scpi_str_long(item)) == scpi_str_len_long(item));
+            REQUIRE(0 == strncmp(scpi_str_short(item), scpi_str_long(item), scpi_str_len_short(item)));
+        }
+    }
+
+    SECTION("Match against a candidate list")
+    {
+        REQUIRE(k_scpi_str_high == scpi_match_menu("high", 4, expect, 3));
+        REQUIRE(k_scpi_str_state == scpi_match_menu("stat", 4, expect, 3));
+        REQUIRE(k_scpi_str_state == scpi_match_menu("state", 5, expect, 3));
+        REQUIRE(k_scpi_str_unknown == scpi_match_menu("sta", 3, expect, 3));
+        REQUIRE(k_scpi_str_unknown == scpi_match_menu("statx", 5, expect, 3));
+        REQUIRE(k_scpi_str_unknown == scpi_match_menu("", 0, expect, 3));
+    }
+}
+
+//  ****************************************************************************
+TEST_CASE("Axis suffix", "")
+{
+    uint8_t * reply;
+    uint32_t event;
+    size_t reply_len;
+    int rc;
+    uint32_t suffix;
+
+    scpi_axis_reset();
+
+    SECTION("Suffix matcher")
+    {
+        REQUIRE(scpi_match_suffix("A7", 2, k_scpi_str_axis, &suffix));
+        REQUIRE(7 == suffix);
+        REQUIRE(scpi_match_suffix("a12", 3, k_scpi_str_axis, &suffix));
+        REQUIRE(12 == suffix);
+        REQUIRE(!scpi_match_suffix("a", 1, k_scpi_str_axis, &suffix));
+        REQUIRE(!scpi_match_suffix("a05", 3, k_scpi_str_axis, &suffix));
+        REQUIRE(!scpi_match_suffix("a123", 4, k_scpi_str_axis, &suffix));
+        REQUIRE(!scpi_match_suffix("b1", 2, k_scpi_str_axis, &suffix));
+    }
+
+    SECTION("Every axis resolves through the same nodes")
+    {
+        char cmd[64];
+
+        for (int axis = 0; axis < SCPI_NUM_AXES; axis++)
+        {
+            snprintf(cmd, sizeof(cmd), ":INP:POS:A%d:ANGL:IMM %d", axis, 10 + axis);
+            INFO(cmd);
+
+            TEST_SCPI(cmd);
+            REQUIRE(2 == rc);
+            REQUIRE(SCPI_AXIS_EVENT(k_scpi_input_position_a0_immediate, axis) == event);
+            REQUIRE(axis == (int)SCPI_EVENT_AXIS(event));
+            REQUIRE(k_scpi_input_position_a0_immediate == SCPI_EVENT_NODE(event));
+            REQUIRE(SCPI_ANGLE_DEG(10 + axis) == scpi_axis_get(axis)->target);
+
+            snprintf(cmd, sizeof(cmd), ":INP:POS:A%d:ANGL:LIM:HIGH 90;STAT OFF", axis);
+            TEST_SCPI(cmd);
+            REQUIRE(2 == rc);
+            REQUIRE(SCPI_AXIS_EVENT(k_scpi_input_position_a0_limit_state, axis) == event);
+        }
+
+        REQUIRE(k_scpi_input_position_a3_dir == SCPI_AXIS_EVENT(k_scpi_input_position_a0_dir, 3));
+    }
+
+    SECTION("Axes past SCPI_NUM_AXES are rejected")
+    {
+        char cmd[64];
+
+        snprintf(cmd, sizeof(cmd), ":INP:POS:A%d:ANGL:IMM", SCPI_NUM_AXES);
+        TEST_SCPI(cmd);
+        REQUIRE(0 > rc);
+        REQUIRE(k_scpi_input_position == event);
+    }
+
+    scpi_axis_reset();
+}
+
+//  ****************************************************************************
+TEST_CASE("Root menu dispatch", "")
+{
+    struct { const char * token; int rc; scpi_menu_root_t state; } const cases[] =
+    {
+        { "*IDN?",     1, k_scpi_root_q_idn    },
+        { "*rst",      2, k_scpi_root_rst      },
+        { "*OPC",      2, k_scpi_root_opc      },
+        { "*opc?",     1, k_scpi_root_q_opc    },
+        { "INP",       0, k_scpi_root_input    },
+        { "input",     0, k_scpi_root_input    },
+        { "Init",      0, k_scpi_root_initiate },
+        { "INITIATE",  0, k_scpi_root_initiate },
+        { "sens",      0, k_scpi_root_sense    },
+        { "SENSe",     0, k_scpi_root_sense    },
+    };
+
+    SECTION("Every form resolves to its node")
+    {
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        {
+            scpi_menu_root_t state = k_scpi_root_none;
+
+            INFO(cases[i].token);
+            REQUIRE(cases[i].rc == scpi_menu_root_sm(&state, cases[i].token, strlen(cases[i].token)));
+            REQUIRE(cases[i].state == state);
+        }
+    }
+
+    SECTION("Near misses and wrong forms are rejected")
+    {
+        const char * const bad[] = { "*IDN", "*RST?", "INP?", "INPU", "INITI", "SEN", "*ID?", "?", "IN", "*TST", "xyzzy" };
+
+        for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+        {
+            scpi_menu_root_t state = k_scpi_root_none;
+
+            INFO(bad[i]);
+            REQUIRE(-1 == scpi_menu_root_sm(&state, bad[i], strlen(bad[i])));
+            REQUIRE(k_scpi_root_none == state);
+        }
+    }
+}
+
+//  ****************************************************************************
+TEST_CASE("Command tree", "")
+{
+    uint8_t * reply;
+    uint32_t event;
+    size_t reply_len;
+    int rc;
+
+    SECTION("Tables match the definition")
+    {
+        REQUIRE(scpi::tree::node_count == k_scpi_node_count);
+        REQUIRE(scpi::tree::keyword_count == k_scpi_str_count);
+        REQUIRE(k_scpi_root_input == scpi::tree::nodes[k_scpi_input_position].parent);
+        REQUIRE(k_scpi_first_input_position_a0_limit == k_scpi_input_position_a0_limit_low);
+    }
+
+    SECTION("Leaves resolve by table")
+    {
+        TEST_SCPI(":INIT:IMM");
+        REQUIRE(2 == rc);
+        REQUIRE(k_scpi_initiate_immediate == event);
+
+        TEST_SCPI(":initiate:immediate");
+        REQUIRE(2 == rc);
+        REQUIRE(k_scpi_initiate_immediate == event);
+    }
+
+    SECTION("Query and command forms are distinct nodes")
+    {
+        TEST_SCPI(":INP:POS:A0:ANGL:IMM?");
+        REQUIRE(0 > rc);
+        REQUIRE(k_scpi_input_position_a0_angle == event);
+
+        TEST_SCPI(":INP:POS:A0?");
+        REQUIRE(0 > rc);
+        REQUIRE(k_scpi_input_position == event);
+    }
+}
+
+//  ****************************************************************************
+TEST_CASE("Header tokenizer", "")
+{
+    scpi_header_t hdr;
+
+    SECTION("Menu levels and parameter span")
+    {
+        static const char * cmd = ":inp:pos:a0:angl:lim:low  -90.5 ";
+
+        REQUIRE(0 == scpi_tokenize(cmd, strlen(cmd) + 1, &hdr));
+        REQUIRE(6 == hdr.count);
+        REQUIRE(hdr.absolute);
+        REQUIRE(0 == strncmp(cmd + hdr.token[0].offset, "inp", hdr.token[0].len));
+        REQUIRE(0 == strncmp(cmd + hdr.token[4].offset, "lim", hdr.token[4].len));
+        REQUIRE(3 == hdr.token[5].len);
+        REQUIRE(5 == hdr.param_len);
+        REQUIRE(0 == strncmp(cmd + hdr.param_offset, "-90.5", hdr.param_len));
+    }
+
+    SECTION("Relative header, no parameter, trailing ':' tolerated")
+    {
+        static const char * cmd = "inp:pos:\n";
+
+        REQUIRE(0 == scpi_tokenize(cmd, strlen(cmd), &hdr));
+        REQUIRE(2 == hdr.count);
+        REQUIRE(!hdr.absolute);
+        REQUIRE(0 == hdr.param_len);
+    }
+
+    SECTION("Malformed headers")
+    {
+        static const char * empty_level = ":inp::pos";
+        static const char * too_deep    = ":a:b:c:d:e:f:g:h:i";
+
+        REQUIRE(0 > scpi_tokenize(empty_level, strlen(empty_level), &hdr));
+        REQUIRE(0 > scpi_tokenize(too_deep, strlen(too_deep), &hdr));
+    }
+}
+
+//  ****************************************************************************
+TEST_CASE("Case-insensitive compare", "")
+{
+    uint8_t * reply;
+    uint32_t event;
+    size_t reply_len;
+    int rc;
+
+    SECTION("Word-at-a-time fold")
+    {
+        REQUIRE(scpi_str_eq_nocase("POSITION", "position", 8));
+        REQUIRE(scpi_str_eq_nocase("PoSiTiOn", "position", 8));
+        REQUIRE(scpi_str_eq_nocase("IMMEDIATE", "immediate", 9));
+        REQUIRE(scpi_str_eq_nocase("*OPC", "*opc", 4));
+        REQUIRE(scpi_str_eq_nocase("A0", "a0", 2));
+        REQUIRE(!scpi_str_eq_nocase("POSITIOM", "position", 8));
+        REQUIRE(!scpi_str_eq_nocase("A1", "a0", 2));
+
+        // characters next to the letter ranges must not fold
+        REQUIRE(!scpi_str_eq_nocase("@[`{", "`{`{", 4));
+        REQUIRE(!scpi_str_eq_nocase("\xc1", "\xe1", 1));
+
+        for (int c = 0; c < 256; c++)
+        {
+            char in[4]  = { static_cast<char>(c), static_cast<char>(c), 'Q', static_cast<char>(c) };
+            char low[4] = { static_cast<char>((c >= 'A' && c <= 'Z') ? c + 0x20 : c), 0, 'q', 0 };
+            low[1] = low[0];
+            low[3] = low[0];
+
+            REQUIRE(scpi_str_eq_nocase(in, low, 4));
+            REQUIRE(scpi_str_eq_nocase(in, low, 1));
+        }
+    }
+
+    SECTION("Mixed case headers parse without a lowercase copy")
+    {
+        TEST_SCPI(":inp:Pos:A0:angl:ImMeDiAtE 0");
+        REQUIRE(2 == rc);
+        REQUIRE(k_scpi_input_position_a0_immediate == event);
+
+        TEST_SCPI("*idn?");
+        REQUIRE(1 == rc);
+        REQUIRE(k_scpi_root_q_idn == event);
+    }
+}
+
+//  ****************************************************************************
+TEST_CASE("Compound commands", "")
+{
+    uint8_t * reply;
+    uint32_t event;
+    size_t reply_len;
+    int rc;
+
+    SECTION("Relative paths continue from the previous command")
+    {
+        TEST_SCPI(":INP:POS:A0:ANGL:LIM:LOW -90;HIGH 90;:INP:POS:A1:ANGL:IMM 10");
+        REQUIRE(2 == rc);
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "OK_CMD;OK_CMD;OK_CMD"));
+        REQUIRE(strlen(reinterpret_cast<char*>(reply)) == reply_len);
+        REQUIRE(k_scpi_input_position_a1_immediate == event);
+
+        TEST_SCPI(":INP:POS:A2:ANGL:LIM:LOW DEF; STAT ON");
+        REQUIRE(2 == rc);
+        REQUIRE(k_scpi_input_position_a2_limit_state == event);
+    }
+
+    SECTION("Common commands do not change the path")
+    {
+        TEST_SCPI(":INP:POS:A3:ANGL:IMM 0;*OPC?;DIR");
+        REQUIRE(2 == rc);
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "OK_CMD;OK_QUERY;OK_CMD"));
+        REQUIRE(k_scpi_input_position_a3_dir == event);
+
+        TEST_SCPI("*RST;*IDN?;");
+        REQUIRE(1 == rc);
+        REQUIRE(0 == strncmp(reinterpret_cast<char*>(reply), "OK_CMD;Antenna", 14));
+    }
+
+    SECTION("Each message starts again at the root")
+    {
+        TEST_SCPI(":INP:POS:A0:ANGL:LIM:LOW DEF");
+        REQUIRE(2 == rc);
+
+        TEST_SCPI("HIGH");
+        REQUIRE(0 > rc);
+        REQUIRE_REPLY("ERROR");
+    }
+
+    SECTION("Processing stops at the first failing unit")
+    {
+        TEST_SCPI(":INP:POS:A0:ANGL:IMM 0;LOWER;*RST");
+        REQUIRE(0 > rc);
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "OK_CMD;ERROR"));
+        REQUIRE(k_scpi_input_position_a0_angle == event);
+
+        TEST_SCPI("*RST;;*RST");
+        REQUIRE(0 > rc);
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "OK_CMD;ERROR"));
+    }
+}
+
+#if SCPI_HDR_CACHE_SZ
+//  ****************************************************************************
+TEST_CASE("Header cache", "")
+{
+    static scpi_ctx_t ctx;
+    uint8_t * reply;
+    uint32_t event;
+    uint32_t hits;
+    uint32_t misses;
+    size_t reply_len;
+    int rc;
+
+    scpi_ctx_init(&ctx);
+    scpi_axis_reset();
+
+    SECTION("Repeated headers hit, whatever the case and parameter")
+    {
+        TEST_CTX(ctx, ":INP:POS:A0:ANGL:IMM 10");
+        REQUIRE(2 == rc);
+        scpi_hdr_cache_stats(&ctx, &hits, &misses);
+        REQUIRE(0 == hits);
+        REQUIRE(1 == misses);
+
+        TEST_CTX(ctx, ":inp:pos:a0:angl:imm   -20.5 ");
+        REQUIRE(2 == rc);
+        REQUIRE(k_scpi_input_position_a0_immediate == event);
+        REQUIRE(SCPI_ANGLE_DEG(-20) - SCPI_ANGLE_SCALE / 2 == scpi_axis_get(0)->target);
+        scpi_hdr_cache_stats(&ctx, &hits, &misses);
+        REQUIRE(1 == hits);
+        REQUIRE(1 == misses);
+
+        TEST_CTX(ctx, "*OPC?");
+        TEST_CTX(ctx, "*opc?");
+        REQUIRE(1 == rc);
+        REQUIRE(k_scpi_root_q_opc == event);
+        scpi_hdr_cache_stats(&ctx, &hits, &misses);
+        REQUIRE(2 == hits);
+        REQUIRE(2 == misses);
+    }
+
+    SECTION("Relative headers are keyed by the path they start from")
+    {
+        TEST_CTX(ctx, ":INP:POS:A0:ANGL:LIM:LOW -90;HIGH 90");
+        REQUIRE(k_scpi_input_position_a0_limit_high == event);
+
+        TEST_CTX(ctx, ":INP:POS:A1:ANGL:LIM:LOW -45;HIGH 45");
+        REQUIRE(2 == rc);
+        REQUIRE(k_scpi_input_position_a1_limit_high == event);
+        REQUIRE(SCPI_ANGLE_DEG(45) == scpi_axis_get(1)->limit_high);
+        REQUIRE(SCPI_ANGLE_DEG(90) == scpi_axis_get(0)->limit_high);
+
+        TEST_CTX(ctx, ":INP:POS:A1:ANGL:LIM:LOW -30;HIGH 30");
+        REQUIRE(k_scpi_input_position_a1_limit_high == event);
+        REQUIRE(SCPI_ANGLE_DEG(30) == scpi_axis_get(1)->limit_high);
+        scpi_hdr_cache_stats(&ctx, &hits, &misses);
+        REQUIRE(2 == hits);
+        REQUIRE(4 == misses);
+
+        TEST_CTX(ctx, "HIGH 10");
+        REQUIRE(0 > rc);
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "ERROR"));
+    }
+
+    SECTION("Failed headers are not cached")
+    {
+        TEST_CTX(ctx, ":INP:POS:A0:ANGL:IMMX");
+        TEST_CTX(ctx, ":INP:POS:A0:ANGL:IMMX");
+        REQUIRE(0 > rc);
+        TEST_CTX(ctx, ":INP:POS:A0");
+        TEST_CTX(ctx, ":INP:POS:A0");
+        REQUIRE(0 > rc);
+        scpi_hdr_cache_stats(&ctx, &hits, &misses);
+        REQUIRE(0 == hits);
+        REQUIRE(4 == misses);
+    }
+
+    scpi_axis_reset();
+}
+#endif
+
+//  ****************************************************************************
+struct test_binding_t
+{
+    int         calls;
+    uint32_t    evt;
+    string      param;
+};
+
+static int test_bound_write(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    test_binding_t * b = static_cast<test_binding_t *>(user);
 
+    b->calls++;
+    b->evt   = evt;
+    b->param = string(ctx->param, ctx->param_len);
 
+    return (b->param == "BAD") ? k_scpi_err_data_type : 0;
+}
+
+static int test_bound_query(scpi_ctx_t * ctx, uint32_t evt, void * user)
+{
+    scpi_reply_str(ctx, static_cast<const char *>(user));
+
+    return 0;
+}
+
+TEST_CASE("Handler registration", "")
+{
+    uint8_t * reply;
+    uint32_t event;
+    size_t reply_len;
+    int rc;
+    test_binding_t binding = { 0, 0, "" };
+
+    scpi_handlers_reset();
+    scpi_axis_reset();
+
+    SECTION("Application handlers replace the built-in ones")
+    {
+        REQUIRE(0 == scpi_register_handler(k_scpi_input_position_a2_dir, test_bound_write, &binding));
+        REQUIRE(0 == scpi_register_handler(k_scpi_input_position_a1_immediate, test_bound_write, &binding));
+        REQUIRE(0 == scpi_register_handler(k_scpi_root_q_idn, test_bound_query, const_cast<char *>("Bench,Sim,0,1")));
+
+        TEST_SCPI(":INP:POS:A2:ANGL:DIR CW");
+        REQUIRE(2 == rc);
+        REQUIRE(1 == binding.calls);
+        REQUIRE(k_scpi_input_position_a2_dir == binding.evt);
+        REQUIRE("CW" == binding.param);
+
+        //the built-in target handler no longer runs for A1
+        TEST_SCPI(":INP:POS:A1:ANGL:IMM 12");
+        REQUIRE(2 == rc);
+        REQUIRE(2 == binding.calls);
+        REQUIRE(0 == scpi_axis_get(1)->target);
+
+        TEST_SCPI(":INP:POS:A1:ANGL:IMM BAD");
+        REQUIRE(0 > rc);
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "ERROR"));
+
+        TEST_SCPI("*IDN?");
+        REQUIRE(1 == rc);
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "Bench,Sim,0,1"));
+    }
+
+    SECTION("Unbinding acknowledges commands without acting")
+    {
+        REQUIRE(0 == scpi_register_handler(k_scpi_input_position_a0_immediate, 0, 0));
+
+        TEST_SCPI(":INP:POS:A0:ANGL:IMM 10");
+        REQUIRE(2 == rc);
+        REQUIRE_REPLY("OK_CMD");
+        REQUIRE(0 == scpi_axis_get(0)->target);
+
+        REQUIRE(0 > scpi_register_handler(k_scpi_root_none, test_bound_write, &binding));
+    }
+
+    scpi_handlers_reset();
+
+    SECTION("Built-in handlers are bound again after a reset")
+    {
+        TEST_SCPI(":INP:POS:A0:ANGL:IMM 10");
+        REQUIRE(2 == rc);
+        REQUIRE(SCPI_ANGLE_DEG(10) == scpi_axis_get(0)->target);
+        REQUIRE(0 == binding.calls);
+    }
+
+    scpi_axis_reset();
+}
+
+//  ****************************************************************************
+/// Runs a message through scpi_input_ctx() and scpi::parser, each from the
+/// same axis state and with the same handlers, and requires the same result
+///
+static void require_same_parse(scpi_ctx_t * ctx, const string & msg)
+{
+    uint8_t * reply;
+    size_t reply_len;
+    uint32_t c_event;
+    uint32_t event;
+
+    auto dispatch = [ctx](const scpi::unit & u)
+    {
+        ctx->param      = u.param.data();
+        ctx->param_len  = u.param.size();
+
+        return (1 == u.rc) ? scpi_query_event_handler(ctx, u.event) : scpi_write_event_handler(ctx, u.event);
+    };
+
+    scpi_axis_reset();
+    int c_rc = scpi_input_ctx(ctx, reinterpret_cast<const uint8_t*>(msg.data()), msg.size(), &reply, &reply_len, &c_event);
+
+    scpi_axis_reset();
+    int rc = scpi::parser<>::parse(msg, event, dispatch);
+
+    INFO(msg);
+    REQUIRE(c_rc == rc);
+    REQUIRE(c_event == event);
+}
+
+TEST_CASE("C++ parser", "")
+{
+    static scpi_ctx_t ctx;
+
+    scpi_ctx_init(&ctx);
+
+    SECTION("Matches the C parser on the command set")
+    {
+        static const char * cmds[] =
+        {
+            "*IDN?", "*RST", "*OPC", "*OPC?", "*opc?", ":*RST", "*IDN", "*RST?", "*IDX?",
+            ":INP:POS:A0:ANGL:IMM 10.5", ":inp:pos:a1:angl:imm -20", ":INPut:POSition:A2:ANGLe:IMMediate 45.125",
+            ":INP:POS:A3:ANGL:LIM:LOW -90", ":INP:POS:A3:ANGL:LIM:STAT ON", ":INP:POS:A0:ANGL:DIR",
+            ":INP:POS:A0:ANGL:LIM:LOW -90;HIGH 90;STAT ON", ":INP:POS:A1:ANGL:IMM 5;*OPC?;IMM 6",
+            ":INP", ":INP:POS", ":INP:POS:A0:ANGL", ":SENS", "INIT:IMM", ":INIT:IMM:", "INIT:IMM:X",
+            ":INP:POS:A9:ANGL:IMM", ":INP:POS:A01:ANGL:IMM 1", ":INP:POS:A:ANGL:IMM 1", ":INP::POS",
+            ":INP:POS:A0:ANGL:IMM 1e9", ":INP:POS:A0:ANGL:IMM abc", ":INP?", "", ":", ";", "*RST;", "*RST;;*RST",
+            "  *RST ;  *OPC? ", ":INP:POS:A0:ANGL:LIM:LOW -10;'a;b';HIGH 10", "*RST\n:INP", "*RST\r\n",
+            ":A:B:C:D:E:F:G:H:I", ":INP:POS:A0:ANGL:IMM:A:B:C:D",
+            "*CLS;*ESE 60;*SRE?;*STB?", ":STAT:OPER?;QUES:COND?;:STATus:QUEStionable:ENABle 512", ":STAT:PRES;OPER:EVEN?",
+            ":SENS:SWE:STAR -10;STOP 10;STEP 5;AXIS 1;HOLD OFF", ":SENSe:SWEep:STEP 0", ":SENS:SWE:AXIS 9;:ABOR", ":ABORT;:INIT:IMM",
+            ":SENS:SWE:RATE 3;LOG?", ":SENS:SWE:RATE 256",
+        };
+
+        for (const char * cmd : cmds)
+            require_same_parse(&ctx, cmd);
+    }
+
+    SECTION("Matches the C parser on generated messages")
+    {
+        static const char * words[] =
+        {
+            "*idn?", "*rst", "*opc", "*opc?", "inp", "input", "pos", "position", "a", "a0", "a1", "a3", "a7", "a8",
+            "a10", "a00", "angl", "angle", "imm", "immediate", "init", "initiate", "dir", "direction", "lim",
+            "limit", "low", "high", "stat", "state", "sens", "sense", "imm?", "in", "posi", "x", "?",
+        };
+        static const char * tails[] = { "", " 10", " -5.5", " ON", " abc", "  ", "\r", "'q;q'" };
+
+        std::mt19937 rng(0x5C92);
+
+        for (int n = 0; n < 4000; n++)
+        {
+            string msg;
+            int units = 1 + static_cast<int>(rng() % 3);
+
+            for (int u = 0; u < units; u++)
+            {
+                int levels = static_cast<int>(rng() % 7);
+
+                if (u)
+                    msg += ';';
+
+                if (rng() % 2)
+                    msg += ':';
+
+                for (int l = 0; l < levels; l++)
+                {
+                    string w = words[rng() % (sizeof(words) / sizeof(words[0]))];
+
+                    for (char & c : w)
+                    {
+                        if (rng() % 2)
+                            c = static_cast<char>(toupper(c));
+                    }
+
+                    msg += (l ? ":" : "") + w;
+                }
+
+                if (0 == rng() % 13)
+                    msg += ':';
+
+                msg += tails[rng() % (sizeof(tails) / sizeof(tails[0]))];
+            }
+
+            require_same_parse(&ctx, msg);
+        }
+    }
+
+    scpi_axis_reset();
+}
+
+//  ****************************************************************************
+TEST_CASE("Streaming framer", "")
+{
+    static scpi_framer_t framer;
+
+    static const char * corpus[] =
+    {
+        "*IDN?",
+        ":INP:POS:A0:ANGL:IMM 10",
+        ":INP:POS:A0:ANGL:LIM:LOW -90;HIGH 90;:INP:POS:A1:ANGL:IMM 10",
+        "*OPC?\r",
+        ":INP:POS:a9",
+        "",
+        ":INPut:POSition:a2:ANGLe:LIMit:STATe",
+        "\r",
+        "*RST;*OPC?"
+    };
+    static const size_t corpus_sz = sizeof(corpus) / sizeof(corpus[0]);
+
+    std::string stream;
+    std::vector<std::string> expect;        //blank lines are skipped, a trailing '\r' is trimmed
+    for (size_t i = 0; i < corpus_sz; i++)
+    {
+        std::string msg(corpus[i]);
+
+        stream += msg;
+        stream += "\n";
+
+        if (!msg.empty() && '\r' == msg.back())
+            msg.pop_back();
+        if (!msg.empty())
+            expect.push_back(msg);
+    }
+
+    // feed one segment, collect the messages that completed
+    auto feed = [](const char * seg, size_t seg_len, std::vector<std::string> & out)
+    {
+        const uint8_t * data = reinterpret_cast<const uint8_t*>(seg);
+        size_t remain = seg_len;
+        const char * msg;
+        size_t msg_len;
+        int rc;
+
+        while (0 != (rc = scpi_framer_next(&framer, &data, &remain, &msg, &msg_len)))
+        {
+            out.push_back(0 < rc ? std::string(msg, msg_len) : std::string("<overflow>"));
+        }
+
+        REQUIRE(0 == remain);
+    };
+
+    // receive one segment in place, a piece at a time as room allows, collect the messages that completed
+    auto fill = [](const char * seg, size_t seg_len, std::vector<std::string> & out)
+    {
+        uint8_t * dst;
+        size_t room;
+        const char * msg;
+        size_t msg_len;
+        int rc;
+
+        while (seg_len)
+        {
+            room = scpi_framer_room(&framer, &dst);
+            REQUIRE(0 < room);
+
+            if (room > seg_len)
+                room = seg_len;
+
+            memcpy(dst, seg, room);
+            scpi_framer_fill(&framer, room);
+            seg     += room;
+            seg_len -= room;
+
+            while (0 != (rc = scpi_framer_pop(&framer, &msg, &msg_len)))
+            {
+                out.push_back(0 < rc ? std::string(msg, msg_len) : std::string("<overflow>"));
+            }
+        }
+    };
+
+    scpi_framer_init(&framer);
+
+    SECTION("Random segmentations yield the same messages")
+    {
+        std::mt19937 rng(0x5C91);
+
+        for (int trial = 0; trial < 200; trial++)
+        {
+            std::vector<std::string> out;
+            size_t pos = 0;
+
+            while (pos < stream.size())
+            {
+                size_t seg = std::uniform_int_distribution<size_t>(1, 40)(rng);
+                if (seg > stream.size() - pos)
+                    seg = stream.size() - pos;
+
+                feed(stream.data() + pos, seg, out);
+                pos += seg;
+            }
+
+            REQUIRE(expect == out);
+        }
+    }
+
+    SECTION("Received in place, random segmentations yield the same messages")
+    {
+        std::mt19937 rng(0x5C92);
+
+        for (int trial = 0; trial < 200; trial++)
+        {
+            std::vector<std::string> out;
+            size_t pos = 0;
+
+            while (pos < stream.size())
+            {
+                size_t seg = std::uniform_int_distribution<size_t>(1, 2 * SCPI_FRAMER_BFR_SZ)(rng);
+                if (seg > stream.size() - pos)
+                    seg = stream.size() - pos;
+
+                fill(stream.data() + pos, seg, out);
+                pos += seg;
+            }
+
+            REQUIRE(expect == out);
+        }
+    }
+
+    SECTION("Received in place, the message and the bytes after it stay put until it is done")
+    {
+        const char * msg;
+        size_t msg_len;
+        uint8_t * dst;
+        const char * in = "*WAI;*IDN?\n*OPC?\n";
+
+        REQUIRE(strlen(in) <= scpi_framer_room(&framer, &dst));
+        memcpy(dst, in, strlen(in));
+        scpi_framer_fill(&framer, strlen(in));
+
+        REQUIRE(1 == scpi_framer_pop(&framer, &msg, &msg_len));
+        REQUIRE(std::string("*WAI;*IDN?") == std::string(msg, msg_len));
+        REQUIRE(reinterpret_cast<char*>(dst) == msg);
+        REQUIRE(1 == scpi_framer_pop(&framer, &msg, &msg_len));
+        REQUIRE(std::string("*OPC?") == std::string(msg, msg_len));
+        REQUIRE(0 == scpi_framer_pop(&framer, &msg, &msg_len));
+        REQUIRE(SCPI_FRAMER_BFR_SZ == scpi_framer_room(&framer, &dst));
+    }
+
+    SECTION("Coalesced segments parse like separate ones")
+    {
+        static scpi_ctx_t ctx;
+        std::vector<std::string> out;
+        uint8_t * reply;
+        size_t reply_len;
+        uint32_t event;
+
+        scpi_ctx_init(&ctx);
+        feed(stream.data(), stream.size(), out);
+
+        REQUIRE(expect.size() == out.size());
+        REQUIRE(1 == scpi_input_ctx(&ctx, reinterpret_cast<const uint8_t*>(out[0].data()), out[0].size(), &reply, &reply_len, &event));
+        REQUIRE(k_scpi_root_q_idn == event);
+        REQUIRE(2 == scpi_input_ctx(&ctx, reinterpret_cast<const uint8_t*>(out[2].data()), out[2].size(), &reply, &reply_len, &event));
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "OK_CMD;OK_CMD;OK_CMD"));
+        REQUIRE(1 == scpi_input_ctx(&ctx, reinterpret_cast<const uint8_t*>(out[3].data()), out[3].size(), &reply, &reply_len, &event));
+        REQUIRE(k_scpi_root_q_opc == event);
+    }
+
+    SECTION("Over-long messages are discarded and reported once")
+    {
+        std::vector<std::string> out;
+        std::string big(SCPI_FRAMER_BFR_SZ + 10, 'x');
+
+        feed(big.data(), 100, out);
+        feed(big.data() + 100, big.size() - 100, out);
+        feed("\n*IDN?\n", 7, out);
+
+        REQUIRE(2 == out.size());
+        REQUIRE("<overflow>" == out[0]);
+        REQUIRE("*IDN?" == out[1]);
+
+        out.clear();
+        big += "\n*OPC?\n";
+        feed(big.data(), big.size(), out);
+
+        REQUIRE(2 == out.size());
+        REQUIRE("<overflow>" == out[0]);
+        REQUIRE("*OPC?" == out[1]);
+    }
+
+    SECTION("Received in place, over-long messages are discarded and reported once")
+    {
+        std::vector<std::string> out;
+        std::string fits(SCPI_FRAMER_BFR_SZ - 1, 'y');
+        std::string big(SCPI_FRAMER_BFR_SZ + 10, 'x');
+
+        fill(big.data(), 100, out);
+        fill(big.data() + 100, big.size() - 100, out);
+        fill("\n*IDN?\n", 7, out);
+
+        REQUIRE(2 == out.size());
+        REQUIRE("<overflow>" == out[0]);
+        REQUIRE("*IDN?" == out[1]);
+
+        out.clear();
+        big = "*RST\n" + fits + "\n" + std::string(SCPI_FRAMER_BFR_SZ, 'x') + "\n*OPC?\n";
+        fill(big.data(), big.size(), out);
+
+        REQUIRE(4 == out.size());
+        REQUIRE("*RST" == out[0]);
+        REQUIRE(fits == out[1]);
+        REQUIRE("<overflow>" == out[2]);
+        REQUIRE("*OPC?" == out[3]);
+    }
+}
+
+//  ****************************************************************************
+TEST_CASE("Parser context", "")
+{
+    static scpi_ctx_t ctx_a;
+    static scpi_ctx_t ctx_b;
+
+    uint8_t * reply_a;
+    uint8_t * reply_b;
+    size_t reply_len_a;
+    size_t reply_len_b;
+    uint32_t event_a;
+    uint32_t event_b;
+
+    static const char * idn = "*IDN?";
+    static const char * bad = ":INP:POS:a9";
+
+    scpi_ctx_init(&ctx_a);
+    scpi_ctx_init(&ctx_b);
+
+#if !SCPI_REPLY_SHARED
+    SECTION("Replies are kept per context")
+    {
+        REQUIRE(1 == scpi_input_ctx(&ctx_a, reinterpret_cast<const uint8_t*>(idn), strlen(idn) + 1, &reply_a, &reply_len_a, &event_a));
+        REQUIRE(0 > scpi_input_ctx(&ctx_b, reinterpret_cast<const uint8_t*>(bad), strlen(bad) + 1, &reply_b, &reply_len_b, &event_b));
+
+        REQUIRE(reply_a == ctx_a.reply);
+        REQUIRE(reply_b == ctx_b.reply);
+        REQUIRE(0 != strstr(reinterpret_cast<char*>(reply_a), "University of Utah"));
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply_b), "ERROR"));
+        REQUIRE(k_scpi_root_q_idn == event_a);
+        REQUIRE(k_scpi_input_position == event_b);
+    }
+#else
+    SECTION("Replies share one buffer, valid until the next message")
+    {
+        REQUIRE(1 == scpi_input_ctx(&ctx_a, reinterpret_cast<const uint8_t*>(idn), strlen(idn) + 1, &reply_a, &reply_len_a, &event_a));
+        REQUIRE(0 != strstr(reinterpret_cast<char*>(reply_a), "University of Utah"));
+
+        REQUIRE(0 > scpi_input_ctx(&ctx_b, reinterpret_cast<const uint8_t*>(bad), strlen(bad) + 1, &reply_b, &reply_len_b, &event_b));
+
+        REQUIRE(reply_a == reply_b);
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply_b), "ERROR"));
+        REQUIRE(k_scpi_root_q_idn == event_a);
+        REQUIRE(k_scpi_input_position == event_b);
+    }
+#endif
+
+    SECTION("Errors are queued per context")
+    {
+        scpi_input_ctx(&ctx_b, reinterpret_cast<const uint8_t*>(bad), strlen(bad) + 1, &reply_b, &reply_len_b, &event_b);
+        scpi_input_ctx(&ctx_b, reinterpret_cast<const uint8_t*>(":INP::POS"), 10, &reply_b, &reply_len_b, &event_b);
+
+        REQUIRE(k_scpi_err_none == scpi_error_pop(&ctx_a));
+        REQUIRE(k_scpi_err_undefined_header == scpi_error_pop(&ctx_b));
+        REQUIRE(k_scpi_err_syntax == scpi_error_pop(&ctx_b));
+        REQUIRE(k_scpi_err_none == scpi_error_pop(&ctx_b));
+    }
+
+    SECTION("Error queue overflow replaces the newest entry")
+    {
+        for (int i = 0; i < SCPI_ERR_QUEUE_SZ + 2; i++)
+            scpi_error_push(&ctx_a, k_scpi_err_syntax);
+
+        for (int i = 0; i < SCPI_ERR_QUEUE_SZ - 2; i++)
+            REQUIRE(k_scpi_err_syntax == scpi_error_pop(&ctx_a));
+
+        REQUIRE(k_scpi_err_queue_overflow == scpi_error_pop(&ctx_a));
+        REQUIRE(k_scpi_err_none == scpi_error_pop(&ctx_a));
+    }
+}
+
+//  ****************************************************************************
+TEST_CASE("SYSTem:ERRor queue", "")
+{
+    static scpi_ctx_t ctx;
+    uint8_t * reply;
+    uint32_t event;
+    size_t reply_len;
+    int rc;
+
+    scpi_ctx_init(&ctx);
+    scpi_axis_reset();
+
+    SECTION("Errors of a pipelined batch are read back in order")
+    {
+        TEST_CTX(ctx, ":INP:POS:A0:ANGL:IMM 10");
+        TEST_CTX(ctx, ":INP:POS:A0:ANGL:IMX 10");
+        TEST_CTX(ctx, ":INP:POS:A1:ANGL:IMM 1e9");
+        TEST_CTX(ctx, ":INP::POS");
+
+        TEST_CTX(ctx, "SYST:ERR:COUN?");
+        REQUIRE(1 == rc);
+        REQUIRE(k_scpi_system_error_q_count == event);
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "3"));
+
+        TEST_CTX(ctx, "SYST:ERR?");
+        REQUIRE(1 == rc);
+        REQUIRE(k_scpi_system_q_error == event);
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "-113,\"Undefined header\""));
+
+        TEST_CTX(ctx, ":system:error:next?;:SYSTem:ERRor:NEXT?;:SYST:ERR?");
+        REQUIRE(1 == rc);
+        REQUIRE(k_scpi_system_q_error == event);
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "-222,\"Data out of range\";-102,\"Syntax error\";0,\"No error\""));
+
+        TEST_CTX(ctx, "SYST:ERR:COUN?");
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "0"));
+    }
+
+    SECTION("Overflow is reported after the queued errors")
+    {
+        for (int i = 0; i < SCPI_ERR_QUEUE_SZ + 2; i++)
+            TEST_CTX(ctx, "*IDX?");
+
+        TEST_CTX(ctx, "SYST:ERR:COUN?");
+        REQUIRE(SCPI_ERR_QUEUE_SZ - 1 == atoi(reinterpret_cast<char*>(reply)));
+
+        for (int i = 0; i < SCPI_ERR_QUEUE_SZ - 2; i++)
+        {
+            TEST_CTX(ctx, "SYST:ERR?");
+            REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "-113,\"Undefined header\""));
+        }
+
+        TEST_CTX(ctx, "SYST:ERR?");
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "-350,\"Queue overflow\""));
+        TEST_CTX(ctx, "SYST:ERR?");
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "0,\"No error\""));
+    }
+
+    SECTION("Bad SYSTem headers")
+    {
+        TEST_CTX(ctx, "SYST:ERR");
+        REQUIRE(-3 == rc);
+        TEST_CTX(ctx, "SYST:ERR:NEXT");
+        REQUIRE(-2 == rc);
+        TEST_CTX(ctx, "SYST:ERR:COUN? 1;:SYST:ERR:NEXT?");
+        REQUIRE(1 == rc);
+        REQUIRE(0 == strcmp(reinterpret_cast<char*>(reply), "2;-113,\"Undefined header\""));
+    }
+
+    SECTION("Errors pushed from other threads keep their order")
+    {
+        static const int k_producers = 4;
+        static const int k_per_producer = 4000;
+
+        vector<thread> producers;
+        vector<int> last(k_producers, -1);
+        atomic<int> running(k_producers);
+        bool ordered = true;
+        int popped = 0;
+
+        for (int t = 0; t < k_producers; t++)
+        {
+            producers.push_back(thread([t, &running]()
+            {
+                //the code carries the producer and its sequence number
+                for (int i = 0; i < k_per_producer; i++)
+                    scpi_error_push(&ctx, static_cast<int16_t>(-(1000 + t * 5000 + i)));
+
+                running--;
+            }));
+        }
+
+        for (;;)
+        {
+            bool finished = (0 == running.load());
+            int16_t code = scpi_error_pop(&ctx);
+
+            if (k_scpi_err_none == code)
+            {
+                if (finished)
+                    break;
+
+                continue;
+            }
+
+            if (k_scpi_err_queue_overflow == code)
+                continue;
+
+            int producer = (-code - 1000) / 5000;
+            int seq = (-code - 1000) % 5000;
+
+            ordered = ordered && producer < k_producers && seq > last[producer];
+            last[producer] = seq;
+            popped++;
+        }
+
+        for (thread & p : producers)
+            p.join();
+
+        REQUIRE(ordered);
+        REQUIRE(0 < popped);
+        REQUIRE(k_scpi_err_none == scpi_error_pop(&ctx));
+        REQUIRE(0u == scpi_error_count(&ctx));
+    }
+
+    scpi_axis_reset();
+}
+
+// **********************************************************************************
+/// Axis drive for the tests; a move runs until the test finishes it
+///
+struct fake_drive
+{
+    int         moving[SCPI_NUM_AXES] = {};
+    int         moves = 0;
+    int         refuse = FALSE;
+    int32_t     target = 0;
+    vector<int32_t> path;
+
+    static int move(void * user, int axis, int32_t target)
+    {
+        fake_drive * d = static_cast<fake_drive *>(user);
+
+        if (d->refuse)
+            return -1;
+
+        d->moving[axis] = TRUE;
+        d->target = target;
+        d->path.push_back(target);
+        d->moves++;
+        return 0;
+    }
+
+    static int busy(void * user, int axis)
+    {
+        return static_cast<fake_drive *>(user)->moving[axis];
+    }
+};
+
+//  ****************************************************************************
+TEST_CASE("Pending operations", "")
+{
+    static scpi_ctx_t ctx;
+    static scpi_ctx_t other;
+    uint8_t * reply;
+    uint32_t event;
+    size_t reply_len;
+    int rc;
+
+    fake_drive drive;
+    const hal_motion_t hal = { fake_drive::move, fake_drive::busy, &drive };
+
+    scpi_ctx_init(&ctx);
+    scpi_ctx_init(&other);
+    scpi_axis_reset();
+    scpi_motion_init(&hal);
+
+    SECTION("A move is queued and acknowledged at once")
+    {
+        TEST_CTX(ctx, ":INP:POS:A1:ANGL:IMM 45");
+        REQUIRE(2 == rc);
+        REQUIRE(REPLY_IS("OK_CMD"));
+        REQUIRE(1u == scpi_ops_pending());
+        REQUIRE(0 == drive.moves);
+
+        REQUIRE(scpi_motion_poll());
+        REQUIRE(1 == drive.moves);
+        REQUIRE(SCPI_ANGLE_DEG(45) == drive.target);
+        REQUIRE(scpi_motion_poll());
+
+        drive.moving[1] = FALSE;
+        REQUIRE(!scpi_motion_poll());
+        REQUIRE(0u == scpi_ops_pending());
+    }
+
+    SECTION("*OPC? holds only its own connection")
+    {
+        TEST_CTX(ctx, ":INP:POS:A0:ANGL:IMM 10;:INP:POS:A0:ANGL:IMM 20");
+        REQUIRE(2u == scpi_ops_pending());
+
+        TEST_CTX(ctx, "*IDN?;*OPC?;*IDN?");
+        REQUIRE(SCPI_INPUT_WAIT == rc);
+        REQUIRE(0 == reply_len);
+        REQUIRE(scpi_input_blocked(&ctx));
+
+        //the reply so far may be sent at once, as tcpConnRun() does; only
+        //what follows it is needed once the message completes
+        std::string held(reinterpret_cast<char*>(ctx.reply), ctx.reply_len);
+        size_t sent = ctx.reply_len;
+        REQUIRE(0 == held.compare(0, 7, "Antenna"));
+
+        //another connection is not held up
+        TEST_CTX(other, "*OPC");
+        REQUIRE(2 == rc);
+        TEST_CTX(other, "SYST:ERR:COUN?");
+        REQUIRE(1 == rc);
+        REQUIRE(REPLY_IS("0"));
+        REQUIRE(0u == (scpi_esr_get(&other) & SCPI_ESR_OPC));
+
+        scpi_motion_poll();
+        drive.moving[0] = FALSE;
+        scpi_motion_poll();
+        REQUIRE(scpi_input_blocked(&ctx));
+        REQUIRE(SCPI_INPUT_WAIT == scpi_input_resume(&ctx, &reply, &reply_len, &event));
+
+        drive.moving[0] = FALSE;
+        REQUIRE(!scpi_motion_poll());
+        REQUIRE(!scpi_input_blocked(&ctx));
+
+        rc = scpi_input_resume(&ctx, &reply, &reply_len, &event);
+        REQUIRE(1 == rc);
+        REQUIRE(k_scpi_root_q_idn == event);
+        REQUIRE(reply_len > sent);
+        REQUIRE(0 == strncmp(reinterpret_cast<char*>(reply) + sent, ";OK_QUERY;Antenna", 17));
+        REQUIRE(reply_len - sent == strlen(reinterpret_cast<char*>(reply) + sent));
+
+#if SCPI_REPLY_SHARED
+        //the other connection's reply took the start of the buffer
+        REQUIRE(0 != strncmp(reinterpret_cast<char*>(reply), "Antenna", 7));
+#else
+        REQUIRE(held == std::string(reinterpret_cast<char*>(reply), sent));
+#endif
+
+        REQUIRE(SCPI_ESR_OPC == (scpi_esr_get(&other) & SCPI_ESR_OPC));
+    }
+
+    SECTION("*WAI orders the units that follow")
+    {
+        TEST_CTX(ctx, ":INP:POS:A2:ANGL:IMM 30;*WAI;:INP:POS:A2:ANGL:LIM:STAT OFF");
+        REQUIRE(SCPI_INPUT_WAIT == rc);
+        REQUIRE(k_scpi_root_wai == event);
+        REQUIRE(scpi_axis_get(2)->limit_enabled);
+
+        scpi_motion_poll();
+        drive.moving[2] = FALSE;
+        scpi_motion_poll();
+
+        rc = scpi_input_resume(&ctx, &reply, &reply_len, &event);
+        REQUIRE(2 == rc);
+        REQUIRE(k_scpi_input_position_a2_limit_state == event);
+        REQUIRE(REPLY_IS("OK_CMD;OK_CMD;OK_CMD"));
+        REQUIRE(!scpi_axis_get(2)->limit_enabled);
+    }
+
+    SECTION("A trailing *OPC? replies on resume")
+    {
+        TEST_CTX(ctx, ":INP:POS:A3:ANGL:IMM 5;*OPC?");
+        REQUIRE(SCPI_INPUT_WAIT == rc);
+
+        scpi_motion_poll();
+        drive.moving[3] = FALSE;
+        scpi_motion_poll();
+
+        rc = scpi_input_resume(&ctx, &reply, &reply_len, &event);
+        REQUIRE(1 == rc);
+        REQUIRE(k_scpi_root_q_opc == event);
+        REQUIRE(REPLY_IS("OK_CMD;OK_QUERY"));
+
+        //nothing pending: *OPC? and *WAI do not wait
+        TEST_CTX(ctx, "*WAI;*OPC?");
+        REQUIRE(1 == rc);
+        REQUIRE(REPLY_IS("OK_CMD;OK_QUERY"));
+    }
+
+    SECTION("*OPC sets the ESR bit once the moves finish")
+    {
+        TEST_CTX(ctx, ":INP:POS:A0:ANGL:IMM 1;*OPC");
+        REQUIRE(2 == rc);
+        REQUIRE(0u == (scpi_esr_get(&ctx) & SCPI_ESR_OPC));
+
+        //as in IEEE 488.2, it waits for no operation to be pending at all
+        scpi_motion_poll();
+        TEST_CTX(other, ":INP:POS:A1:ANGL:IMM 1");
+        drive.moving[0] = FALSE;
+        scpi_motion_poll();
+        REQUIRE(1u == scpi_ops_pending());
+        REQUIRE(0u == (scpi_esr_get(&ctx) & SCPI_ESR_OPC));
+
+        drive.moving[1] = FALSE;
+        scpi_motion_poll();
+        REQUIRE(SCPI_ESR_OPC == (scpi_esr_get(&ctx) & SCPI_ESR_OPC));
+
+        //*RST disarms
+        TEST_CTX(ctx, ":INP:POS:A0:ANGL:IMM 2;*OPC;*RST");
+        scpi_motion_poll();
+        drive.moving[0] = FALSE;
+        scpi_motion_poll();
+        ctx.esr = 0;
+        REQUIRE(0u == scpi_esr_get(&ctx));
+    }
+
+    SECTION("A full queue or a refused move does not leave work pending")
+    {
+        for (int i = 0; i < SCPI_MOTION_QUEUE_SZ; i++)
+        {
+            TEST_CTX(ctx, ":INP:POS:A0:ANGL:IMM 1");
+            REQUIRE(2 == rc);
+        }
+
+        TEST_CTX(ctx, ":INP:POS:A0:ANGL:IMM 2");
+        REQUIRE(0 > rc);
+        REQUIRE(k_scpi_err_execution == scpi_error_pop(&ctx));
+        REQUIRE(SCPI_ANGLE_DEG(1) == scpi_axis_get(0)->target);
+
+        drive.refuse = TRUE;
+        while (scpi_motion_poll())
+            ;
+        REQUIRE(0u == scpi_ops_pending());
+        REQUIRE(0 == drive.moves);
+    }
+
+    scpi_motion_init(0);
+    REQUIRE(0u == scpi_ops_pending());
+    scpi_axis_reset();
+}
+
+//  ****************************************************************************
+TEST_CASE("Status model", "")
+{
+    static scpi_ctx_t ctx;
+    static scpi_ctx_t other;
+    uint8_t * reply;
+    uint32_t event;
+    size_t reply_len;
+    int rc;
+
+    scpi_ctx_init(&ctx);
+    scpi_ctx_init(&other);
+
+    TEST_CTX(ctx, "*CLS;:STAT:PRES");
+    REQUIRE(2 == rc);
+
+    SECTION("Errors latch their class in the ESR")
+    {
+        TEST_CTX(ctx, "*ESR?");
+        REQUIRE(1 == rc);
+        REQUIRE(k_scpi_root_q_esr == event);
+        REQUIRE(REPLY_IS("0"));
+
+        TEST_CTX(ctx, ":INP::POS");
+        TEST_CTX(ctx, ":INP:POS:A0:ANGL:IMM 1e9");
+        REQUIRE(SCPI_STB_EAV == scpi_stb_get(&ctx));
+
+        TEST_CTX(ctx, "*OPC;*ESR?;*ESR?");
+        REQUIRE(1 == rc);
+        REQUIRE(REPLY_IS("OK_CMD;49;0"));
+
+        //the other connection saw none of it
+        TEST_CTX(other, "*ESR?;*STB?");
+        REQUIRE(REPLY_IS("0;0"));
+    }
+
+    SECTION("*ESE / *SRE summarise into the status byte")
+    {
+        TEST_CTX(ctx, "*ESE 32;*SRE 255;*ESE?;*SRE?");
+        REQUIRE(1 == rc);
+        REQUIRE(REPLY_IS("OK_CMD;OK_CMD;32;191"));
+
+        TEST_CTX(ctx, "*IDX?");
+        TEST_CTX(ctx, "*STB?");
+        REQUIRE(REPLY_IS("100"));       //EAV | ESB | MSS
+
+        //*STB? does not clear, *CLS does
+        TEST_CTX(ctx, "*STB?");
+        REQUIRE(REPLY_IS("100"));
+        TEST_CTX(ctx, "*CLS;*STB?");
+        REQUIRE(REPLY_IS("OK_CMD;0"));
+        REQUIRE(0u == scpi_error_count(&ctx));
+
+        TEST_CTX(ctx, "*ESE 256");
+        REQUIRE(0 > rc);
+        TEST_CTX(ctx, "*ESE 2147483.647");       //largest value the parser accepts
+        REQUIRE(0 > rc);
+        TEST_CTX(ctx, "*ESE -0.4;*ESE?");
+        REQUIRE(REPLY_IS("OK_CMD;0"));
+        TEST_CTX(ctx, "*SRE");
+        REQUIRE(0 > rc);
+        TEST_CTX(ctx, "*ESE 31.6;*ESE?;*SRE MAX;*SRE?");
+        REQUIRE(REPLY_IS("OK_CMD;32;OK_CMD;191"));
+        TEST_CTX(ctx, "*ESE 0;*SRE 0");
+    }
+
+    SECTION("OPERation and QUEStionable latch positive transitions")
+    {
+        scpi_status_set(k_scpi_reg_questionable, SCPI_QUES_LIMIT);
+        scpi_status_clear(k_scpi_reg_questionable, SCPI_QUES_LIMIT);
+        scpi_status_set(k_scpi_reg_operation, SCPI_OPER_VNA_READY);
+
+        TEST_CTX(ctx, ":STAT:QUES:COND?;EVEN?;EVEN?");
+        REQUIRE(1 == rc);
+        REQUIRE(REPLY_IS("0;512;0"));
+
+        TEST_CTX(ctx, ":STATus:OPERation:CONDition?;:STAT:OPER?");
+        REQUIRE(REPLY_IS("512;512"));
+        REQUIRE(SCPI_OPER_VNA_READY == scpi_status_condition(k_scpi_reg_operation));
+
+        //still raised, but the transition was read
+        scpi_status_set(k_scpi_reg_operation, SCPI_OPER_VNA_READY);
+        TEST_CTX(ctx, ":STAT:OPER:EVEN?");
+        REQUIRE(REPLY_IS("0"));
+
+        //enabled summaries reach the status byte of every connection
+        scpi_status_set(k_scpi_reg_questionable, SCPI_QUES_DRIVE);
+        TEST_CTX(ctx, ":STAT:QUES:ENAB 1024;ENAB?;:STAT:OPER:ENAB 32768");
+        REQUIRE(0 > rc);
+        REQUIRE(REPLY_IS("OK_CMD;1024;ERROR"));
+        REQUIRE(SCPI_STB_QUES == (scpi_stb_get(&other) & SCPI_STB_QUES));
+
+        TEST_CTX(other, "*SRE 8;*STB?");
+        REQUIRE(REPLY_IS("OK_CMD;72"));    //QUES | MSS
+
+        TEST_CTX(ctx, ":STAT:PRES;:STAT:QUES:ENAB?");
+        REQUIRE(REPLY_IS("OK_CMD;0"));
+        REQUIRE(0u == (scpi_stb_get(&other) & SCPI_STB_QUES));
+
+        TEST_CTX(ctx, "*CLS;:STAT:QUES?");
+        REQUIRE(REPLY_IS("OK_CMD;0"));
+        scpi_status_clear(k_scpi_reg_operation, SCPI_OPER_VNA_READY);
+        scpi_status_clear(k_scpi_reg_questionable, SCPI_QUES_DRIVE);
+    }
+
+    SECTION("Moves raise OPERation MOVing; a refused move QUEStionable")
+    {
+        fake_drive drive;
+        const hal_motion_t hal = { fake_drive::move, fake_drive::busy, &drive };
+
+        scpi_motion_init(&hal);
+
+        TEST_CTX(ctx, ":INP:POS:A0:ANGL:IMM 3");
+        REQUIRE(SCPI_OPER_MOVING == scpi_status_condition(k_scpi_reg_operation));
+        scpi_motion_poll();
+        drive.moving[0] = FALSE;
+        REQUIRE(!scpi_motion_poll());
+        REQUIRE(0u == scpi_status_condition(k_scpi_reg_operation));
+
+        drive.refuse = TRUE;
+        TEST_CTX(ctx, ":INP:POS:A0:ANGL:IMM 4");
+        REQUIRE(!scpi_motion_poll());
+
+        TEST_CTX(ctx, ":STAT:OPER?;OPER:COND?;:STAT:QUES:COND?");
+        REQUIRE(REPLY_IS("256;0;1024"));
+
+        scpi_motion_init(0);
+        REQUIRE(0u == scpi_status_condition(k_scpi_reg_questionable));
+    }
+
+    scpi_axis_reset();
+}
+
+static void collect_line(scpi_ctx_t * ctx, const char * line, size_t len, void * user)
+{
+    static_cast<vector<string> *>(user)->push_back(string(line, len));
+}
+
+//  ****************************************************************************
+TEST_CASE("Service requests", "")
+{
+    static scpi_ctx_t ctx;
+    static scpi_ctx_t other;
+    uint8_t * reply;
+    uint32_t event;
+    size_t reply_len;
+    int rc;
+
+    vector<string> lines;
+    vector<string> other_lines;
+    fake_drive drive;
+    const hal_motion_t hal = { fake_drive::move, fake_drive::busy, &drive };
+
+    scpi_ctx_init(&ctx);
+    scpi_ctx_init(&other);
+    scpi_ctx_notify(&ctx, collect_line, &lines);
+    scpi_ctx_notify(&other, collect_line, &other_lines);
+    scpi_motion_init(&hal);
+
+    TEST_CTX(ctx, "*CLS;:STAT:PRES;:STAT:OPER:ENAB 256;*SRE 128;:SYST:SRQ ON;SRQ?");
+    REQUIRE(1 == rc);
+    REQUIRE(REPLY_IS("OK_CMD;OK_CMD;OK_CMD;OK_CMD;OK_CMD;1"));
+    REQUIRE(!scpi_srq_poll(&ctx));
+
+    SECTION("Each enabled rise is pushed once")
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            TEST_CTX(ctx, ":INP:POS:A0:ANGL:IMM 5");
+            REQUIRE(scpi_srq_poll(&ctx));
+            REQUIRE(!scpi_srq_poll(&ctx));
+
+            scpi_motion_poll();
+            drive.moving[0] = FALSE;
+            scpi_motion_poll();
+            REQUIRE(!scpi_srq_poll(&ctx));
+        }
+
+        REQUIRE(3 == lines.size());
+        REQUIRE("SRQ 192" == lines[0]);
+        REQUIRE("SRQ 192" == lines[2]);
+
+        //not subscribed: nothing, though the shared register is enabled
+        REQUIRE(!scpi_srq_poll(&other));
+        REQUIRE(other_lines.empty());
+    }
+
+    SECTION("Operation complete and errors request service through *ESE / *SRE")
+    {
+        TEST_CTX(other, ":STAT:PRES;*ESE 1;*SRE 36;:SYST:SRQ 1;:INP:POS:A1:ANGL:IMM 2;*OPC");
+        REQUIRE(2 == rc);
+        REQUIRE(!scpi_srq_poll(&other));
+
+        scpi_motion_poll();
+        drive.moving[1] = FALSE;
+        scpi_motion_poll();
+        REQUIRE(scpi_srq_poll(&other));
+        REQUIRE("SRQ 96" == other_lines.back());       //ESB | MSS
+
+        TEST_CTX(other, "*ESR?;*IDX?");
+        REQUIRE(scpi_srq_poll(&other));
+        REQUIRE("SRQ 68" == other_lines.back());       //EAV | MSS
+
+        TEST_CTX(other, ":SYST:SRQ OFF;:SYST:ERR?;*IDX?");
+        REQUIRE(!scpi_srq_poll(&other));
+        REQUIRE(2 == other_lines.size());
+
+        TEST_CTX(other, ":SYST:SRQ");
+        REQUIRE(0 > rc);
+    }
+
+    SECTION("Rises that are not enabled are not pushed")
+    {
+        scpi_status_set(k_scpi_reg_questionable, SCPI_QUES_LIMIT);
+        REQUIRE(!scpi_srq_poll(&ctx));
+        scpi_status_clear(k_scpi_reg_questionable, SCPI_QUES_LIMIT);
+        REQUIRE(lines.empty());
+    }
+
+    scpi_motion_init(0);
+    scpi_input_ctx(&ctx, reinterpret_cast<const uint8_t*>("*CLS;:STAT:PRES"), 15, &reply, &reply_len, &event);
+    scpi_axis_reset();
+}
+
+// **********************************************************************************
+/// VNA for the tests; a measurement runs until the test finishes it
+///
+struct fake_vna
+{
+    int         measuring = FALSE;
+    int         triggers = 0;
+    int         trig_high = -1;
+    int         rdy_high = -1;
+    fake_drive * drive = nullptr;
+    int         early = 0;          //triggers while an axis was still moving
+
+    static void polarity(void * user, int trig_active_high, int rdy_active_high)
+    {
+        fake_vna * v = static_cast<fake_vna *>(user);
+
+        v->trig_high = trig_active_high;
+        v->rdy_high  = rdy_active_high;
+    }
+
+    static void trigger(void * user)
+    {
+        fake_vna * v = static_cast<fake_vna *>(user);
+
+        for (int m : v->drive->moving)
+            v->early += m;
+
+        v->measuring = TRUE;
+        v->triggers++;
+    }
+
+    static int ready(void * user)
+    {
+        return !static_cast<fake_vna *>(user)->measuring;
+    }
+};
+
+//  ****************************************************************************
+TEST_CASE("Sweep", "")
+{
+    static scpi_ctx_t ctx;
+    uint8_t * reply;
+    uint32_t event;
+    size_t reply_len;
+    int rc;
+
+    fake_drive drive;
+    fake_vna vna;
+    const hal_motion_t hal = { fake_drive::move, fake_drive::busy, &drive };
+    const hal_vna_t vna_hal = { fake_vna::polarity, fake_vna::trigger, fake_vna::ready, &vna };
+
+    vna.drive = &drive;
+
+    scpi_ctx_init(&ctx);
+    scpi_axis_reset();
+    scpi_motion_init(&hal);
+    scpi_sweep_init(&vna_hal);
+
+    //the motion task, with a drive and a VNA that finish whatever they started
+    auto run = [&]()
+    {
+        int n = 0;
+
+        while ((scpi_motion_poll() | scpi_sweep_poll()) && n++ < 1000)
+        {
+            for (int & m : drive.moving)
+                m = FALSE;
+
+            vna.measuring = FALSE;
+        }
+    };
+
+    SECTION("INITiate walks the active axis over the grid")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STAR -10;STOP 10;STEP 5;AXIS 2;:INIT:IMM");
+        REQUIRE(2 == rc);
+        REQUIRE(1u == scpi_ops_pending());
+        REQUIRE(0u != (SCPI_OPER_SWEEPING & scpi_status_condition(k_scpi_reg_operation)));
+
+        run();
+
+        REQUIRE(vector<int32_t>{ SCPI_ANGLE_DEG(-10), SCPI_ANGLE_DEG(-5), 0, SCPI_ANGLE_DEG(5), SCPI_ANGLE_DEG(10) } == drive.path);
+        REQUIRE(5 == vna.triggers);
+        REQUIRE(0 == vna.early);
+        REQUIRE(1 == vna.trig_high);
+        REQUIRE(1 == vna.rdy_high);
+        REQUIRE(0u == scpi_ops_pending());
+        REQUIRE(0u == (SCPI_OPER_SWEEPING & scpi_status_condition(k_scpi_reg_operation)));
+
+        TEST_CTX(ctx, ":STAT:OPER:EVEN?");
+        REQUIRE(REPLY_IS("1800"));      //SWEEPING | MOVING | VNA_READY | POINT
+
+        //a drive without position readback logs the targets
+        TEST_CTX(ctx, ":SENS:SWE:LOG?");
+        REQUIRE(REPLY_IS("5,0,-10.000,0,1,-5.000,0,2,0.000,0,3,5.000,0,4,10.000,0"));
+    }
+
+    SECTION("A descending sweep stops short of an end the step does not reach")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STAR 1;STOP -1;STEP 0.8;:INIT:IMM");
+        REQUIRE(2 == rc);
+
+        run();
+
+        REQUIRE(vector<int32_t>{ SCPI_ANGLE_DEG(1), 200, -600 } == drive.path);
+    }
+
+    SECTION("HOLD keeps the axis still until the VNA is done")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STOP 2;HOLD ON;:INIT:IMM");
+
+        scpi_sweep_poll();
+        scpi_motion_poll();
+        drive.moving[0] = FALSE;
+        scpi_motion_poll();
+        scpi_sweep_poll();
+        REQUIRE(1 == vna.triggers);
+
+        scpi_motion_poll();
+        scpi_sweep_poll();
+        REQUIRE(1 == drive.moves);
+
+        vna.measuring = FALSE;
+        scpi_sweep_poll();
+        scpi_motion_poll();
+        REQUIRE(2 == drive.moves);
+
+        run();
+        REQUIRE(3 == vna.triggers);
+    }
+
+    SECTION("HOLD OFF moves on while the VNA measures")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STOP 2;HOLD OFF;:INIT:IMM");
+
+        scpi_sweep_poll();
+        scpi_motion_poll();
+        drive.moving[0] = FALSE;
+        scpi_motion_poll();
+        scpi_sweep_poll();
+        REQUIRE(1 == vna.triggers);
+
+        scpi_motion_poll();
+        REQUIRE(2 == drive.moves);
+        REQUIRE(SCPI_ANGLE_DEG(1) == drive.target);
+        REQUIRE(vna.measuring);
+
+        //the next trigger still waits for the axis
+        vna.measuring = FALSE;
+        scpi_sweep_poll();
+        REQUIRE(1 == vna.triggers);
+
+        run();
+        REQUIRE(3 == vna.triggers);
+        REQUIRE(0 == vna.early);
+        REQUIRE(3 == drive.moves);
+    }
+
+    SECTION("*OPC? answers once the sweep is done")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STOP 1;:INIT:IMM;*OPC?");
+        REQUIRE(SCPI_INPUT_WAIT == rc);
+
+        run();
+
+        REQUIRE(1 == scpi_input_resume(&ctx, &reply, &reply_len, &event));
+        REQUIRE(0 != strstr(reinterpret_cast<char*>(reply), "OK_QUERY"));
+    }
+
+    SECTION("A second INITiate is ignored; ABORt ends the sweep")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STOP 90;:INIT:IMM");
+        scpi_sweep_poll();
+        scpi_motion_poll();
+
+        TEST_CTX(ctx, ":INIT:IMM");
+        REQUIRE(0 > rc);
+        TEST_CTX(ctx, ":SYST:ERR?");
+        REQUIRE(REPLY_IS("-213,\"Init ignored\""));
+
+        TEST_CTX(ctx, ":ABOR");
+        REQUIRE(2 == rc);
+
+        run();
+
+        REQUIRE(1 == drive.moves);
+        REQUIRE(0u == scpi_ops_pending());
+        REQUIRE(0u == (SCPI_OPER_SWEEPING & scpi_status_condition(k_scpi_reg_operation)));
+
+        TEST_CTX(ctx, ":INIT:IMM");
+        REQUIRE(2 == rc);
+        run();
+        REQUIRE(92 == drive.moves);
+    }
+
+    SECTION("Settings are checked")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STEP 0");
+        REQUIRE(0 > rc);
+        TEST_CTX(ctx, ":SENS:SWE:STEP 0.04");
+        REQUIRE(0 > rc);
+        TEST_CTX(ctx, ":SENS:SWE:STAR 361");
+        REQUIRE(0 > rc);
+        TEST_CTX(ctx, ":SENS:SWE:AXIS 8");
+        REQUIRE(0 > rc);
+        TEST_CTX(ctx, ":SENS:SWE:HOLD");
+        REQUIRE(0 > rc);
+
+        TEST_CTX(ctx, "*CLS;:INP:POS:A0:ANGL:LIM:LOW -45;:SENS:SWE:STAR -90;:INIT:IMM");
+        REQUIRE(0 > rc);
+        TEST_CTX(ctx, ":SYST:ERR?");
+        REQUIRE(REPLY_IS("-221,\"Settings conflict\""));
+        REQUIRE(0u == scpi_ops_pending());
+
+        TEST_CTX(ctx, ":INP:POS:A0:ANGL:LIM:STAT OFF;:INIT:IMM");
+        REQUIRE(2 == rc);
+        run();
+        REQUIRE(SCPI_ANGLE_DEG(-90) == drive.path.front());
+    }
+
+    SECTION("The VNA ready input shows in the OPERation condition")
+    {
+        scpi_sweep_poll();
+        REQUIRE(0u != (SCPI_OPER_VNA_READY & scpi_status_condition(k_scpi_reg_operation)));
+
+        vna.measuring = TRUE;
+        scpi_sweep_poll();
+        REQUIRE(0u == (SCPI_OPER_VNA_READY & scpi_status_condition(k_scpi_reg_operation)));
+    }
+
+    SECTION("With no drive and no VNA a sweep completes as it is accepted")
+    {
+        scpi_motion_init(0);
+        scpi_sweep_init(0);
+
+        TEST_CTX(ctx, ":STAT:OPER:EVEN?;:SENS:SWE:STOP 3;:INIT:IMM;*OPC?");
+        REQUIRE(1 == rc);
+        REQUIRE(0u == scpi_ops_pending());
+        REQUIRE(0 == drive.moves);
+
+        TEST_CTX(ctx, ":STAT:OPER:EVEN?");
+        REQUIRE(REPLY_IS("1032"));      //SWEEPING | POINT
+    }
+
+    scpi_sweep_init(0);
+    scpi_motion_init(0);
+    scpi_input_ctx(&ctx, reinterpret_cast<const uint8_t*>("*RST;*CLS;:STAT:PRES"), 20, &reply, &reply_len, &event);
+    scpi_status_clear(k_scpi_reg_operation, SCPI_OPER_VNA_READY);
+    scpi_axis_reset();
+}
+
+// **********************************************************************************
+/// Drive that reports its position; the test advances its clock and it moves
+/// at the set rate, or straight to the target without one
+///
+struct fake_glide
+{
+    int32_t     pos = 0;
+    int32_t     target = 0;
+    uint32_t    speed = 0;
+    uint32_t    us = 0;
+    int         rates = 0;
+    int         stops = 0;
+    vector<uint32_t> speeds;
+    vector<int32_t> path;
+
+    static int move(void * user, int axis, int32_t target)
+    {
+        fake_glide * g = static_cast<fake_glide *>(user);
+
+        g->target = target;
+        g->path.push_back(target);
+        return 0;
+    }
+
+    static int busy(void * user, int axis)
+    {
+        fake_glide * g = static_cast<fake_glide *>(user);
+
+        return g->pos != g->target;
+    }
+
+    static int32_t position(void * user, int axis)
+    {
+        return static_cast<fake_glide *>(user)->pos;
+    }
+
+    static int rate(void * user, int axis, uint32_t speed)
+    {
+        fake_glide * g = static_cast<fake_glide *>(user);
+
+        g->speed = speed;
+        g->speeds.push_back(speed);
+        g->rates++;
+        return 0;
+    }
+
+    static uint32_t now(void * user)
+    {
+        return static_cast<fake_glide *>(user)->us;
+    }
+
+    static int stop(void * user, int axis)
+    {
+        fake_glide * g = static_cast<fake_glide *>(user);
+
+        g->target = g->pos;
+        g->stops++;
+        return 0;
+    }
+
+    void tick(uint32_t dt_us)
+    {
+        int32_t step = speed ? static_cast<int32_t>(static_cast<uint64_t>(speed) * dt_us / 1000000u) : INT32_MAX;
+        int32_t left = target - pos;
+
+        us += dt_us;
+        pos = (left > step) ? pos + step : (left < -step) ? pos - step : target;
+    }
+};
+
+//  ****************************************************************************
+TEST_CASE("Continuous sweep", "")
+{
+    static scpi_ctx_t ctx;
+    uint8_t * reply;
+    uint32_t event;
+    size_t reply_len;
+    int rc;
+
+    fake_glide glide;
+    fake_drive still;
+    fake_vna vna;
+    const hal_motion_t hal = { fake_glide::move, fake_glide::busy, &glide, fake_glide::position, fake_glide::rate, fake_glide::now, 0, fake_glide::stop };
+    const hal_vna_t vna_hal = { fake_vna::polarity, fake_vna::trigger, fake_vna::ready, &vna };
+
+    vna.drive = &still;
+
+    scpi_ctx_init(&ctx);
+    scpi_axis_reset();
+    scpi_motion_init(&hal);
+    scpi_sweep_init(&vna_hal);
+
+    //the motion task every millisecond; the VNA takes busy_ms per measurement
+    auto run = [&](int busy_ms)
+    {
+        int n = 0;
+        int busy = 0;
+
+        while ((scpi_motion_poll() | scpi_sweep_poll()) && n++ < 100000)
+        {
+            glide.tick(1000);
+
+            if (vna.measuring && ++busy >= busy_ms)
+            {
+                vna.measuring = FALSE;
+                busy = 0;
+            }
+        }
+    };
+
+    //every mark of the log, as { point, angle, time }
+    auto marks = [&]()
+    {
+        vector<vector<int64_t>> out;
+
+        for (;;)
+        {
+            TEST_CTX(ctx, ":SENS:SWE:LOG?");
+            REQUIRE(1 == rc);
+
+            char * p = reinterpret_cast<char *>(reply);
+            long count = strtol(p, &p, 10);
+
+            if (!count)
+                return out;
+
+            for (long i = 0; i < count; i++)
+            {
+                long point = strtol(p + 1, &p, 10);
+                double angle = strtod(p + 1, &p);
+                long us = strtol(p + 1, &p, 10);
+
+                out.push_back({ point, static_cast<int64_t>(angle * SCPI_ANGLE_SCALE + (angle < 0 ? -0.5 : 0.5)), us });
+            }
+        }
+    };
+
+    SECTION("The trigger fires as the axis crosses each point")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STAR 0;STOP 2;STEP 0.5;HOLD OFF;RATE 1;:INIT:IMM");
+        REQUIRE(2 == rc);
+
+        run(1);
+
+        REQUIRE(5 == vna.triggers);
+        REQUIRE(vector<int32_t>{ 0, SCPI_ANGLE_DEG(2) } == glide.path);
+        REQUIRE(2 == glide.rates);
+        REQUIRE((vector<uint32_t>{ SCPI_SWEEP_ANGLE_PER_RAD, 0 }) == glide.speeds);
+        REQUIRE(0u == glide.speed);
+        REQUIRE(0u == scpi_ops_pending());
+
+        vector<vector<int64_t>> log = marks();
+
+        REQUIRE(5u == log.size());
+
+        for (size_t i = 0; i < log.size(); i++)
+        {
+            REQUIRE(static_cast<int64_t>(i) == log[i][0]);
+            REQUIRE(log[i][1] >= static_cast<int64_t>(i) * 500);
+            REQUIRE(log[i][1] <  static_cast<int64_t>(i) * 500 + 58);         //one poll at 1 rad/s
+        }
+
+        //about 8.7 ms per half degree at 57.296 degree/s
+        REQUIRE(log[4][2] - log[0][2] >= 34000);
+        REQUIRE(log[4][2] - log[0][2] <= 38000);
+    }
+
+    SECTION("The rate takes fractions of a rad/s")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STAR 0;STOP 1;STEP 0.5;HOLD OFF;RATE 0.5;:INIT:IMM");
+        REQUIRE(2 == rc);
+
+        run(1);
+
+        REQUIRE(3 == vna.triggers);
+        REQUIRE((vector<uint32_t>{ SCPI_SWEEP_ANGLE_PER_RAD / 2, 0 }) == glide.speeds);
+
+        TEST_CTX(ctx, ":SENS:SWE:RATE 0.001");
+        REQUIRE(57u == scpi_sweep_config()->sweep_rate);
+        TEST_CTX(ctx, ":SENS:SWE:RATE MAX");
+        REQUIRE(SCPI_SWEEP_RATE_MAX == scpi_sweep_config()->sweep_rate);
+
+        TEST_CTX(ctx, ":SENS:SWE:RATE 255.5");
+        REQUIRE(0 > rc);
+        TEST_CTX(ctx, ":SENS:SWE:RATE -0.5");
+        REQUIRE(0 > rc);
+        TEST_CTX(ctx, ":SENS:SWE:RATE");
+        REQUIRE(0 > rc);
+        REQUIRE(k_scpi_err_out_of_range == scpi_error_pop(&ctx));
+        REQUIRE(k_scpi_err_out_of_range == scpi_error_pop(&ctx));
+        REQUIRE(k_scpi_err_missing_parameter == scpi_error_pop(&ctx));
+        REQUIRE(SCPI_SWEEP_RATE_MAX == scpi_sweep_config()->sweep_rate);
+    }
+
+    SECTION("ABORt halts the axis where it is")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STAR 0;STOP 30;STEP 1;HOLD OFF;RATE 1;:INIT:IMM");
+        REQUIRE(2 == rc);
+
+        for (int n = 0; n < 1000 && glide.pos < SCPI_ANGLE_DEG(5); n++)
+        {
+            scpi_motion_poll();
+            scpi_sweep_poll();
+            glide.tick(1000);
+            vna.measuring = FALSE;
+        }
+
+        REQUIRE(glide.pos >= SCPI_ANGLE_DEG(5));
+
+        TEST_CTX(ctx, ":ABOR");
+        REQUIRE(2 == rc);
+
+        run(1);
+
+        int32_t stopped = glide.pos;
+
+        for (int n = 0; n < 100; n++)
+            glide.tick(1000);
+
+        REQUIRE(stopped == glide.pos);
+        REQUIRE(stopped < SCPI_ANGLE_DEG(10));
+        REQUIRE(1 == glide.stops);
+        REQUIRE((vector<uint32_t>{ SCPI_SWEEP_ANGLE_PER_RAD, 0 }) == glide.speeds);
+        REQUIRE(0u == scpi_ops_pending());
+        REQUIRE(0u == (SCPI_OPER_SWEEPING & scpi_status_condition(k_scpi_reg_operation)));
+    }
+
+    SECTION("A busy VNA delays the trigger past the point")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STAR 0;STOP -2;STEP 0.5;HOLD OFF;RATE 1;:INIT:IMM");
+
+        run(20);
+
+        vector<vector<int64_t>> log = marks();
+
+        REQUIRE(5u == log.size());
+        REQUIRE(log[1][1] < -600);
+        REQUIRE(log[4][1] == SCPI_ANGLE_DEG(-2));
+    }
+
+    SECTION("Holding for the measurement logs each point where the axis stopped")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STAR 0;STOP 1;STEP 0.5;HOLD ON;:INIT:IMM");
+
+        run(3);
+
+        REQUIRE(vector<int32_t>{ 0, 500, 1000 } == glide.path);
+        REQUIRE(0 == glide.rates);
+
+        vector<vector<int64_t>> log = marks();
+
+        REQUIRE(3u == log.size());
+        REQUIRE((vector<int64_t>{ 1, 500 }) == vector<int64_t>(log[1].begin(), log[1].begin() + 2));
+        REQUIRE(log[2][2] > log[1][2]);
+
+        TEST_CTX(ctx, ":SENS:SWE:LOG?");
+        REQUIRE(REPLY_IS("0"));
+    }
+
+    SECTION("A full log drops marks and raises QUES")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STAR 0;STOP 10;STEP 0.1;HOLD OFF;RATE 0;:INIT:IMM");
+
+        run(0);
+
+        REQUIRE(101 == vna.triggers);
+        REQUIRE(0u != (SCPI_QUES_LOG & scpi_status_condition(k_scpi_reg_questionable)));
+        REQUIRE(static_cast<size_t>(SCPI_SWEEP_LOG_SZ) == marks().size());
+
+        //the next sweep starts a new log
+        TEST_CTX(ctx, ":INIT:IMM");
+        scpi_sweep_poll();
+        REQUIRE(0u == (SCPI_QUES_LOG & scpi_status_condition(k_scpi_reg_questionable)));
+    }
+
+    SECTION("A run that stops short ends the sweep")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STAR 0;STOP 2;STEP 0.5;HOLD OFF;RATE 1;:INIT:IMM");
+
+        scpi_sweep_poll();
+        scpi_motion_poll();
+        glide.tick(1000);
+        scpi_motion_poll();
+        scpi_sweep_poll();
+        scpi_motion_poll();
+        REQUIRE(SCPI_ANGLE_DEG(2) == glide.target);
+
+        //an end stop
+        glide.target = glide.pos = 100;
+
+        run(1);
+
+        REQUIRE(1 == vna.triggers);
+        REQUIRE(0u == scpi_ops_pending());
+        REQUIRE(0u == glide.speed);
+    }
+
+    scpi_sweep_init(0);
+    scpi_motion_init(0);
+    scpi_input_ctx(&ctx, reinterpret_cast<const uint8_t*>("*RST;*CLS;:STAT:PRES"), 20, &reply, &reply_len, &event);
+    scpi_status_clear(k_scpi_reg_operation, SCPI_OPER_VNA_READY);
+    scpi_axis_reset();
+}
+
+//  ****************************************************************************
+TEST_CASE("Pedestal simulator", "")
+{
+    static scpi_ctx_t ctx;
+    static hal_sim_t sim;
+    uint8_t * reply;
+    uint32_t event;
+    size_t reply_len;
+    int rc;
+
+    hal_sim_init(&sim);
+    scpi_ctx_init(&ctx);
+    scpi_axis_reset();
+    scpi_motion_init(&sim.motion);
+    scpi_sweep_init(&sim.vna_hal);
+
+    SECTION("A move follows the speed and acceleration limits")
+    {
+        TEST_CTX(ctx, ":INP:POS:A0:ANGL:IMM 90");
+        REQUIRE(2 == rc);
+
+        scpi_motion_poll();
+        hal_sim_advance(&sim, 500000);
+
+        //half a second at 60 degree/s^2 reaches the 30 degree/s top speed after 7.5 degree
+        REQUIRE(sim.axis[0].vel == Approx(SCPI_ANGLE_DEG(30)).epsilon(0.01));
+        REQUIRE(sim.axis[0].pos == Approx(SCPI_ANGLE_DEG(7.5)).epsilon(0.02));
+
+        uint64_t us = hal_sim_run(&sim, 1000, 60000000u);
+
+        //7.5 degree up, 75 at top speed, 7.5 down: 3.5 s in all
+        REQUIRE(sim.now_us == Approx(3500000).epsilon(0.01));
+        REQUIRE(us < 60000000u);
+        REQUIRE(SCPI_ANGLE_DEG(90) == sim.motion.position(sim.motion.user, 0));
+        REQUIRE(0.0 == sim.axis[0].vel);
+        REQUIRE(0u == scpi_ops_pending());
+    }
+
+    SECTION("A limit switch stops the axis and raises QUES")
+    {
+        TEST_CTX(ctx, ":INP:POS:A1:ANGL:LIM:STAT OFF;:INP:POS:A1:ANGL:IMM 400");
+        hal_sim_run(&sim, 1000, 60000000u);
+
+        REQUIRE(SCPI_ANGLE_DEG(370) == sim.motion.position(sim.motion.user, 1));
+        REQUIRE(0u != (SCPI_QUES_LIMIT & scpi_status_condition(k_scpi_reg_questionable)));
+
+        TEST_CTX(ctx, ":INP:POS:A1:ANGL:IMM 0");
+        hal_sim_run(&sim, 1000, 60000000u);
+
+        REQUIRE(0 == sim.motion.position(sim.motion.user, 1));
+        REQUIRE(0u == (SCPI_QUES_LIMIT & scpi_status_condition(k_scpi_reg_questionable)));
+    }
+
+    SECTION("A stop-and-go sweep in virtual time")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STAR 0;STOP 10;STEP 1;HOLD ON;:INIT:IMM");
+        REQUIRE(2 == rc);
+
+        uint64_t us = hal_sim_run(&sim, 1000, 600000000u);
+
+        REQUIRE(11u == sim.vna.triggers);
+        REQUIRE(0u == sim.vna.missed);
+        REQUIRE(SCPI_ANGLE_DEG(10) == sim.motion.position(sim.motion.user, 0));
+        REQUIRE(0u == scpi_ops_pending());
+
+        //ten 1 degree moves of 2 * sqrt(1 / 60) s, eleven 20 ms measurements
+        REQUIRE(us == Approx(10 * 258200 + 11 * 20000).epsilon(0.05));
+    }
+
+    SECTION("A continuous sweep is set by the rotation speed")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STAR 0;STOP 30;STEP 1;HOLD OFF;RATE 0;:INIT:IMM");
+
+        uint64_t us = hal_sim_run(&sim, 1000, 600000000u);
+
+        REQUIRE(31u == sim.vna.triggers);
+        REQUIRE(0u == sim.vna.missed);
+        REQUIRE(0u == (SCPI_QUES_LOG & scpi_status_condition(k_scpi_reg_questionable)));
+
+        //30 degree at 30 degree/s plus the speed-up and braking
+        REQUIRE(us > 1000000u);
+        REQUIRE(us < 1600000u);
+    }
+
+    SECTION("Virtual time runs far faster than real time")
+    {
+        TEST_CTX(ctx, ":SENS:SWE:STAR -180;STOP 180;STEP 1;HOLD ON;:INIT:IMM");
+
+        auto t0 = chrono::steady_clock::now();
+        uint64_t us = hal_sim_run(&sim, 1000, 3600000000u);
+        auto real_us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - t0).count();
+
+        REQUIRE(361u == sim.vna.triggers);
+        REQUIRE(us > 60000000u);
+        //thousands of times in an optimised build; leave room for coverage instrumentation
+        REQUIRE(static_cast<uint64_t>(real_us) * 100 < us);
+    }
+
+    SECTION("The VNA sweep time follows the chosen distribution")
+    {
+        //sorted draws from the VNA model
+        auto draw = [&](hal_sim_latency_t latency, uint64_t seed)
+        {
+            vector<uint32_t> out;
+
+            sim.vna.latency   = latency;
+            sim.vna.sweep_us  = 20000;
+            sim.vna.spread_us = 5000;
+            sim.vna.seed      = seed;
+
+            for (int i = 0; i < 20000; i++)
+                out.push_back(hal_sim_vna_latency(&sim.vna));
+
+            sort(out.begin(), out.end());
+            return out;
+        };
+
+        vector<uint32_t> fixed = draw(k_hal_sim_latency_fixed, 1);
+        REQUIRE(20000u == fixed.front());
+        REQUIRE(20000u == fixed.back());
+
+        vector<uint32_t> normal = draw(k_hal_sim_latency_normal, 1);
+        double sum = 0;
+        double sq = 0;
+
+        for (uint32_t us : normal)
+        {
+            sum += us;
+            sq  += static_cast<double>(us) * us;
+        }
+
+        double mean = sum / normal.size();
+
+        REQUIRE(mean == Approx(20000).epsilon(0.01));
+        REQUIRE(sqrt(sq / normal.size() - mean * mean) == Approx(5000).epsilon(0.05));
+
+        //lognormal, sigma 0.25: the median stays at 20 ms, the 99th percentile is 20 * e^(0.25 * 2.326) ms
+        vector<uint32_t> tail = draw(k_hal_sim_latency_long_tail, 1);
+
+        REQUIRE(tail[tail.size() / 2] == Approx(20000).epsilon(0.02));
+        REQUIRE(tail[tail.size() * 99 / 100] == Approx(35770).epsilon(0.05));
+        REQUIRE(tail[tail.size() * 99 / 100] > normal[normal.size() * 99 / 100]);
+
+        //the same seed gives the same run
+        REQUIRE(tail == draw(k_hal_sim_latency_long_tail, 1));
+        REQUIRE(tail != draw(k_hal_sim_latency_long_tail, 2));
+    }
+
+    SECTION("A long-tail VNA slows the sweep but no trigger is lost")
+    {
+        sim.vna.latency   = k_hal_sim_latency_long_tail;
+        sim.vna.spread_us = 20000;
+
+        TEST_CTX(ctx, ":SENS:SWE:STAR 0;STOP 30;STEP 1;HOLD OFF;RATE 0;:INIT:IMM");
+
+        uint64_t us = hal_sim_run(&sim, 1000, 600000000u);
+
+        REQUIRE(31u == sim.vna.triggers);
+        REQUIRE(0u == sim.vna.missed);
+        REQUIRE(sim.vna.busy_us < us);
+        REQUIRE(0u == scpi_ops_pending());
+    }
+
+    scpi_sweep_init(0);
+    scpi_motion_init(0);
+    scpi_input_ctx(&ctx, reinterpret_cast<const uint8_t*>("*RST;*CLS;:STAT:PRES"), 20, &reply, &reply_len, &event);
+    scpi_status_clear(k_scpi_reg_operation, SCPI_OPER_VNA_READY);
+    scpi_axis_reset();
+}
@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+"""Generates inc/scpi_root_hash.h, the minimal perfect hash used by
+scpi_menu_root_sm() to map a root menu token to its single candidate node.
+
+Every short and long form of every root keyword gets its own slot, so a
+token hashes to exactly one entry and one compare verifies it.  The root
+menu is read from inc/scpi_tree.def; re-run after adding a root command:
+
+    python3 tools/gen_root_hash.py > inc/scpi_root_hash.h
+"""
+
+import os
+import random
+import re
+import sys
+
+TREE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "inc", "scpi_tree.def")
+
+KEYWORD_RE = re.compile(r'^SCPI_KEYWORD\(\s*(\w+)\s*,\s*"([^"]*)"\s*,\s*"([^"]*)"\s*\)')
+NODE_RE    = re.compile(r'^SCPI_(MENU|LEAF)\(\s*(\w+)\s*,\s*(\w+)\s*,\s*(\w+)\s*,\s*(\w+)\s*\)')
+
+
+def load_root(path):
+    """Root menu entries from scpi_tree.def:
+    (keyword enum, short form, long form, command state, command rc, query state)
+    rc 0 = continue into a sub-menu, 2 = complete command"""
+    keywords = {}
+    root = {}
+    order = []
+
+    with open(path) as f:
+        for line in f:
+            m = KEYWORD_RE.match(line.strip())
+            if m:
+                keywords[m.group(1)] = (m.group(2), m.group(3))
+                continue
+
+            m = NODE_RE.match(line.strip())
+            if not m:
+                continue
+
+            kind, name, parent, keyword, arg = m.groups()
+            if parent != "root_none" or name == "root_none":
+                continue
+
+            if keyword not in root:
+                root[keyword] = [None, None, None]
+                order.append(keyword)
+
+            if kind == "MENU":
+                root[keyword][0], root[keyword][1] = "k_scpi_" + name, 0
+            elif arg == "SCPI_NODE_QUERY":
+                root[keyword][2] = "k_scpi_" + name
+            else:
+                root[keyword][0], root[keyword][1] = "k_scpi_" + name, 2
+
+    return [("k_scpi_str_" + kw, keywords[kw][0], keywords[kw][1]) + tuple(root[kw]) for kw in order]
+
+
+ROOT = load_root(TREE)
+
+MASK32 = 0xFFFFFFFF
+
+
+def fold(c):
+    return ord(c) | 0x20
+
+
+def root_key(form):
+    """Must match scpi_root_key() in scpi.c"""
+    return (  fold(form[0])
+            | fold(form[1]) << 8
+            | fold(form[2]) << 16
+            | fold(form[-1]) << 24) + len(form) & MASK32
+
+
+def search(keys, bucket_bits):
+    n = len(keys)
+    rng = random.Random(0x5C91)
+
+    for _ in range(100000):
+        s1 = rng.getrandbits(32) | 1
+        s2 = rng.getrandbits(32) | 1
+
+        buckets = [[] for _ in range(1 << bucket_bits)]
+        for k in keys:
+            buckets[((k * s1) & MASK32) >> (32 - bucket_bits)].append(k)
+
+        disp = [0] * len(buckets)
+        used = {}
+        ok = True
+
+        for b in sorted(range(len(buckets)), key=lambda i: -len(buckets[i])):
+            if not buckets[b]:
+                continue
+            for d in range(256):
+                slots = [((((k * s2) & MASK32) >> 16) + d) % n for k in buckets[b]]
+                if len(set(slots)) == len(slots) and not any(s in used for s in slots):
+                    disp[b] = d
+                    for k, s in zip(buckets[b], slots):
+                        used[s] = k
+                    break
+            else:
+                ok = False
+                break
+
+        if ok:
+            return s1, s2, disp, used
+
+    raise SystemExit("no perfect hash found; raise the bucket count")
+
+
+def main():
+    forms = {}
+    for entry in ROOT:
+        for form in (entry[1], entry[2]):
+            forms[root_key(form)] = entry
+
+    if len(forms) != len(set(f for e in ROOT for f in (e[1], e[2]))):
+        raise SystemExit("root key collision; extend root_key()")
+
+    keys = sorted(forms)
+    bucket_bits = max(1, (len(keys) // 2 - 1).bit_length())
+    s1, s2, disp, used = search(keys, bucket_bits)
+
+    out = sys.stdout
+    out.write("/// @file scpi_root_hash.h\n")
+    out.write("///\n")
+    out.write("/// Minimal perfect hash over the root menu keywords (short and long forms).\n")
+    out.write("/// Generated by tools/gen_root_hash.py -- do not edit by hand.\n")
+    out.write("///\n\n")
+    out.write("#ifndef INC_SCPI_ROOT_HASH_H_\n#define INC_SCPI_ROOT_HASH_H_\n\n")
+    out.write("#define SCPI_ROOT_HASH_SZ           %du\n" % len(keys))
+    out.write("#define SCPI_ROOT_HASH_BUCKET_BITS  %du\n" % bucket_bits)
+    out.write("#define SCPI_ROOT_HASH_SEED1        0x%08xu\n" % s1)
+    out.write("#define SCPI_ROOT_HASH_SEED2        0x%08xu\n\n" % s2)
+    out.write("static const uint8_t s_root_hash_disp[1u << SCPI_ROOT_HASH_BUCKET_BITS] =\n{\n    ")
+    out.write(", ".join("%d" % d for d in disp))
+    out.write("\n};\n\n")
+    out.write("static const scpi_root_node_t s_root_hash[SCPI_ROOT_HASH_SZ] =\n{\n")
+    rows = []
+    for slot in range(len(keys)):
+        kw, sf, lf, state, rc, qstate = forms[used[slot]]
+        form = sf if root_key(sf) == used[slot] else lf
+        rows.append("    /* %-10s */ { %-20s, %-22s, %d, %-19s }" % (
+            '"%s"' % form, kw, state or "k_scpi_root_none", rc or 0, qstate or "k_scpi_root_none"))
+    out.write(",\n".join(rows))
+    out.write("\n};\n\n#endif /* INC_SCPI_ROOT_HASH_H_ */\n")
+
+
+if __name__ == "__main__":
+    main()